@@ -0,0 +1,315 @@
+/**
+@file benchmarks.cpp
+@brief Google Benchmark suite for the classification building blocks and end-to-end throughput.
+
+Run with --benchmark_format=json (or --benchmark_out=FILE --benchmark_out_format=json) for
+machine-readable results. Every benchmark reports bytes per second, so runs on different corpora
+stay comparable.
+*/
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unistd.h>
+#include "ahoCorasick.h"
+#include "catalog.h"
+#include "corpus.h"
+#include "directoryWalker.h"
+#include "documentReader.h"
+#include "prefilter.h"
+#include "resultFile.h"
+#include "threadPool.h"
+#include "wordMatcher.h"
+
+namespace {
+
+constexpr size_t textBytes = 4 << 20; ///< Size of the in-memory text the matcher benchmarks scan.
+
+/**
+ * @brief A catalog, its compiled matchers and a text, generated once per term density.
+ */
+struct Workload {
+    explicit Workload(double termDensity) : generator(optionsFor(termDensity))
+    {
+        catalogText = generator.catalog();
+        catalog = Catalog(catalogText);
+        matcher = AhoCorasick(catalog);
+        wordMatcher = WordMatcher(matcher);
+        for (size_t index = 0; text.size() < textBytes; ++index) {
+            text += generator.document(index);
+        }
+    }
+
+    static CorpusOptions optionsFor(double termDensity)
+    {
+        CorpusOptions options;
+        options.termDensity = termDensity;
+        options.sizes = SizeDistribution::Fixed;
+        options.meanSize = 64 << 10;
+        options.topics = 50;
+        options.termsPerTopic = 200;
+        return options;
+    }
+
+    CorpusGenerator generator;
+    std::string catalogText;
+    Catalog catalog;
+    AhoCorasick matcher;
+    WordMatcher wordMatcher;
+    std::string text;
+};
+
+/**
+ * @brief The workload for a density given in terms per thousand words.
+ */
+Workload& workload(int64_t termsPerMille)
+{
+    static std::map<int64_t, std::unique_ptr<Workload>> workloads;
+    auto& slot = workloads[termsPerMille];
+    if (!slot) {
+        slot = std::make_unique<Workload>(static_cast<double>(termsPerMille) / 1000);
+    }
+    return *slot;
+}
+
+const prefilter::Kernel kernels[] = {prefilter::Kernel::Off, prefilter::Kernel::Scalar, prefilter::Kernel::Sse42,
+                                     prefilter::Kernel::Avx2, prefilter::Kernel::Neon};
+const char* const kernelNames[] = {"off", "scalar", "sse4.2", "avx2", "neon"};
+
+void BM_ForEachToken(benchmark::State& state)
+{
+    const std::string& text = workload(10).catalogText;
+    for (auto _ : state) {
+        size_t tokens = 0;
+        forEachToken(text, "\n", [&](std::string_view line) {
+            forEachToken(line, ",", [&](std::string_view) { ++tokens; });
+        });
+        benchmark::DoNotOptimize(tokens);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_ForEachToken);
+
+void BM_ForEachWord(benchmark::State& state)
+{
+    const std::string& text = workload(10).text;
+    for (auto _ : state) {
+        size_t words = 0;
+        forEachWord(text, [&](std::string_view) { ++words; });
+        benchmark::DoNotOptimize(words);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_ForEachWord);
+
+void BM_CatalogParse(benchmark::State& state)
+{
+    const std::string& text = workload(10).catalogText;
+    for (auto _ : state) {
+        Catalog catalog(text);
+        benchmark::DoNotOptimize(catalog.topicCount());
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_CatalogParse);
+
+void BM_CatalogCompile(benchmark::State& state)
+{
+    const Workload& load = workload(10);
+    for (auto _ : state) {
+        AhoCorasick matcher(load.catalog);
+        benchmark::DoNotOptimize(matcher.imageSize());
+    }
+    state.SetBytesProcessed(state.iterations() * load.catalogText.size());
+}
+BENCHMARK(BM_CatalogCompile)->Unit(benchmark::kMillisecond);
+
+/**
+ * @brief Substring matcher on an in-memory text; arguments are the prefilter kernel and the
+ *        term density in terms per thousand words.
+ */
+void BM_MatchSubstring(benchmark::State& state)
+{
+    prefilter::Kernel kernel = kernels[state.range(0)];
+    if (!prefilter::isSupported(kernel)) {
+        state.SkipWithError("kernel not supported on this CPU");
+        return;
+    }
+    Workload& load = workload(state.range(1));
+    load.matcher.setPrefilter(kernel);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(load.matcher.countTopics(load.text));
+    }
+    load.matcher.setPrefilter(prefilter::Kernel::Auto);
+    state.SetLabel(kernelNames[state.range(0)]);
+    state.SetBytesProcessed(state.iterations() * load.text.size());
+}
+BENCHMARK(BM_MatchSubstring)->ArgsProduct({{0, 1, 2, 3, 4}, {1, 10, 50}})->Unit(benchmark::kMillisecond);
+
+/**
+ * @brief Substring matcher fed in chunks of the given size, as with --stream-chunk.
+ */
+void BM_MatchStreaming(benchmark::State& state)
+{
+    const Workload& load = workload(10);
+    const size_t chunk = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        AhoCorasick::StreamCounter counter(load.matcher);
+        for (size_t offset = 0; offset < load.text.size(); offset += chunk) {
+            counter.feed(std::string_view(load.text).substr(offset, chunk));
+        }
+        benchmark::DoNotOptimize(counter.topicCounts());
+    }
+    state.SetBytesProcessed(state.iterations() * load.text.size());
+}
+BENCHMARK(BM_MatchStreaming)->Arg(4 << 10)->Arg(64 << 10)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+
+/**
+ * @brief Substring matcher compiled with case folding; the argument is the CaseFold value.
+ */
+void BM_MatchCaseFold(benchmark::State& state)
+{
+    const Workload& load = workload(10);
+    AhoCorasick matcher(load.catalog, true, static_cast<CaseFold>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(matcher.countTopics(load.text));
+    }
+    state.SetLabel(state.range(0) == 0 ? "none" : state.range(0) == 1 ? "ascii" : "unicode");
+    state.SetBytesProcessed(state.iterations() * load.text.size());
+}
+BENCHMARK(BM_MatchCaseFold)->Arg(0)->Arg(1)->Arg(2)->Unit(benchmark::kMillisecond);
+
+/**
+ * @brief Whole-word engine; the argument is the term density in terms per thousand words.
+ */
+void BM_MatchWords(benchmark::State& state)
+{
+    const Workload& load = workload(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(load.wordMatcher.countTopics(load.text));
+    }
+    state.SetBytesProcessed(state.iterations() * load.text.size());
+}
+BENCHMARK(BM_MatchWords)->Arg(1)->Arg(10)->Arg(50)->Unit(benchmark::kMillisecond);
+
+/**
+ * @brief Writes the counts of 100000 documents over 50 topics, three non-zero per document, with
+ *        the given CountEncoding, then reads every count back from the mapped file.
+ */
+void BM_ResultFile(benchmark::State& state)
+{
+    const CountEncoding encoding = static_cast<CountEncoding>(state.range(0));
+    const size_t documents = 100000;
+    const size_t topics = 50;
+    std::vector<std::string> names;
+    for (size_t topic = 0; topic < topics; ++topic) {
+        names.push_back(CorpusGenerator::topicName(topic));
+    }
+    std::string path = (std::filesystem::temp_directory_path() / ("dcat-results-" + std::to_string(::getpid()))).string();
+    std::vector<uint32_t> counts(topics, 0);
+    uint64_t sum = 0;
+    for (auto _ : state) {
+        {
+            ResultFileWriter writer(path, names, encoding);
+            for (size_t document = 0; document < documents; ++document) {
+                std::fill(counts.begin(), counts.end(), 0);
+                for (size_t term = 0; term < 3; ++term) {
+                    counts[(document * 7 + term * 13) % topics] = static_cast<uint32_t>(document % 100 + term);
+                }
+                writer.add("documents/document_" + std::to_string(document) + ".txt", counts.data());
+            }
+        }
+        ResultFileReader reader(path);
+        for (size_t document = 0; document < reader.documentCount(); ++document) {
+            reader.forEachCount(document, [&](size_t, uint32_t count) { sum += count; });
+        }
+    }
+    benchmark::DoNotOptimize(sum);
+    state.SetItemsProcessed(state.iterations() * documents);
+    state.SetBytesProcessed(state.iterations() * std::filesystem::file_size(path));
+    std::filesystem::remove(path);
+    state.SetLabel(state.range(0) == 0 ? "dense" : state.range(0) == 1 ? "sparse" : "packed");
+}
+BENCHMARK(BM_ResultFile)->Arg(0)->Arg(1)->Arg(2)->Unit(benchmark::kMillisecond);
+
+/**
+ * @brief A corpus written to a temporary directory once and removed at exit.
+ */
+struct CorpusOnDisk {
+    CorpusOnDisk()
+    {
+        root = std::filesystem::temp_directory_path() / ("dcat-benchmark-" + std::to_string(::getpid()));
+        CorpusOptions options;
+        options.documents = 2000;
+        options.meanSize = 16 << 10;
+        options.topics = 50;
+        options.termsPerTopic = 200;
+        CorpusGenerator generator(options);
+        catalog = Catalog(generator.catalog());
+        matcher = AhoCorasick(catalog);
+        for (size_t index = 0; index < options.documents; ++index) {
+            std::filesystem::path folder = root / CorpusGenerator::topicName(generator.mainTopic(index));
+            std::filesystem::create_directories(folder);
+            std::string text = generator.document(index);
+            std::ofstream(folder / ("document_" + std::to_string(index) + ".txt"), std::ios::binary) << text;
+            bytes += text.size();
+        }
+        documents = options.documents;
+    }
+
+    ~CorpusOnDisk()
+    {
+        std::error_code error;
+        std::filesystem::remove_all(root, error);
+    }
+
+    std::filesystem::path root;
+    Catalog catalog;
+    AhoCorasick matcher;
+    size_t documents = 0;
+    uintmax_t bytes = 0;
+};
+
+CorpusOnDisk& corpusOnDisk()
+{
+    static CorpusOnDisk corpus;
+    return corpus;
+}
+
+/**
+ * @brief Walks the corpus tree, maps every document and counts its topics on a pool of the
+ *        given number of threads: the work of the single-process classifier without its output.
+ */
+void BM_EndToEnd(benchmark::State& state)
+{
+    CorpusOnDisk& corpus = corpusOnDisk();
+    const size_t threads = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        WorkStealingPool pool(threads);
+        std::vector<std::vector<uint32_t>> results(pool.size(), std::vector<uint32_t>(corpus.matcher.topicCount(), 0));
+        forEachFileInTree(corpus.root.string(), {".txt"}, 1, [&](std::string path) {
+            pool.submit([&corpus, &results, path = std::move(path)](size_t worker) {
+                MappedDocument document(path);
+                std::vector<uint32_t> counts = corpus.matcher.countTopics(document.text());
+                for (size_t topic = 0; topic < counts.size(); ++topic) {
+                    results[worker][topic] += counts[topic];
+                }
+            });
+        });
+        pool.wait();
+        benchmark::DoNotOptimize(results);
+    }
+    state.SetBytesProcessed(state.iterations() * corpus.bytes);
+    state.SetItemsProcessed(state.iterations() * corpus.documents);
+}
+BENCHMARK(BM_EndToEnd)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,207 @@
+/**
+ * @file corpus.h
+ * @brief Deterministic synthetic catalogs and documents for benchmarking.
+ * @details Filler words are drawn from a vocabulary with a Zipf distribution, as in natural text,
+ *          so the matcher sees a realistic mix of frequent short words and a long tail rather than
+ *          a few repeated strings. Every document leans towards one topic: most catalog terms in it
+ *          come from that topic, the rest from any topic. Everything is derived from the seed with
+ *          a fixed generator and no std distributions, so a corpus is identical on every platform.
+ */
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief How document sizes are spread around the mean.
+ */
+enum class SizeDistribution {
+    Fixed,     ///< Every document has the mean size.
+    Uniform,   ///< Uniform between 0 and twice the mean.
+    LogNormal  ///< Log-normal with the given spread; a few large documents and many small ones.
+};
+
+/**
+ * @brief Parameters of a synthetic corpus.
+ */
+struct CorpusOptions {
+    size_t documents = 1000;       ///< Number of documents.
+    size_t meanSize = 16384;       ///< Mean document size in bytes.
+    SizeDistribution sizes = SizeDistribution::LogNormal;
+    double sizeSpread = 1.0;       ///< Sigma of the log-normal size distribution.
+    size_t vocabulary = 20000;     ///< Distinct filler words.
+    size_t topics = 20;            ///< Topics in the catalog.
+    size_t termsPerTopic = 50;     ///< Terms per topic.
+    double multiWordTerms = 0.2;   ///< Fraction of terms made of two words.
+    double termDensity = 0.01;     ///< Fraction of words in a document that are catalog terms.
+    double topicFocus = 0.7;       ///< Fraction of a document's terms taken from its main topic.
+    uint64_t seed = 1;
+};
+
+inline SizeDistribution parseSizeDistribution(std::string_view name)
+{
+    if (name == "fixed") {
+        return SizeDistribution::Fixed;
+    }
+    if (name == "uniform") {
+        return SizeDistribution::Uniform;
+    }
+    if (name == "lognormal") {
+        return SizeDistribution::LogNormal;
+    }
+    throw std::invalid_argument("Unknown size distribution: " + std::string(name));
+}
+
+/**
+ * @brief Generates the catalog and the documents of a corpus on demand.
+ */
+class CorpusGenerator {
+public:
+    explicit CorpusGenerator(const CorpusOptions& options) : options_(options)
+    {
+        std::mt19937_64 random(options_.seed);
+        std::unordered_set<std::string> used;
+        auto freshWord = [&](size_t minLength, size_t maxLength) {
+            while (true) {
+                std::string word = randomWord(random, minLength, maxLength);
+                if (used.insert(word).second) {
+                    return word;
+                }
+            }
+        };
+
+        vocabulary_.reserve(options_.vocabulary);
+        for (size_t i = 0; i < options_.vocabulary; ++i) {
+            vocabulary_.push_back(freshWord(2, 10));
+        }
+        // Zipf weights with exponent 1: the k-th most frequent word has weight 1 / k.
+        cumulative_.reserve(vocabulary_.size());
+        double total = 0;
+        for (size_t rank = 1; rank <= vocabulary_.size(); ++rank) {
+            total += 1.0 / static_cast<double>(rank);
+            cumulative_.push_back(total);
+        }
+
+        terms_.resize(options_.topics);
+        for (size_t topic = 0; topic < options_.topics; ++topic) {
+            for (size_t i = 0; i < options_.termsPerTopic; ++i) {
+                std::string term = freshWord(4, 12);
+                if (unit(random) < options_.multiWordTerms) {
+                    term += ' ';
+                    term += freshWord(4, 12);
+                }
+                terms_[topic].push_back(std::move(term));
+            }
+        }
+    }
+
+    size_t topicCount() const { return terms_.size(); }
+
+    static std::string topicName(size_t topic) { return "topic" + std::to_string(topic); }
+
+    /**
+     * @brief The catalog in the repository format, one "Topic@%term,term,..." line per topic.
+     */
+    std::string catalog() const
+    {
+        std::string text;
+        for (size_t topic = 0; topic < terms_.size(); ++topic) {
+            text += topicName(topic);
+            text += "@%";
+            for (size_t i = 0; i < terms_[topic].size(); ++i) {
+                if (i > 0) {
+                    text += ',';
+                }
+                text += terms_[topic][i];
+            }
+            text += '\n';
+        }
+        return text;
+    }
+
+    /**
+     * @brief The topic that most terms of a document come from.
+     */
+    size_t mainTopic(size_t index) const { return terms_.empty() ? 0 : index % terms_.size(); }
+
+    /**
+     * @brief Generates one document; the same index always gives the same document.
+     */
+    std::string document(size_t index) const
+    {
+        std::mt19937_64 random(options_.seed ^ (0x9e3779b97f4a7c15ULL * (index + 1)));
+        size_t size = documentSize(random);
+        std::string text;
+        text.reserve(size + 32);
+        size_t wordsOnLine = 0;
+        while (text.size() < size) {
+            if (!terms_.empty() && unit(random) < options_.termDensity) {
+                size_t topic = unit(random) < options_.topicFocus ? mainTopic(index) : random() % terms_.size();
+                text += terms_[topic][random() % terms_[topic].size()];
+            } else if (!vocabulary_.empty()) {
+                text += fillerWord(random);
+            }
+            // Lines of about a dozen words, like prose with hard line breaks.
+            if (++wordsOnLine >= 12 && random() % 4 == 0) {
+                text += '\n';
+                wordsOnLine = 0;
+            } else {
+                text += ' ';
+            }
+        }
+        return text;
+    }
+
+private:
+    static double unit(std::mt19937_64& random) { return static_cast<double>(random() >> 11) * 0x1.0p-53; }
+
+    static std::string randomWord(std::mt19937_64& random, size_t minLength, size_t maxLength)
+    {
+        size_t length = minLength + random() % (maxLength - minLength + 1);
+        std::string word(length, 'a');
+        for (char& c : word) {
+            c = static_cast<char>('a' + random() % 26);
+        }
+        return word;
+    }
+
+    const std::string& fillerWord(std::mt19937_64& random) const
+    {
+        double target = unit(random) * cumulative_.back();
+        size_t rank = std::lower_bound(cumulative_.begin(), cumulative_.end(), target) - cumulative_.begin();
+        return vocabulary_[std::min(rank, vocabulary_.size() - 1)];
+    }
+
+    size_t documentSize(std::mt19937_64& random) const
+    {
+        double mean = static_cast<double>(options_.meanSize);
+        switch (options_.sizes) {
+        case SizeDistribution::Fixed:
+            return options_.meanSize;
+        case SizeDistribution::Uniform:
+            return static_cast<size_t>(unit(random) * 2 * mean);
+        case SizeDistribution::LogNormal:
+            break;
+        }
+        // Box-Muller; mu is chosen so that the mean of the distribution is meanSize.
+        double sigma = options_.sizeSpread;
+        double normal = std::sqrt(-2 * std::log(1 - unit(random))) * std::cos(2 * M_PI * unit(random));
+        return static_cast<size_t>(std::exp(std::log(mean) - sigma * sigma / 2 + sigma * normal));
+    }
+
+    CorpusOptions options_;
+    std::vector<std::string> vocabulary_;
+    std::vector<double> cumulative_;
+    std::vector<std::vector<std::string>> terms_;
+};
+
+#endif // CORPUS_H
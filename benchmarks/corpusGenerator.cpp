@@ -0,0 +1,96 @@
+/**
+@file corpusGenerator.cpp
+@brief Writes a synthetic catalog and document tree for benchmarking the classifiers.
+*/
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "corpus.h"
+
+/**
+ * @brief Parses the command line.
+ * @details Supported options (defaults in CorpusOptions):
+ *          --output DIR            where catalog.txt and documents/ are written (default ./corpus)
+ *          --documents N           number of documents
+ *          --mean-size B           mean document size in bytes
+ *          --sizes fixed|uniform|lognormal   document size distribution
+ *          --size-spread S         sigma of the log-normal distribution
+ *          --vocabulary N          distinct filler words
+ *          --topics N              topics in the catalog
+ *          --terms-per-topic N     terms per topic
+ *          --multi-word F          fraction of two-word terms
+ *          --term-density F        fraction of words that are catalog terms
+ *          --topic-focus F         fraction of a document's terms from its main topic
+ *          --seed N                seed of the generator
+ */
+CorpusOptions parseArguments(int argc, char** argv, std::string& output) {
+    CorpusOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (i + 1 >= argc) {
+            throw std::invalid_argument("Missing value for " + std::string(arg));
+        }
+        std::string value = argv[++i];
+        if (arg == "--output") {
+            output = value;
+        } else if (arg == "--documents") {
+            options.documents = std::stoul(value);
+        } else if (arg == "--mean-size") {
+            options.meanSize = std::stoul(value);
+        } else if (arg == "--sizes") {
+            options.sizes = parseSizeDistribution(value);
+        } else if (arg == "--size-spread") {
+            options.sizeSpread = std::stod(value);
+        } else if (arg == "--vocabulary") {
+            options.vocabulary = std::stoul(value);
+        } else if (arg == "--topics") {
+            options.topics = std::stoul(value);
+        } else if (arg == "--terms-per-topic") {
+            options.termsPerTopic = std::stoul(value);
+        } else if (arg == "--multi-word") {
+            options.multiWordTerms = std::stod(value);
+        } else if (arg == "--term-density") {
+            options.termDensity = std::stod(value);
+        } else if (arg == "--topic-focus") {
+            options.topicFocus = std::stod(value);
+        } else if (arg == "--seed") {
+            options.seed = std::stoull(value);
+        } else {
+            throw std::invalid_argument("Unknown argument: " + std::string(arg));
+        }
+    }
+    return options;
+}
+
+int main(int argc, char** argv) {
+    std::string output = "corpus";
+    CorpusOptions options = parseArguments(argc, argv, output);
+    CorpusGenerator generator(options);
+
+    std::filesystem::create_directories(output);
+    std::ofstream catalogFile(std::filesystem::path(output) / "catalog.txt", std::ios::binary);
+    catalogFile << generator.catalog();
+
+    // One folder per main topic, like the per-category folders of generateSampleTexts.sh
+    uintmax_t totalBytes = 0;
+    for (size_t index = 0; index < options.documents; ++index) {
+        std::filesystem::path folder =
+            std::filesystem::path(output) / "documents" / CorpusGenerator::topicName(generator.mainTopic(index));
+        std::filesystem::create_directories(folder);
+        std::string text = generator.document(index);
+        std::ofstream documentFile(folder / ("document_" + std::to_string(index) + ".txt"), std::ios::binary);
+        documentFile << text;
+        if (!documentFile) {
+            std::cerr << "Error writing document " << index << "!" << std::endl;
+            return 1;
+        }
+        totalBytes += text.size();
+    }
+    std::cout << "Wrote " << options.documents << " documents (" << totalBytes << " bytes) and a catalog of "
+              << options.topics << " topics to " << output << std::endl;
+    return 0;
+}
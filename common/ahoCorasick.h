@@ -0,0 +1,896 @@
+/**
+ * @file ahoCorasick.h
+ * @brief Aho-Corasick automaton compiled from the whole topic catalog.
+ * @details Every identifier of every topic is added to a single automaton, so a document
+ *          is scanned once no matter how many identifiers the catalog has. Hits are mapped
+ *          back to per-topic counters through a pattern -> topic table.
+ *
+ *          The compiled automaton lives in one flat, position-independent image (see
+ *          AhoCorasick::imageData). The image can be broadcast or stored as raw bytes and used
+ *          again by AhoCorasick::fromImage without any parsing.
+ */
+#ifndef AHO_CORASICK_H
+#define AHO_CORASICK_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "caseFold.h"
+#include "catalog.h"
+#include "prefilter.h"
+
+/**
+ * @brief How occurrences of a single identifier are counted.
+ * @details NonOverlapping reproduces the original std::string::find loop, which restarts the
+ *          search after the end of every hit ("aa" is found once in "aaa").
+ *          Overlapping counts every position an identifier ends at ("aa" is found twice in "aaa").
+ *          In both modes different identifiers are counted independently of each other.
+ */
+enum class MatchMode {
+    NonOverlapping,
+    Overlapping
+};
+
+/**
+ * @brief Where a counted occurrence was found, for highlighting.
+ * @details begin and end (exclusive) are byte offsets into the document as stored, line breaks
+ *          included. An occurrence credited to several topics is reported once per topic.
+ */
+struct MatchPosition {
+    uint32_t topic;
+    size_t begin;
+    size_t end;
+};
+
+/**
+ * @brief Multi-pattern matcher over the identifiers of a catalog.
+ * @details The automaton is stored as a dense transition table over byte classes: bytes that
+ *          appear in some identifier get their own class, every other byte shares class 0 and
+ *          always leads back to the root. This keeps the table small for ordinary catalogs
+ *          while scanning stays a single table lookup per input byte.
+ *
+ *          Besides the automaton the image keeps the catalog itself with integer topic ids:
+ *          one string table holding every topic name and term, and offset arrays mapping a
+ *          topic id to its name and to its range of terms.
+ *
+ *          Copies share the same image, so copying a matcher is cheap.
+ */
+class AhoCorasick {
+public:
+    /**
+     * @brief Version of the image layout, bumped whenever the layout changes.
+     */
+    static constexpr uint32_t imageVersion = 5;
+
+    AhoCorasick() = default;
+
+    /**
+     * @brief Compiles the automaton from a catalog.
+     * @param catalog Topics and their identifiers. Topic ids follow the catalog order.
+     * @param joinLines When true, '\n' bytes in scanned text are skipped, so identifiers match
+     *                  across line breaks exactly as they did when documents were read with
+     *                  getline and concatenated.
+     * @param fold Letters matched regardless of case. The terms are folded here, once; scanned
+     *             text is folded byte by byte as the automaton reads it (see caseFold.h).
+     * @details Empty identifiers are ignored. An identifier listed under several topics (or
+     *          several times under one topic) is matched once and credited to each listing; with
+     *          folding, so are identifiers that only differ in case.
+     */
+    explicit AhoCorasick(const Catalog& catalog, bool joinLines = true, CaseFold fold = CaseFold::None)
+    {
+        Tables tables;
+        std::vector<std::string> foldedTerms;
+        std::unordered_map<std::string_view, int32_t> patternIds;
+        std::vector<std::vector<std::pair<int32_t, float>>> topicsOfPattern;
+
+        // Topic names first, then every term, so both form contiguous runs in the string table.
+        tables.topicNameOffsets.push_back(0);
+        for (size_t topic = 0; topic < catalog.topicCount(); ++topic) {
+            tables.strings += catalog.topicName(topic);
+            tables.topicNameOffsets.push_back(static_cast<uint32_t>(tables.strings.size()));
+        }
+        if (fold != CaseFold::None) {
+            // Folded up front so the views into foldedTerms stay valid while patterns are added.
+            for (size_t topic = 0; topic < catalog.topicCount(); ++topic) {
+                for (size_t i = 0; i < catalog.termCount(topic); ++i) {
+                    foldedTerms.push_back(caseFold::foldTerm(catalog.term(topic, i), fold));
+                }
+            }
+        }
+        tables.topicTermOffsets.push_back(0);
+        tables.termOffsets.push_back(static_cast<uint32_t>(tables.strings.size()));
+        for (size_t topic = 0, termId = 0; topic < catalog.topicCount(); ++topic) {
+            const auto topicId = static_cast<int32_t>(topic);
+            for (size_t i = 0; i < catalog.termCount(topic); ++i, ++termId) {
+                std::string_view term = catalog.term(topic, i);
+                tables.strings += term;
+                tables.termOffsets.push_back(static_cast<uint32_t>(tables.strings.size()));
+                if (term.empty()) {
+                    continue;
+                }
+                if (fold == CaseFold::None) {
+                    tables.prefilter.addTerm(term);
+                } else {
+                    addFoldedTerm(tables.prefilter, term, fold);
+                    term = foldedTerms[termId];
+                }
+                auto [it, inserted] = patternIds.emplace(term, static_cast<int32_t>(tables.patternLengths.size()));
+                if (inserted) {
+                    tables.patternLengths.push_back(static_cast<uint32_t>(term.size()));
+                    topicsOfPattern.emplace_back();
+                }
+                topicsOfPattern[it->second].emplace_back(topicId, catalog.termWeight(topic, i));
+            }
+            tables.topicTermOffsets.push_back(static_cast<uint32_t>(tables.termOffsets.size() - 1));
+        }
+
+        tables.patternTopicOffsets.push_back(0);
+        for (const auto& topics : topicsOfPattern) {
+            for (const auto& [topicId, weight] : topics) {
+                tables.patternTopics.push_back(topicId);
+                tables.patternTopicWeights.push_back(weight);
+            }
+            tables.patternTopicOffsets.push_back(static_cast<int32_t>(tables.patternTopics.size()));
+        }
+
+        tables.classOf.fill(0);
+        int32_t classes = 1;
+        for (const auto& [term, id] : patternIds) {
+            for (unsigned char c : term) {
+                if (tables.classOf[c] == 0) {
+                    tables.classOf[c] = static_cast<uint16_t>(classes++);
+                }
+            }
+        }
+        if (fold != CaseFold::None) {
+            // Upper-case ASCII letters share the class of their lower-case letter, so folding them
+            // costs nothing per scanned byte.
+            for (int c = 'A'; c <= 'Z'; ++c) {
+                tables.classOf[c] = tables.classOf[c + ('a' - 'A')];
+            }
+        }
+        tables.stride = classes;
+
+        tables.prefilter.finish();
+        build(tables, patternIds);
+        pack(tables, joinLines, fold, catalog.weighted());
+    }
+
+    /**
+     * @brief Uses a compiled image in place, without copying or parsing it.
+     * @param data Start of the image, aligned to 8 bytes.
+     * @param size Size of the image in bytes.
+     * @param owner Keeps the memory behind data alive for as long as any copy of the matcher
+     *              exists; may be empty when the caller guarantees that itself.
+     * @throws std::invalid_argument if the bytes are not a valid image of this version.
+     */
+    static AhoCorasick fromImage(const void* data, size_t size, std::shared_ptr<const void> owner = {})
+    {
+        AhoCorasick matcher;
+        matcher.attach(static_cast<const char*>(data), size, std::move(owner));
+        return matcher;
+    }
+
+    /**
+     * @brief Start of the compiled image.
+     */
+    const char* imageData() const { return image_; }
+
+    /**
+     * @brief Size of the compiled image in bytes.
+     */
+    size_t imageSize() const { return imageSize_; }
+
+    /**
+     * @brief Number of topics in the catalog the automaton was built from.
+     */
+    size_t topicCount() const { return topicCount_; }
+
+    /**
+     * @brief Name of a topic by id.
+     */
+    std::string_view topicName(size_t topicId) const
+    {
+        return stringAt(topicNameOffsets_[topicId], topicNameOffsets_[topicId + 1]);
+    }
+
+    /**
+     * @brief Number of terms listed for a topic, including empty and repeated ones.
+     */
+    size_t termCount(size_t topicId) const
+    {
+        return topicTermOffsets_[topicId + 1] - topicTermOffsets_[topicId];
+    }
+
+    /**
+     * @brief A term of a topic, in catalog order.
+     */
+    std::string_view term(size_t topicId, size_t index) const
+    {
+        size_t termId = topicTermOffsets_[topicId] + index;
+        return stringAt(termOffsets_[termId], termOffsets_[termId + 1]);
+    }
+
+    /**
+     * @brief Number of distinct identifiers compiled into the automaton.
+     */
+    size_t patternCount() const { return patternCount_; }
+
+    /**
+     * @brief Letters the automaton matches regardless of case.
+     */
+    CaseFold caseFold() const { return caseFold_; }
+
+    /**
+     * @brief Whether the catalog was parsed with term weights (see Catalog::weighted).
+     */
+    bool weighted() const { return weighted_; }
+
+    /**
+     * @brief The topics a pattern is credited to, one per catalog listing of its term, with the
+     *        scoring weight of each listing.
+     */
+    struct Listings {
+        const int32_t* topics;
+        const float* weights;
+        size_t size;
+    };
+
+    Listings listings(size_t pattern) const
+    {
+        int32_t begin = patternTopicOffsets_[pattern];
+        return Listings {patternTopics_ + begin, patternTopicWeights_ + begin,
+                         static_cast<size_t>(patternTopicOffsets_[pattern + 1] - begin)};
+    }
+
+    /**
+     * @brief Selects the prefilter that skips text in which no identifier can start.
+     * @param kernel The kernel to use; Auto (the default) picks the widest one the CPU supports
+     *               and Off disables skipping. Every kernel gives the same results.
+     * @throws std::invalid_argument if the kernel is not supported on this CPU.
+     */
+    void setPrefilter(prefilter::Kernel kernel) { skip_ = prefilter::skipFunction(kernel); }
+
+    /**
+     * @brief Runs the automaton over a text and reports every identifier occurrence.
+     * @param text The text to scan.
+     * @param onMatch Called as onMatch(patternId, endPosition) for each occurrence, where
+     *                endPosition is the index of the last byte of the occurrence. With joinLines
+     *                the index is counted in the text with its line breaks removed.
+     */
+    template <typename Callback>
+    void scan(std::string_view text, Callback&& onMatch) const
+    {
+        int32_t state = 0;
+        size_t position = 0;
+        scan(text, state, position, onMatch);
+    }
+
+    /**
+     * @brief Continues a scan that was started on earlier chunks of the same text.
+     * @param text The next chunk.
+     * @param state Automaton state after the previous chunk (0 before the first one); updated.
+     * @param position Number of bytes consumed so far, not counting skipped line breaks; updated.
+     * @param onMatch As for scan(); endPosition is relative to the start of the whole text.
+     * @details The automaton state is all the context a match needs, so occurrences straddling
+     *          chunk boundaries are reported exactly as if the chunks had been concatenated.
+     *          With Unicode folding, a two-byte character split between two chunks is read
+     *          unfolded; StreamCounter keeps that context as well.
+     */
+    template <typename Callback>
+    void scan(std::string_view text, int32_t& state, size_t& position, Callback&& onMatch) const
+    {
+        auto report = [&](int32_t pattern, size_t end, size_t) { onMatch(pattern, end); };
+        unsigned char lead = 0;
+        scanBytes(text, state, position, lead, report);
+        if (lead != 0) {
+            step(lead, text.size() - 1, state, position, report);
+        }
+    }
+
+    /**
+     * @brief Counts identifier occurrences per topic.
+     * @param text The text to scan.
+     * @param mode How repeated occurrences of one identifier are counted.
+     * @return Vector of counts indexed by topic id.
+     */
+    std::vector<uint32_t> countTopics(std::string_view text, MatchMode mode = MatchMode::NonOverlapping) const
+    {
+        StreamCounter counter(*this, mode);
+        counter.feed(text);
+        return counter.topicCounts();
+    }
+
+    /**
+     * @brief Counts like countTopics and also reports where every counted occurrence is.
+     * @param positions Cleared, then filled in text order. Passing the same buffer for every
+     *                  document reuses its capacity, so steady-state scanning does not allocate.
+     */
+    std::vector<uint32_t> countTopics(std::string_view text, MatchMode mode, std::vector<MatchPosition>& positions) const
+    {
+        positions.clear();
+        StreamCounter counter(*this, mode);
+        counter.feed(text, &positions);
+        return counter.topicCounts();
+    }
+
+    /**
+     * @brief Counts identifier occurrences per topic over a text that arrives in chunks.
+     * @details Feeding the chunks of a text one after another gives the same counts as
+     *          countTopics on the whole text, wherever the chunk boundaries fall. Line breaks
+     *          are handled per byte, so with joinLines an identifier split across a line break
+     *          (and across a chunk boundary) still matches. Memory use is independent of the
+     *          text length. The matcher must outlive the counter.
+     */
+    class StreamCounter {
+    public:
+        explicit StreamCounter(const AhoCorasick& matcher, MatchMode mode = MatchMode::NonOverlapping)
+            : matcher_(&matcher), mode_(mode), patternCounts_(matcher.patternCount_, 0)
+        {
+            if (mode_ == MatchMode::NonOverlapping) {
+                nextAllowed_.assign(matcher.patternCount_, 0);
+            }
+        }
+
+        /**
+         * @brief Scans the next chunk of the text.
+         * @param positions When given, every counted occurrence is appended to it. Offsets are
+         *                  relative to the start of the whole text; with joinLines, the start of
+         *                  an occurrence that began in an earlier chunk ignores line breaks there.
+         */
+        void feed(std::string_view chunk, std::vector<MatchPosition>* positions = nullptr)
+        {
+            if (positions != nullptr) {
+                feedWithPositions(chunk, *positions);
+            } else if (mode_ == MatchMode::Overlapping) {
+                matcher_->scanBytes(chunk, state_, position_, lead_,
+                                    [&](int32_t pattern, size_t, size_t) { ++patternCounts_[pattern]; });
+            } else {
+                matcher_->scanBytes(chunk, state_, position_, lead_,
+                                    [&](int32_t pattern, size_t end, size_t) { countNonOverlapping(pattern, end); });
+            }
+            offset_ += chunk.size();
+        }
+
+        /**
+         * @brief Counts per pattern id for everything fed so far.
+         */
+        const std::vector<uint32_t>& patternCounts() const { return patternCounts_; }
+
+        /**
+         * @brief Counts per topic id for everything fed so far.
+         */
+        std::vector<uint32_t> topicCounts() const
+        {
+            std::vector<uint32_t> topicCounts(matcher_->topicCount_, 0);
+            for (size_t pattern = 0; pattern < patternCounts_.size(); ++pattern) {
+                if (patternCounts_[pattern] == 0) {
+                    continue;
+                }
+                for (int32_t i = matcher_->patternTopicOffsets_[pattern]; i < matcher_->patternTopicOffsets_[pattern + 1]; ++i) {
+                    topicCounts[matcher_->patternTopics_[i]] += patternCounts_[pattern];
+                }
+            }
+            return topicCounts;
+        }
+
+    private:
+        /**
+         * @brief Counts an occurrence unless it overlaps the previous counted one of its pattern.
+         * @return Whether the occurrence was counted.
+         */
+        bool countNonOverlapping(int32_t pattern, size_t end)
+        {
+            // Earliest start position at which the next occurrence of each pattern may begin.
+            size_t start = end + 1 - matcher_->patternLengths_[pattern];
+            if (start < nextAllowed_[pattern]) {
+                return false;
+            }
+            ++patternCounts_[pattern];
+            nextAllowed_[pattern] = end + 1;
+            return true;
+        }
+
+        void feedWithPositions(std::string_view chunk, std::vector<MatchPosition>& positions)
+        {
+            matcher_->scanBytes(chunk, state_, position_, lead_, [&](int32_t pattern, size_t end, size_t index) {
+                if (mode_ == MatchMode::Overlapping) {
+                    ++patternCounts_[pattern];
+                } else if (!countNonOverlapping(pattern, end)) {
+                    return;
+                }
+                // Walk back over the pattern's bytes to find where it starts in the stored text.
+                size_t remaining = matcher_->patternLengths_[pattern];
+                size_t begin = index + 1;
+                while (remaining > 0 && begin > 0) {
+                    --begin;
+                    if (chunk[begin] != '\n' || !matcher_->joinLines_) {
+                        --remaining;
+                    }
+                }
+                // Bytes left over began in an earlier chunk (remaining > 0 implies begin == 0).
+                MatchPosition match {0, offset_ + begin - std::min(remaining, offset_), offset_ + index + 1};
+                int32_t previous = -1;
+                for (int32_t i = matcher_->patternTopicOffsets_[pattern]; i < matcher_->patternTopicOffsets_[pattern + 1]; ++i) {
+                    // A term listed twice under one topic is still one highlighted occurrence.
+                    if (matcher_->patternTopics_[i] != previous) {
+                        previous = matcher_->patternTopics_[i];
+                        match.topic = static_cast<uint32_t>(previous);
+                        positions.push_back(match);
+                    }
+                }
+            });
+        }
+
+        const AhoCorasick* matcher_;
+        MatchMode mode_;
+        int32_t state_ = 0;
+        size_t position_ = 0;
+        unsigned char lead_ = 0; ///< First byte of a two-byte character still waiting to be folded.
+        size_t offset_ = 0; ///< Bytes fed before the current chunk.
+        std::vector<uint32_t> patternCounts_;
+        std::vector<size_t> nextAllowed_;
+    };
+
+private:
+    /**
+     * @brief The scan loop; onMatch(patternId, endPosition, index) also receives the index of the
+     *        last byte of the occurrence within text, line breaks included.
+     * @param lead With Unicode folding, the first byte of a two-byte character whose second byte
+     *             has not been read yet (0 if there is none); updated.
+     */
+    template <typename Callback>
+    void scanBytes(std::string_view text, int32_t& state, size_t& position, unsigned char& lead, Callback&& onMatch) const
+    {
+        if (caseFold_ == CaseFold::Unicode) {
+            scanLoop<true>(text, state, position, lead, onMatch);
+        } else {
+            scanLoop<false>(text, state, position, lead, onMatch);
+        }
+    }
+
+    /**
+     * @brief The scan loop, folding two-byte UTF-8 characters when FoldPairs is set.
+     * @details ASCII folding is already part of the byte classes. A two-byte character is folded
+     *          by holding back its first byte until the second one arrives and then feeding the
+     *          folded pair, so the document is still read once and never copied; only bytes that
+     *          start such a character leave the plain loop.
+     */
+    template <bool FoldPairs, typename Callback>
+    void scanLoop(std::string_view text, int32_t& state, size_t& position, unsigned char& lead, Callback& onMatch) const
+    {
+        if (patternCount_ == 0) {
+            return;
+        }
+        const auto* data = reinterpret_cast<const unsigned char*>(text.data());
+        const size_t length = text.size();
+        for (size_t i = 0; i < length; ++i) {
+            if (state == 0 && skip_ != nullptr && (!FoldPairs || lead == 0)) {
+                // No identifier is in progress: jump straight to the next position one could start at.
+                size_t newlines = 0;
+                size_t next = skip_(*prefilter_, data, i, length, newlines);
+                position += next - i - (joinLines_ ? newlines : 0);
+                i = next;
+                if (i == length) {
+                    break;
+                }
+            }
+            unsigned char c = data[i];
+            if (c == '\n' && joinLines_) {
+                continue;
+            }
+            if constexpr (FoldPairs) {
+                if (lead != 0) {
+                    unsigned char first = lead;
+                    lead = 0;
+                    if (caseFold::isContinuation(c)) {
+                        caseFold::foldPair(first, c);
+                    }
+                    step(first, i, state, position, onMatch);
+                }
+                if (caseFold::isPairLead(c)) {
+                    lead = c;
+                    continue;
+                }
+            }
+            step(c, i, state, position, onMatch);
+        }
+    }
+
+    /**
+     * @brief Feeds one byte to the automaton and reports the occurrences ending at it.
+     */
+    template <typename Callback>
+    void step(unsigned char c, size_t index, int32_t& state, size_t& position, Callback& onMatch) const
+    {
+        state = delta_[static_cast<size_t>(state) * stride_ + classOf_[c]];
+        for (int32_t s = output_[state] >= 0 ? state : dictLink_[state]; s >= 0; s = dictLink_[s]) {
+            onMatch(output_[s], position, index);
+        }
+        ++position;
+    }
+
+    /**
+     * @brief Sections of the image, each starting on an 8-byte boundary.
+     */
+    enum Section {
+        TopicNameOffsets,    ///< uint32[topicCount + 1], name of topic t is strings[o[t], o[t + 1])
+        TopicTermOffsets,    ///< uint32[topicCount + 1], terms of topic t are term ids [o[t], o[t + 1])
+        TermOffsets,         ///< uint32[termCount + 1], term i is strings[o[i], o[i + 1])
+        Strings,             ///< char[], all topic names back to back, followed by all terms
+        PatternLengths,      ///< uint32[patternCount]
+        PatternTopicOffsets, ///< int32[patternCount + 1], topics credited for pattern p
+        PatternTopics,       ///< int32[], topic ids, repeated when a term is listed repeatedly
+        PatternTopicWeights, ///< float[], scoring weight of every entry of PatternTopics
+        ClassOf,             ///< uint16[256], byte -> byte class
+        Delta,               ///< int32[stateCount * stride], completed transition table
+        Output,              ///< int32[stateCount], pattern ending in a state or -1
+        DictLink,            ///< int32[stateCount], next state on the suffix chain with an output or -1
+        Prefilter,           ///< prefilter::Tables of the terms, as spelled with case folding
+        SectionCount
+    };
+
+    struct ImageHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t flags;
+        uint32_t topicCount;
+        uint32_t termCount;
+        uint32_t patternCount;
+        uint32_t stateCount;
+        uint32_t stride;
+        uint32_t reserved;
+        uint64_t imageSize;
+        uint64_t sectionOffset[SectionCount];
+        uint64_t sectionSize[SectionCount];
+    };
+
+    static constexpr char imageMagic[8] = {'D', 'C', 'A', 'T', 'A', 'C', '0', '1'};
+    static constexpr uint32_t flagJoinLines = 1;
+    static constexpr uint32_t flagFoldAscii = 2;
+    static constexpr uint32_t flagFoldUnicode = 4;
+    static constexpr uint32_t flagWeighted = 8;
+
+    /**
+     * @brief Tables collected while compiling, before they are packed into the image.
+     */
+    struct Tables {
+        std::vector<uint32_t> topicNameOffsets;
+        std::vector<uint32_t> topicTermOffsets;
+        std::vector<uint32_t> termOffsets;
+        std::string strings;
+        std::vector<uint32_t> patternLengths;
+        std::vector<int32_t> patternTopicOffsets;
+        std::vector<int32_t> patternTopics;
+        std::vector<float> patternTopicWeights;
+        std::array<uint16_t, 256> classOf{};
+        int32_t stride = 1;
+        std::vector<int32_t> delta;
+        std::vector<int32_t> output;
+        std::vector<int32_t> dictLink;
+        prefilter::Tables prefilter;
+    };
+
+    static_assert(std::is_trivially_copyable_v<prefilter::Tables> && alignof(prefilter::Tables) <= alignof(uint64_t),
+                  "prefilter tables are stored in the image and used in place");
+
+    /**
+     * @brief Builds the trie, the failure links and the completed transition table.
+     */
+    static void build(Tables& tables, const std::unordered_map<std::string_view, int32_t>& patternIds)
+    {
+        const size_t stride = tables.stride;
+        auto addState = [&tables, stride] {
+            tables.delta.resize(tables.delta.size() + stride, -1);
+            tables.output.push_back(-1);
+            tables.dictLink.push_back(-1);
+            return static_cast<int32_t>(tables.output.size() - 1);
+        };
+
+        addState();
+        for (const auto& [term, id] : patternIds) {
+            int32_t state = 0;
+            for (unsigned char c : term) {
+                size_t edge = static_cast<size_t>(state) * stride + tables.classOf[c];
+                if (tables.delta[edge] < 0) {
+                    int32_t created = addState();
+                    tables.delta[edge] = created;
+                }
+                state = tables.delta[edge];
+            }
+            tables.output[state] = id;
+        }
+
+        std::vector<int32_t> fail(tables.output.size(), 0);
+        std::queue<int32_t> pending;
+        for (size_t c = 0; c < stride; ++c) {
+            int32_t& next = tables.delta[c];
+            if (next < 0) {
+                next = 0;
+            } else {
+                pending.push(next);
+            }
+        }
+
+        while (!pending.empty()) {
+            int32_t state = pending.front();
+            pending.pop();
+            int32_t f = fail[state];
+            tables.dictLink[state] = tables.output[f] >= 0 ? f : tables.dictLink[f];
+            for (size_t c = 0; c < stride; ++c) {
+                int32_t& next = tables.delta[static_cast<size_t>(state) * stride + c];
+                if (next < 0) {
+                    next = tables.delta[static_cast<size_t>(f) * stride + c];
+                } else {
+                    fail[next] = tables.delta[static_cast<size_t>(f) * stride + c];
+                    pending.push(next);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Lays the tables out in a freshly allocated image and attaches to it.
+     */
+    void pack(const Tables& tables, bool joinLines, CaseFold fold, bool weighted)
+    {
+        ImageHeader header{};
+        std::memcpy(header.magic, imageMagic, sizeof(imageMagic));
+        header.version = imageVersion;
+        header.flags = (joinLines ? flagJoinLines : 0) | (fold == CaseFold::Ascii ? flagFoldAscii : 0) |
+                       (fold == CaseFold::Unicode ? flagFoldUnicode : 0) | (weighted ? flagWeighted : 0);
+        header.topicCount = static_cast<uint32_t>(tables.topicNameOffsets.size() - 1);
+        header.termCount = static_cast<uint32_t>(tables.termOffsets.size() - 1);
+        header.patternCount = static_cast<uint32_t>(tables.patternLengths.size());
+        header.stateCount = static_cast<uint32_t>(tables.output.size());
+        header.stride = static_cast<uint32_t>(tables.stride);
+
+        const void* sources[SectionCount] = {
+            tables.topicNameOffsets.data(), tables.topicTermOffsets.data(), tables.termOffsets.data(),
+            tables.strings.data(), tables.patternLengths.data(), tables.patternTopicOffsets.data(),
+            tables.patternTopics.data(), tables.patternTopicWeights.data(), tables.classOf.data(), tables.delta.data(),
+            tables.output.data(), tables.dictLink.data(), &tables.prefilter};
+        header.sectionSize[TopicNameOffsets] = tables.topicNameOffsets.size() * sizeof(uint32_t);
+        header.sectionSize[TopicTermOffsets] = tables.topicTermOffsets.size() * sizeof(uint32_t);
+        header.sectionSize[TermOffsets] = tables.termOffsets.size() * sizeof(uint32_t);
+        header.sectionSize[Strings] = tables.strings.size();
+        header.sectionSize[PatternLengths] = tables.patternLengths.size() * sizeof(uint32_t);
+        header.sectionSize[PatternTopicOffsets] = tables.patternTopicOffsets.size() * sizeof(int32_t);
+        header.sectionSize[PatternTopics] = tables.patternTopics.size() * sizeof(int32_t);
+        header.sectionSize[PatternTopicWeights] = tables.patternTopicWeights.size() * sizeof(float);
+        header.sectionSize[ClassOf] = tables.classOf.size() * sizeof(uint16_t);
+        header.sectionSize[Delta] = tables.delta.size() * sizeof(int32_t);
+        header.sectionSize[Output] = tables.output.size() * sizeof(int32_t);
+        header.sectionSize[DictLink] = tables.dictLink.size() * sizeof(int32_t);
+        header.sectionSize[Prefilter] = sizeof(prefilter::Tables);
+
+        uint64_t offset = alignUp(sizeof(ImageHeader));
+        for (int section = 0; section < SectionCount; ++section) {
+            header.sectionOffset[section] = offset;
+            offset = alignUp(offset + header.sectionSize[section]);
+        }
+        header.imageSize = offset;
+
+        // uint64_t storage keeps every section 8-byte aligned.
+        auto storage = std::make_shared<std::vector<uint64_t>>(offset / sizeof(uint64_t), 0);
+        char* image = reinterpret_cast<char*>(storage->data());
+        std::memcpy(image, &header, sizeof(header));
+        for (int section = 0; section < SectionCount; ++section) {
+            if (header.sectionSize[section] > 0) {
+                std::memcpy(image + header.sectionOffset[section], sources[section], header.sectionSize[section]);
+            }
+        }
+        attach(image, offset, std::move(storage));
+    }
+
+    /**
+     * @brief Validates an image and points the lookup tables into it.
+     */
+    void attach(const char* data, size_t size, std::shared_ptr<const void> owner)
+    {
+        ImageHeader header{};
+        if (data == nullptr || size < sizeof(header) || reinterpret_cast<uintptr_t>(data) % alignof(uint64_t) != 0) {
+            throw std::invalid_argument("Compiled catalog image is truncated or misaligned");
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, imageMagic, sizeof(imageMagic)) != 0 || header.version != imageVersion) {
+            throw std::invalid_argument("Unsupported compiled catalog image");
+        }
+        if (header.imageSize != size) {
+            throw std::invalid_argument("Compiled catalog image size mismatch");
+        }
+
+        const uint64_t expected[SectionCount] = {
+            (header.topicCount + 1ull) * sizeof(uint32_t),
+            (header.topicCount + 1ull) * sizeof(uint32_t),
+            (header.termCount + 1ull) * sizeof(uint32_t),
+            header.sectionSize[Strings],
+            header.patternCount * 1ull * sizeof(uint32_t),
+            (header.patternCount + 1ull) * sizeof(int32_t),
+            header.sectionSize[PatternTopics],
+            header.sectionSize[PatternTopics] / sizeof(int32_t) * sizeof(float),
+            256 * sizeof(uint16_t),
+            static_cast<uint64_t>(header.stateCount) * header.stride * sizeof(int32_t),
+            header.stateCount * 1ull * sizeof(int32_t),
+            header.stateCount * 1ull * sizeof(int32_t),
+            sizeof(prefilter::Tables)};
+        for (int section = 0; section < SectionCount; ++section) {
+            if (header.sectionSize[section] != expected[section] || header.sectionOffset[section] % alignof(uint64_t) != 0 ||
+                header.sectionOffset[section] + header.sectionSize[section] > size) {
+                throw std::invalid_argument("Corrupt compiled catalog image");
+            }
+        }
+        if (header.stateCount == 0 || header.stride == 0) {
+            throw std::invalid_argument("Corrupt compiled catalog image");
+        }
+
+        owner_ = std::move(owner);
+        image_ = data;
+        imageSize_ = size;
+        joinLines_ = (header.flags & flagJoinLines) != 0;
+        caseFold_ = (header.flags & flagFoldUnicode) != 0 ? CaseFold::Unicode
+                    : (header.flags & flagFoldAscii) != 0 ? CaseFold::Ascii
+                                                          : CaseFold::None;
+        weighted_ = (header.flags & flagWeighted) != 0;
+        topicCount_ = header.topicCount;
+        patternCount_ = header.patternCount;
+        stride_ = header.stride;
+        auto at = [&](Section section) { return data + header.sectionOffset[section]; };
+        topicNameOffsets_ = reinterpret_cast<const uint32_t*>(at(TopicNameOffsets));
+        topicTermOffsets_ = reinterpret_cast<const uint32_t*>(at(TopicTermOffsets));
+        termOffsets_ = reinterpret_cast<const uint32_t*>(at(TermOffsets));
+        strings_ = at(Strings);
+        patternLengths_ = reinterpret_cast<const uint32_t*>(at(PatternLengths));
+        patternTopicOffsets_ = reinterpret_cast<const int32_t*>(at(PatternTopicOffsets));
+        patternTopics_ = reinterpret_cast<const int32_t*>(at(PatternTopics));
+        patternTopicWeights_ = reinterpret_cast<const float*>(at(PatternTopicWeights));
+        classOf_ = reinterpret_cast<const uint16_t*>(at(ClassOf));
+        delta_ = reinterpret_cast<const int32_t*>(at(Delta));
+        output_ = reinterpret_cast<const int32_t*>(at(Output));
+        dictLink_ = reinterpret_cast<const int32_t*>(at(DictLink));
+        prefilter_ = reinterpret_cast<const prefilter::Tables*>(at(Prefilter));
+
+        validateTables(header);
+        skip_ = prefilter::skipFunction(prefilter::Kernel::Auto);
+    }
+
+    /**
+     * @brief Checks every index stored in the attached tables, once, so that a damaged or foreign
+     *        image is rejected here instead of being read out of bounds while scanning.
+     * @details The prefilter tables are indexed by byte values only and need no check.
+     */
+    void validateTables(const ImageHeader& header) const
+    {
+        auto corrupt = [] { throw std::invalid_argument("Corrupt compiled catalog image"); };
+        auto ascending = [&](const uint32_t* offsets, size_t count, uint64_t limit) {
+            for (size_t i = 0; i < count; ++i) {
+                if (offsets[i] > offsets[i + 1]) {
+                    corrupt();
+                }
+            }
+            if (offsets[count] > limit) {
+                corrupt();
+            }
+        };
+        ascending(topicNameOffsets_, topicCount_, header.sectionSize[Strings]);
+        ascending(topicTermOffsets_, topicCount_, header.termCount);
+        ascending(termOffsets_, header.termCount, header.sectionSize[Strings]);
+
+        const uint64_t patternTopicCount = header.sectionSize[PatternTopics] / sizeof(int32_t);
+        if (patternTopicOffsets_[0] != 0 || static_cast<uint64_t>(patternTopicOffsets_[patternCount_]) != patternTopicCount) {
+            corrupt();
+        }
+        for (size_t pattern = 0; pattern < patternCount_; ++pattern) {
+            if (patternLengths_[pattern] == 0 || patternTopicOffsets_[pattern] > patternTopicOffsets_[pattern + 1]) {
+                corrupt();
+            }
+        }
+        for (uint64_t i = 0; i < patternTopicCount; ++i) {
+            if (patternTopics_[i] < 0 || static_cast<size_t>(patternTopics_[i]) >= topicCount_) {
+                corrupt();
+            }
+        }
+
+        const int32_t stateCount = static_cast<int32_t>(header.stateCount);
+        if (header.stateCount > static_cast<uint32_t>(std::numeric_limits<int32_t>::max())) {
+            corrupt();
+        }
+        for (size_t c = 0; c < 256; ++c) {
+            if (classOf_[c] >= stride_) {
+                corrupt();
+            }
+        }
+        for (uint64_t edge = 0; edge < static_cast<uint64_t>(header.stateCount) * stride_; ++edge) {
+            if (delta_[edge] < 0 || delta_[edge] >= stateCount) {
+                corrupt();
+            }
+        }
+        for (int32_t state = 0; state < stateCount; ++state) {
+            if (output_[state] < -1 || static_cast<int64_t>(output_[state]) >= static_cast<int64_t>(patternCount_) ||
+                dictLink_[state] < -1 || dictLink_[state] >= stateCount ||
+                (dictLink_[state] >= 0 && output_[dictLink_[state]] < 0)) {
+                corrupt();
+            }
+        }
+        // step() follows the dictionary links until -1, so they must not form a cycle. A chain is
+        // walked until it reaches a state already known to end; one longer than stateCount loops.
+        std::vector<char> ends(header.stateCount, 0);
+        std::vector<int32_t> chain;
+        for (int32_t state = 0; state < stateCount; ++state) {
+            chain.clear();
+            for (int32_t s = state; s >= 0 && !ends[s]; s = dictLink_[s]) {
+                if (chain.size() == header.stateCount) {
+                    corrupt();
+                }
+                chain.push_back(s);
+            }
+            for (int32_t s : chain) {
+                ends[s] = 1;
+            }
+        }
+    }
+
+    /**
+     * @brief Registers every spelling of a term's first two bytes that folds to the term's own.
+     */
+    static void addFoldedTerm(prefilter::Tables& filter, std::string_view term, CaseFold fold)
+    {
+        if (term.empty()) {
+            return;
+        }
+        std::string folded = caseFold::foldTerm(term, fold);
+        for (const std::string& first : caseFold::unfoldedForms(folded, fold)) {
+            std::string_view rest = std::string_view(folded).substr(first.size());
+            if (first.size() > 1 || rest.empty()) {
+                filter.addTerm(first);
+                continue;
+            }
+            for (const std::string& second : caseFold::unfoldedForms(rest, fold)) {
+                filter.addTerm(first + second);
+            }
+        }
+    }
+
+    static uint64_t alignUp(uint64_t offset) { return (offset + 7) & ~uint64_t{7}; }
+
+    std::string_view stringAt(uint32_t begin, uint32_t end) const { return {strings_ + begin, end - begin}; }
+
+    std::shared_ptr<const void> owner_;
+    const char* image_ = nullptr;
+    size_t imageSize_ = 0;
+
+    bool joinLines_ = true;
+    CaseFold caseFold_ = CaseFold::None;
+    bool weighted_ = false;
+    size_t topicCount_ = 0;
+    size_t patternCount_ = 0;
+    size_t stride_ = 1;
+    const uint32_t* topicNameOffsets_ = nullptr;
+    const uint32_t* topicTermOffsets_ = nullptr;
+    const uint32_t* termOffsets_ = nullptr;
+    const char* strings_ = nullptr;
+    const uint32_t* patternLengths_ = nullptr;
+    const int32_t* patternTopicOffsets_ = nullptr;
+    const int32_t* patternTopics_ = nullptr;
+    const float* patternTopicWeights_ = nullptr;
+    const uint16_t* classOf_ = nullptr;
+    const int32_t* delta_ = nullptr;
+    const int32_t* output_ = nullptr;
+    const int32_t* dictLink_ = nullptr;
+
+    const prefilter::Tables* prefilter_ = nullptr;
+    prefilter::SkipFunction skip_ = nullptr;
+};
+
+#endif // AHO_CORASICK_H
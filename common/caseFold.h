@@ -0,0 +1,186 @@
+/**
+ * @file caseFold.h
+ * @brief Case folding of catalog terms and of scanned text.
+ * @details Folding is applied to both sides of a match: catalog terms are folded once when the
+ *          automaton is compiled, and scanned bytes are folded on their way into the automaton,
+ *          in the same pass and without a folded copy of the document (see AhoCorasick).
+ *
+ *          Ascii folds 'A'-'Z' to 'a'-'z'. Unicode also applies the simple case folding of the
+ *          two-byte UTF-8 range where it maps a letter to another two-byte letter: Latin-1
+ *          Supplement, Latin Extended-A, Greek, Cyrillic and Armenian. Longer sequences, invalid
+ *          UTF-8 and foldings that change the encoded length ("ſ" -> "s", "ẞ" -> "ß") are left
+ *          as they are, so folding never changes the length of a text.
+ */
+#ifndef CASE_FOLD_H
+#define CASE_FOLD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Which letters are matched regardless of case.
+ */
+enum class CaseFold {
+    None,   ///< Bytes are matched exactly.
+    Ascii,  ///< ASCII letters.
+    Unicode ///< ASCII letters and the two-byte UTF-8 letters listed in caseFold.h.
+};
+
+inline CaseFold parseCaseFold(std::string_view name)
+{
+    if (name == "none") {
+        return CaseFold::None;
+    }
+    if (name == "ascii") {
+        return CaseFold::Ascii;
+    }
+    if (name == "unicode") {
+        return CaseFold::Unicode;
+    }
+    throw std::invalid_argument("Unknown case folding: " + std::string(name));
+}
+
+namespace caseFold {
+
+inline unsigned char foldAscii(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<unsigned char>(c + ('a' - 'A')) : c;
+}
+
+/**
+ * @brief Simple case folding of a code point in U+0080..U+07FF; others are returned unchanged.
+ */
+inline uint32_t foldCodePoint(uint32_t c)
+{
+    if (c < 0x100) {
+        if (c == 0xb5) {
+            return 0x3bc; // MICRO SIGN -> GREEK SMALL LETTER MU
+        }
+        return c >= 0xc0 && c <= 0xde && c != 0xd7 ? c + 0x20 : c;
+    }
+    if (c < 0x180) {
+        // Upper and lower case alternate; the even/odd phase flips after U+0138 and again at U+0179.
+        if (c == 0x130 || c == 0x131 || c == 0x138 || c == 0x149 || c == 0x17f) {
+            return c;
+        }
+        if (c == 0x178) {
+            return 0xff;
+        }
+        bool oddUpper = (c >= 0x139 && c <= 0x148) || c >= 0x179;
+        return (c % 2 == 1) == oddUpper ? c + 1 : c;
+    }
+    if (c >= 0x386 && c <= 0x3ab) {
+        if (c == 0x386) {
+            return 0x3ac;
+        }
+        if (c >= 0x388 && c <= 0x38a) {
+            return c + 0x25;
+        }
+        if (c == 0x38c) {
+            return 0x3cc;
+        }
+        if (c == 0x38e || c == 0x38f) {
+            return c + 0x3f;
+        }
+        return c >= 0x391 && c != 0x3a2 ? c + 0x20 : c;
+    }
+    if (c == 0x3c2) {
+        return 0x3c3; // final sigma
+    }
+    if (c >= 0x400 && c <= 0x52f) {
+        if (c < 0x410) {
+            return c + 0x50;
+        }
+        if (c < 0x430) {
+            return c + 0x20;
+        }
+        if (c == 0x4c0) {
+            return 0x4cf;
+        }
+        bool pairs = (c >= 0x460 && c <= 0x481) || (c >= 0x48a && c <= 0x4bf) || c >= 0x4d0;
+        if (pairs && c % 2 == 0) {
+            return c + 1;
+        }
+        return c >= 0x4c1 && c <= 0x4ce && c % 2 == 1 ? c + 1 : c;
+    }
+    if (c >= 0x531 && c <= 0x556) {
+        return c + 0x30;
+    }
+    return c;
+}
+
+/**
+ * @brief Folds the two-byte UTF-8 sequence lead, continuation in place.
+ */
+inline void foldPair(unsigned char& lead, unsigned char& continuation)
+{
+    uint32_t c = foldCodePoint(static_cast<uint32_t>(lead & 0x1f) << 6 | (continuation & 0x3f));
+    lead = static_cast<unsigned char>(0xc0 | c >> 6);
+    continuation = static_cast<unsigned char>(0x80 | (c & 0x3f));
+}
+
+inline bool isPairLead(unsigned char c) { return (c & 0xe0) == 0xc0; }
+
+inline bool isContinuation(unsigned char c) { return (c & 0xc0) == 0x80; }
+
+/**
+ * @brief The folded form of a term, of the same length.
+ */
+inline std::string foldTerm(std::string_view term, CaseFold fold)
+{
+    std::string folded(term);
+    if (fold == CaseFold::None) {
+        return folded;
+    }
+    for (size_t i = 0; i < folded.size(); ++i) {
+        auto& c = reinterpret_cast<unsigned char&>(folded[i]);
+        if (fold == CaseFold::Unicode && isPairLead(c) && i + 1 < folded.size() &&
+            isContinuation(static_cast<unsigned char>(folded[i + 1]))) {
+            foldPair(c, reinterpret_cast<unsigned char&>(folded[++i]));
+        } else {
+            c = foldAscii(c);
+        }
+    }
+    return folded;
+}
+
+/**
+ * @brief Every byte sequence that folds to the first character of a folded text, that character
+ *        included. The character is one byte, or two for a two-byte UTF-8 sequence.
+ */
+inline std::vector<std::string> unfoldedForms(std::string_view folded, CaseFold fold)
+{
+    auto first = static_cast<unsigned char>(folded[0]);
+    if (fold == CaseFold::Unicode && isPairLead(first) && folded.size() > 1 &&
+        isContinuation(static_cast<unsigned char>(folded[1]))) {
+        // Code points of the two-byte range by the code point they fold to, built on first use.
+        static const std::vector<std::vector<uint16_t>> unfolded = [] {
+            std::vector<std::vector<uint16_t>> table(0x800);
+            for (uint32_t c = 0x80; c < 0x800; ++c) {
+                table[foldCodePoint(c)].push_back(static_cast<uint16_t>(c));
+            }
+            return table;
+        }();
+        uint32_t target = static_cast<uint32_t>(first & 0x1f) << 6 | (static_cast<unsigned char>(folded[1]) & 0x3f);
+        std::vector<std::string> forms {std::string(folded.substr(0, 2))};
+        for (uint32_t c : unfolded[target]) {
+            if (c != target) {
+                forms.push_back({static_cast<char>(0xc0 | c >> 6), static_cast<char>(0x80 | (c & 0x3f))});
+            }
+        }
+        return forms;
+    }
+    std::vector<std::string> forms {std::string(1, static_cast<char>(first))};
+    if (fold != CaseFold::None && first >= 'a' && first <= 'z') {
+        forms.push_back(std::string(1, static_cast<char>(first - ('a' - 'A'))));
+    }
+    return forms;
+}
+
+} // namespace caseFold
+
+#endif // CASE_FOLD_H
@@ -0,0 +1,201 @@
+/**
+ * @file catalog.h
+ * @brief Topic catalog parsed without per-token allocations.
+ * @details The catalog is a structure of arrays: one byte blob holding every topic name back to
+ *          back followed by every term, a CSR offset array mapping a topic id to its range of
+ *          terms, and offset arrays delimiting each name and term in the blob. A catalog therefore
+ *          costs a handful of allocations however many terms it has, and iterating over it walks
+ *          memory in order. It is the same layout the compiled matcher image uses.
+ *
+ *          When a catalog is parsed with term weights (for scoring), a term may end in "^weight"
+ *          (such as "stock^2.5") to weight it; terms without one weigh 1, and so does every term
+ *          of a catalog parsed without weights, whose terms are always read verbatim. A suffix
+ *          that is not a non-negative number is part of the term either way.
+ */
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "documentReader.h"
+
+/**
+ * @brief Calls onToken(std::string_view) for every token of s separated by delimiter.
+ * @details Same splitting as the old tokenize(): empty tokens between adjacent delimiters are
+ *          reported, and so is the token after the last delimiter. The views point into s.
+ */
+template <typename Callback>
+void forEachToken(std::string_view s, std::string_view delimiter, Callback&& onToken)
+{
+    size_t start = 0;
+    size_t end = s.find(delimiter);
+    while (end != std::string_view::npos) {
+        onToken(s.substr(start, end - start));
+        start = end + delimiter.size();
+        end = s.find(delimiter, start);
+    }
+    onToken(s.substr(start));
+}
+
+/**
+ * @brief Topics and their terms in flat arrays, indexed by topic id.
+ * @details Topics are ordered by name and a repeated topic keeps its first definition, which is
+ *          the order and behaviour of the std::map the catalog used to be read into.
+ */
+class Catalog {
+public:
+    Catalog() = default;
+
+    /**
+     * @brief Parses catalog text, one topic per line:
+     *        Topic1@%Identifier1,Identifier2,Identifier3
+     * @param onLine Called as onLine(std::string_view) with every topic line, in file order.
+     * @param termWeights Split "^weight" suffixes off the terms; otherwise they are part of the term.
+     * @details Lines without the "@%" separator (such as empty lines) are skipped.
+     * @throws std::length_error if the catalog does not fit 32-bit offsets.
+     */
+    template <typename Callback>
+    Catalog(std::string_view text, Callback&& onLine, bool termWeights = false) : weighted_(termWeights)
+    {
+        // Views into text first; the arrays are laid out once the topic order is known.
+        struct Line {
+            std::string_view name;
+            std::string_view terms;
+        };
+        std::vector<Line> lines;
+        forEachToken(text, "\n", [&](std::string_view line) {
+            size_t separator = line.find("@%");
+            if (separator == std::string_view::npos) {
+                return;
+            }
+            onLine(line);
+            // Anything after a second "@%" was ignored by the old parser as well.
+            std::string_view terms = line.substr(separator + 2);
+            lines.push_back(Line {line.substr(0, separator), terms.substr(0, terms.find("@%"))});
+        });
+        std::stable_sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) { return a.name < b.name; });
+        lines.erase(std::unique(lines.begin(), lines.end(), [](const Line& a, const Line& b) { return a.name == b.name; }),
+                    lines.end());
+
+        size_t byteCount = 0;
+        for (const Line& line : lines) {
+            byteCount += line.name.size() + line.terms.size();
+        }
+        bytes_.reserve(byteCount);
+        topicNameOffsets_.reserve(lines.size() + 1);
+        topicNameOffsets_.push_back(0);
+        for (const Line& line : lines) {
+            topicNameOffsets_.push_back(append(line.name));
+        }
+        topicTermOffsets_.reserve(lines.size() + 1);
+        topicTermOffsets_.push_back(0);
+        termOffsets_.push_back(static_cast<uint32_t>(bytes_.size()));
+        for (const Line& line : lines) {
+            forEachToken(line.terms, ",", [&](std::string_view term) {
+                termWeights_.push_back(termWeights ? splitWeight(term) : 1.0f);
+                termOffsets_.push_back(append(term));
+            });
+            topicTermOffsets_.push_back(static_cast<uint32_t>(termOffsets_.size() - 1));
+        }
+    }
+
+    explicit Catalog(std::string_view text, bool termWeights = false) : Catalog(text, [](std::string_view) {}, termWeights) {}
+
+    /**
+     * @brief Reads and parses a catalog file.
+     * @throws std::invalid_argument if the file cannot be opened.
+     */
+    template <typename Callback>
+    static Catalog load(const std::string& path, Callback&& onLine, bool termWeights = false)
+    {
+        try {
+            MappedDocument file(path);
+            return Catalog(file.text(), onLine, termWeights);
+        } catch (const std::invalid_argument&) {
+            throw std::invalid_argument("Catalog file does not exist");
+        }
+    }
+
+    static Catalog load(const std::string& path, bool termWeights = false)
+    {
+        return load(path, [](std::string_view) {}, termWeights);
+    }
+
+    size_t topicCount() const { return topicNameOffsets_.empty() ? 0 : topicNameOffsets_.size() - 1; }
+
+    std::string_view topicName(size_t topicId) const
+    {
+        return slice(topicNameOffsets_[topicId], topicNameOffsets_[topicId + 1]);
+    }
+
+    size_t termCount(size_t topicId) const { return topicTermOffsets_[topicId + 1] - topicTermOffsets_[topicId]; }
+
+    /**
+     * @brief A term of a topic, in catalog order; may be empty.
+     */
+    std::string_view term(size_t topicId, size_t index) const
+    {
+        size_t termId = topicTermOffsets_[topicId] + index;
+        return slice(termOffsets_[termId], termOffsets_[termId + 1]);
+    }
+
+    /**
+     * @brief Scoring weight of a term of a topic; 1 unless the catalog gives one.
+     */
+    float termWeight(size_t topicId, size_t index) const { return termWeights_[topicTermOffsets_[topicId] + index]; }
+
+    /**
+     * @brief Whether "^weight" suffixes were split off the terms.
+     */
+    bool weighted() const { return weighted_; }
+
+private:
+    /**
+     * @brief Removes a "^weight" suffix from a term and returns the weight, or 1 without one.
+     */
+    static float splitWeight(std::string_view& term)
+    {
+        size_t caret = term.rfind('^');
+        if (caret == std::string_view::npos || caret == 0 || caret + 1 == term.size()) {
+            return 1.0f;
+        }
+        std::string suffix(term.substr(caret + 1));
+        char* end = nullptr;
+        float weight = std::strtof(suffix.c_str(), &end);
+        if (end != suffix.c_str() + suffix.size() || !std::isfinite(weight) || weight < 0) {
+            return 1.0f;
+        }
+        term = term.substr(0, caret);
+        return weight;
+    }
+
+    /**
+     * @brief Appends bytes to the blob and returns the offset just past them.
+     */
+    uint32_t append(std::string_view bytes)
+    {
+        if (bytes_.size() + bytes.size() > std::numeric_limits<uint32_t>::max()) {
+            throw std::length_error("Catalog too large");
+        }
+        bytes_ += bytes;
+        return static_cast<uint32_t>(bytes_.size());
+    }
+
+    std::string_view slice(uint32_t begin, uint32_t end) const { return {bytes_.data() + begin, end - begin}; }
+
+    std::string bytes_;                      ///< All topic names back to back, followed by all terms.
+    std::vector<uint32_t> topicNameOffsets_; ///< [topicCount + 1], name of topic t is bytes_[o[t], o[t + 1]).
+    std::vector<uint32_t> topicTermOffsets_; ///< [topicCount + 1], terms of topic t are term ids [o[t], o[t + 1]).
+    std::vector<uint32_t> termOffsets_;      ///< [termCount + 1], term i is bytes_[o[i], o[i + 1]).
+    std::vector<float> termWeights_;         ///< [termCount], scoring weight of term i.
+    bool weighted_ = false;
+};
+
+#endif // CATALOG_H
@@ -0,0 +1,181 @@
+/**
+ * @file catalogCache.h
+ * @brief On-disk cache of the compiled catalog for fast startup.
+ * @details The cache file holds a small header followed by the compiled AhoCorasick image.
+ *          The header records the size, modification time and hash of the source catalog it
+ *          was built from. A cache whose key still matches is memory-mapped and used in place,
+ *          so a warm start does not parse or compile anything.
+ */
+#ifndef CATALOG_CACHE_H
+#define CATALOG_CACHE_H
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include "ahoCorasick.h"
+#include "documentReader.h"
+#include "hash.h"
+
+/**
+ * @brief Identity of a source catalog file, used to decide whether a cache is still valid.
+ */
+struct CatalogKey {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = 0;
+};
+
+/**
+ * @brief Header at the start of a catalog cache file.
+ */
+struct CatalogCacheHeader {
+    char magic[8];
+    uint32_t cacheVersion;
+    uint32_t imageVersion;
+    CatalogKey source;
+    uint64_t imageOffset;
+    uint64_t imageSize;
+};
+
+namespace catalogCache {
+
+constexpr char magic[8] = {'D', 'C', 'A', 'T', 'C', 'A', 'C', 'H'};
+constexpr uint32_t version = 1;
+
+/**
+ * @brief Reads size and modification time of a catalog file; the hash is filled in lazily.
+ */
+inline CatalogKey statCatalog(const std::string& catalogPath)
+{
+    CatalogKey key;
+    key.size = std::filesystem::file_size(catalogPath);
+    key.mtime = static_cast<int64_t>(std::filesystem::last_write_time(catalogPath).time_since_epoch().count());
+    return key;
+}
+
+inline uint64_t hashFile(const std::string& path)
+{
+    MappedDocument file(path);
+    return fnv1a64(file.text());
+}
+
+/**
+ * @brief Tries to map a valid cache for the given catalog.
+ * @return True and sets matcher if the cache exists and was built from the same catalog with the
+ *         same case folding and term weights.
+ * @details Size and modification time are compared first; if only the modification time
+ *          differs, the catalog is hashed, so touching an unchanged catalog does not invalidate
+ *          its cache. key.hash is then set, and stays 0 when nothing was hashed.
+ */
+inline bool tryLoad(const std::string& cachePath, const std::string& catalogPath, CatalogKey& key, AhoCorasick& matcher,
+                    CaseFold fold = CaseFold::None, bool weighted = false)
+{
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(cachePath, error)) {
+        return false;
+    }
+    auto cache = std::make_shared<MappedDocument>(cachePath);
+    std::string_view bytes = cache->text();
+    CatalogCacheHeader header{};
+    if (bytes.size() < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.cacheVersion != version ||
+        header.imageVersion != AhoCorasick::imageVersion || header.imageOffset + header.imageSize > bytes.size()) {
+        return false;
+    }
+
+    if (header.source.size != key.size) {
+        return false;
+    }
+    if (header.source.mtime != key.mtime) {
+        key.hash = hashFile(catalogPath);
+        if (header.source.hash != key.hash) {
+            return false;
+        }
+    }
+
+    try {
+        matcher = AhoCorasick::fromImage(bytes.data() + header.imageOffset, header.imageSize, cache);
+    } catch (const std::invalid_argument&) {
+        return false;
+    }
+    return matcher.caseFold() == fold && matcher.weighted() == weighted;
+}
+
+/**
+ * @brief Writes a cache file atomically (write to a temporary file, then rename).
+ */
+inline void store(const std::string& cachePath, const std::string& catalogPath, CatalogKey key, const AhoCorasick& matcher)
+{
+    if (key.hash == 0) {
+        key.hash = hashFile(catalogPath);
+    }
+    CatalogCacheHeader header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.cacheVersion = version;
+    header.imageVersion = AhoCorasick::imageVersion;
+    header.source = key;
+    header.imageOffset = (sizeof(header) + 7) & ~uint64_t{7};
+    header.imageSize = matcher.imageSize();
+
+    std::string temporaryPath = cachePath + ".tmp";
+    {
+        std::ofstream outputFile(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!outputFile.is_open()) {
+            std::cerr << "Error opening catalog cache for writing!" << std::endl;
+            return;
+        }
+        const char padding[8] = {};
+        outputFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        outputFile.write(padding, header.imageOffset - sizeof(header));
+        outputFile.write(matcher.imageData(), matcher.imageSize());
+        if (!outputFile) {
+            std::cerr << "Error writing catalog cache!" << std::endl;
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, cachePath, error);
+    if (error) {
+        std::cerr << "Error replacing catalog cache: " << error.message() << std::endl;
+    }
+}
+
+} // namespace catalogCache
+
+/**
+ * @brief Returns the compiled catalog, from the cache when it is still valid.
+ * @param catalogPath The source catalog file.
+ * @param cachePath The cache file; created or replaced when missing or stale.
+ * @param compile Reads and compiles the catalog with the given case folding; only called on a
+ *                cache miss.
+ * @param fold Case folding the cached automaton must have been compiled with.
+ * @param weighted Whether the cached catalog must have been parsed with term weights.
+ */
+template <typename Compile>
+AhoCorasick loadCompiledCatalog(const std::string& catalogPath, const std::string& cachePath, Compile&& compile,
+                                CaseFold fold = CaseFold::None, bool weighted = false)
+{
+    CatalogKey key = catalogCache::statCatalog(catalogPath);
+    AhoCorasick matcher;
+    if (catalogCache::tryLoad(cachePath, catalogPath, key, matcher, fold, weighted)) {
+        if (key.hash != 0) {
+            // The hash confirmed a touched catalog; record its new time so later starts skip the hash.
+            catalogCache::store(cachePath, catalogPath, key, matcher);
+        }
+        return matcher;
+    }
+    matcher = compile();
+    catalogCache::store(cachePath, catalogPath, key, matcher);
+    return matcher;
+}
+
+#endif // CATALOG_CACHE_H
@@ -0,0 +1,502 @@
+/**
+ * @file classificationServer.h
+ * @brief Long-running classification service on a Unix domain socket.
+ * @details The server compiles the catalog once and answers requests until it is told to shut
+ *          down. Every client connection is read on its own thread; requests of all connections
+ *          go to one queue, from which a dispatcher takes everything that is waiting (up to a
+ *          maximum batch size) and classifies it on a work-stealing pool. Requests that arrive
+ *          while a batch runs form the next batch, so batches grow with the load and a lone
+ *          request is not delayed. A reload compiles the new catalog next to the old one and
+ *          swaps it in between batches; requests are never refused while it compiles.
+ *
+ *          The protocol is line-based. A request is one of
+ *            CLASSIFY <path>\n       classify the document at path (as seen by the server)
+ *            TEXT <length>\n<bytes>  classify length raw bytes that follow the line
+ *            RELOAD\n                recompile the catalog and swap it in
+ *            SHUTDOWN\n              stop accepting requests and exit run()
+ *          and every reply is "OK" or "ERROR <message>", the "topic,count" lines of the result
+ *          for a classification, and an empty line. Requests of one connection are answered in
+ *          order. A TEXT request with a malformed length or one above the maximum request size is
+ *          answered with an error and the connection is closed, since its bytes cannot be skipped.
+ *          Only available where Unix domain sockets are (CLASSIFICATION_SERVER_AVAILABLE).
+ */
+#ifndef CLASSIFICATION_SERVER_H
+#define CLASSIFICATION_SERVER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "ahoCorasick.h"
+#include "documentReader.h"
+#include "instrumentation.h"
+#include "threadPool.h"
+#include "topicSelection.h"
+#include "wordMatcher.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define CLASSIFICATION_SERVER_AVAILABLE 1
+#else
+#define CLASSIFICATION_SERVER_AVAILABLE 0
+#endif
+
+/**
+ * @brief A compiled catalog as the server uses it; immutable once it is being served.
+ */
+struct ServedCatalog {
+    AhoCorasick matcher;
+    WordMatcher wordMatcher; ///< Built only when words is set.
+    bool words = false;      ///< Match whole words only instead of substrings.
+    EarlyStop earlyStop;     ///< Substring engine only.
+
+    std::vector<uint32_t> countTopics(std::string_view text) const
+    {
+        instrumentation::ScopedTimer timer(instrumentation::Matching);
+        if (words) {
+            return wordMatcher.countTopics(text);
+        }
+        if (earlyStop.active()) {
+            EarlyStopCounter counter(matcher, earlyStop);
+            counter.feed(text);
+            return counter.topicCounts();
+        }
+        return matcher.countTopics(text);
+    }
+};
+
+#if CLASSIFICATION_SERVER_AVAILABLE
+
+/**
+ * @brief Serves classification requests on a Unix domain socket; see the file comment for the protocol.
+ */
+class ClassificationServer {
+public:
+    /**
+     * @brief Compiles the catalog to serve; called once at startup and again for every reload.
+     */
+    using Loader = std::function<std::shared_ptr<const ServedCatalog>()>;
+
+    /**
+     * @param socketPath Path of the Unix domain socket; an existing socket file there is replaced.
+     * @param threads Classification threads; 0 means one per hardware thread.
+     * @param maxBatch Most requests classified in one batch.
+     * @param maxRequestBytes Largest text a TEXT request may carry; it is buffered whole.
+     * @throws std::runtime_error if the socket cannot be created.
+     */
+    ClassificationServer(const std::string& socketPath, Loader load, size_t threads, TopicSelection selection,
+                         size_t maxBatch = 256, size_t maxRequestBytes = 64 << 20)
+        : socketPath_(socketPath), load_(std::move(load)), selection_(selection),
+          maxBatch_(std::max<size_t>(maxBatch, 1)), maxRequestBytes_(maxRequestBytes), catalog_(load_()), pool_(threads)
+    {
+        sockaddr_un address {};
+        if (socketPath_.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("Socket path is too long: " + socketPath_);
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, socketPath_.c_str(), socketPath_.size() + 1);
+        if (::pipe(wakeFds_) != 0) {
+            throw std::runtime_error("Cannot create the shutdown pipe: " + std::string(std::strerror(errno)));
+        }
+        listenFd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        ::unlink(socketPath_.c_str());
+        if (listenFd_ < 0 || ::bind(listenFd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(listenFd_, SOMAXCONN) != 0) {
+            std::string error = std::strerror(errno);
+            if (listenFd_ >= 0) {
+                ::close(listenFd_);
+            }
+            ::close(wakeFds_[0]);
+            ::close(wakeFds_[1]);
+            throw std::runtime_error("Cannot listen on " + socketPath_ + ": " + error);
+        }
+    }
+
+    ClassificationServer(const ClassificationServer&) = delete;
+    ClassificationServer& operator=(const ClassificationServer&) = delete;
+
+    ~ClassificationServer()
+    {
+        stop();
+        ::close(listenFd_);
+        ::close(wakeFds_[0]);
+        ::close(wakeFds_[1]);
+        ::unlink(socketPath_.c_str());
+    }
+
+    /**
+     * @brief Accepts connections and answers requests until a SHUTDOWN request arrives.
+     */
+    void run()
+    {
+        std::thread dispatcher([this] { dispatch(); });
+        while (!stopping_) {
+            // Waiting in poll() rather than accept(): stop() wakes it through the pipe, which a
+            // shutdown() of the listening socket would not do everywhere (macOS, the BSDs).
+            pollfd waiting[2] = {{listenFd_, POLLIN, 0}, {wakeFds_[0], POLLIN, 0}};
+            if (::poll(waiting, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            if (waiting[1].revents != 0) {
+                break;
+            }
+            if (waiting[0].revents == 0) {
+                continue;
+            }
+            int client = ::accept(listenFd_, nullptr, nullptr);
+            if (client < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED) {
+                    continue;
+                }
+                break;
+            }
+            std::lock_guard<std::mutex> lock(connectionsMutex_);
+            if (stopping_) {
+                ::close(client);
+                break;
+            }
+            reapConnections();
+            auto connection = connections_.insert(connections_.end(), Connection {client, {}, false});
+            connection->thread = std::thread([this, connection] { serve(connection); });
+        }
+        stop();
+        // Connections finish their current request first, so the dispatcher has to outlive them.
+        std::list<Connection> remaining;
+        {
+            std::lock_guard<std::mutex> lock(connectionsMutex_);
+            remaining.swap(connections_);
+        }
+        for (Connection& connection : remaining) {
+            connection.thread.join();
+        }
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            dispatcherDone_ = true;
+        }
+        queueReady_.notify_all();
+        dispatcher.join();
+    }
+
+    /**
+     * @brief Compiles the catalog again and serves it from the next batch on.
+     * @return Number of topics of the new catalog.
+     */
+    size_t reload()
+    {
+        std::lock_guard<std::mutex> lock(reloadMutex_);
+        std::shared_ptr<const ServedCatalog> next = load_();
+        size_t topics = next->matcher.topicCount();
+        std::atomic_store(&catalog_, std::move(next));
+        return topics;
+    }
+
+private:
+    struct Connection {
+        int fd;             ///< Closed and set to -1 by the connection's thread when it is done.
+        std::thread thread;
+        bool done;
+    };
+
+    /**
+     * @brief A queued document: a path to map, or the text itself.
+     */
+    struct Request {
+        bool isPath;
+        std::string payload;
+        std::promise<std::string> reply;
+    };
+
+    /**
+     * @brief Buffered reads of lines and byte counts from a socket.
+     */
+    class Reader {
+    public:
+        explicit Reader(int fd) : fd_(fd) {}
+
+        bool readLine(std::string& line)
+        {
+            for (;;) {
+                size_t end = buffer_.find('\n', begin_);
+                if (end != std::string::npos) {
+                    line.assign(buffer_, begin_, end - begin_);
+                    begin_ = end + 1;
+                    return true;
+                }
+                if (!fill()) {
+                    return false;
+                }
+            }
+        }
+
+        bool readBytes(size_t count, std::string& bytes)
+        {
+            while (buffer_.size() - begin_ < count) {
+                if (!fill()) {
+                    return false;
+                }
+            }
+            bytes.assign(buffer_, begin_, count);
+            begin_ += count;
+            return true;
+        }
+
+    private:
+        bool fill()
+        {
+            buffer_.erase(0, begin_);
+            begin_ = 0;
+            char chunk[64 << 10];
+            ssize_t received = ::recv(fd_, chunk, sizeof(chunk), 0);
+            while (received < 0 && errno == EINTR) {
+                received = ::recv(fd_, chunk, sizeof(chunk), 0);
+            }
+            if (received <= 0) {
+                return false;
+            }
+            buffer_.append(chunk, static_cast<size_t>(received));
+            return true;
+        }
+
+        int fd_;
+        std::string buffer_;
+        size_t begin_ = 0;
+    };
+
+    /**
+     * @brief Wakes run() through the shutdown pipe and shuts every connection down, which wakes
+     *        the threads reading them.
+     */
+    void stop()
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex_);
+        if (!stopping_.exchange(true)) {
+            const char wake = 0;
+            while (::write(wakeFds_[1], &wake, 1) < 0 && errno == EINTR) {
+            }
+        }
+        for (Connection& connection : connections_) {
+            if (connection.fd >= 0) {
+                ::shutdown(connection.fd, SHUT_RDWR);
+            }
+        }
+    }
+
+    /**
+     * @brief Joins the threads of closed connections; called with connectionsMutex_ held.
+     */
+    void reapConnections()
+    {
+        for (auto connection = connections_.begin(); connection != connections_.end();) {
+            if (connection->done) {
+                connection->thread.join();
+                connection = connections_.erase(connection);
+            } else {
+                ++connection;
+            }
+        }
+    }
+
+    /**
+     * @brief Parses a decimal byte count; signs, spaces and more than 19 digits are rejected.
+     */
+    static bool parseLength(std::string_view digits, uint64_t& length)
+    {
+        if (digits.empty() || digits.size() > 19) {
+            return false;
+        }
+        uint64_t value = 0;
+        for (char c : digits) {
+            if (c < '0' || c > '9') {
+                return false;
+            }
+            value = value * 10 + static_cast<uint64_t>(c - '0');
+        }
+        length = value;
+        return true;
+    }
+
+    static bool sendAll(int fd, std::string_view bytes)
+    {
+        while (!bytes.empty()) {
+            ssize_t sent = ::send(fd, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                return false;
+            }
+            bytes.remove_prefix(static_cast<size_t>(sent));
+        }
+        return true;
+    }
+
+    /**
+     * @brief Reads the requests of one connection and answers them in order.
+     */
+    void serve(std::list<Connection>::iterator connection)
+    {
+        const int fd = connection->fd;
+        Reader reader(fd);
+        std::string line;
+        while (reader.readLine(line)) {
+            std::string reply;
+            if (line.rfind("CLASSIFY ", 0) == 0) {
+                reply = classify(true, line.substr(9));
+            } else if (line.rfind("TEXT ", 0) == 0) {
+                uint64_t length = 0;
+                if (!parseLength(std::string_view(line).substr(5), length)) {
+                    sendAll(fd, "ERROR Bad length\n\n");
+                    break;
+                }
+                if (length > maxRequestBytes_) {
+                    sendAll(fd, "ERROR Request larger than " + std::to_string(maxRequestBytes_) + " bytes\n\n");
+                    break;
+                }
+                std::string text;
+                if (!reader.readBytes(static_cast<size_t>(length), text)) {
+                    break;
+                }
+                reply = classify(false, std::move(text));
+            } else if (line == "RELOAD") {
+                try {
+                    reply = "OK " + std::to_string(reload()) + " topics\n\n";
+                } catch (const std::exception& error) {
+                    reply = "ERROR " + std::string(error.what()) + "\n\n";
+                }
+            } else if (line == "SHUTDOWN") {
+                sendAll(fd, "OK\n\n");
+                stop();
+                break;
+            } else {
+                reply = "ERROR Unknown request\n\n";
+            }
+            if (!sendAll(fd, reply)) {
+                break;
+            }
+        }
+        std::lock_guard<std::mutex> lock(connectionsMutex_);
+        ::close(fd);
+        connection->fd = -1;
+        connection->done = true;
+    }
+
+    /**
+     * @brief Queues one document and waits for its formatted result.
+     */
+    std::string classify(bool isPath, std::string payload)
+    {
+        std::future<std::string> reply;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            queue_.push_back(Request {isPath, std::move(payload), {}});
+            reply = queue_.back().reply.get_future();
+        }
+        queueReady_.notify_one();
+        try {
+            return reply.get();
+        } catch (const std::exception& error) {
+            return "ERROR " + std::string(error.what()) + "\n\n";
+        }
+    }
+
+    /**
+     * @brief Takes the waiting requests in batches and classifies every batch on the pool with
+     *        one snapshot of the catalog.
+     */
+    void dispatch()
+    {
+        std::vector<Request> batch;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(queueMutex_);
+                queueReady_.wait(lock, [this] { return !queue_.empty() || dispatcherDone_; });
+                if (queue_.empty()) {
+                    return;
+                }
+                size_t count = std::min(queue_.size(), maxBatch_);
+                batch.clear();
+                std::move(queue_.begin(), queue_.begin() + count, std::back_inserter(batch));
+                queue_.erase(queue_.begin(), queue_.begin() + count);
+            }
+            std::shared_ptr<const ServedCatalog> catalog = std::atomic_load(&catalog_);
+            for (Request& request : batch) {
+                pool_.submit([this, &catalog, &request](size_t) {
+                    // The connection waits on the reply, so it is completed whatever goes wrong.
+                    try {
+                        request.reply.set_value(answer(*catalog, request));
+                    } catch (...) {
+                        request.reply.set_exception(std::current_exception());
+                    }
+                });
+            }
+            pool_.wait();
+        }
+    }
+
+    std::string answer(const ServedCatalog& catalog, const Request& request) const
+    {
+        std::vector<uint32_t> counts;
+        try {
+            if (request.isPath) {
+                MappedDocument document(request.payload);
+                counts = catalog.countTopics(document.text());
+            } else {
+                counts = catalog.countTopics(request.payload);
+            }
+        } catch (const std::exception& error) {
+            return "ERROR " + std::string(error.what()) + "\n\n";
+        }
+        instrumentation::addDocument(counts);
+        std::string reply = "OK\n";
+        for (const auto& [topicId, count] : selectTopics(counts.data(), counts.size(), selection_)) {
+            reply += catalog.matcher.topicName(topicId);
+            reply += ',' + std::to_string(count) + '\n';
+        }
+        return reply + '\n';
+    }
+
+    std::string socketPath_;
+    Loader load_;
+    TopicSelection selection_;
+    size_t maxBatch_;
+    size_t maxRequestBytes_;
+    std::shared_ptr<const ServedCatalog> catalog_; ///< Swapped atomically by reload().
+    WorkStealingPool pool_;
+    int listenFd_ = -1;
+    int wakeFds_[2] = {-1, -1}; ///< Self-pipe; stop() writes a byte to wake run() out of poll().
+    std::atomic<bool> stopping_ {false};
+
+    std::mutex reloadMutex_;
+    std::mutex connectionsMutex_;
+    std::list<Connection> connections_;
+
+    std::mutex queueMutex_;
+    std::condition_variable queueReady_;
+    std::deque<Request> queue_;
+    bool dispatcherDone_ = false;
+};
+
+#endif // CLASSIFICATION_SERVER_AVAILABLE
+
+#endif // CLASSIFICATION_SERVER_H
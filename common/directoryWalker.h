@@ -0,0 +1,232 @@
+/**
+ * @file directoryWalker.h
+ * @brief Recursive, multi-threaded discovery of the documents below a directory.
+ * @details A flat directory_iterator misses documents in subfolders, and listing a tree of
+ *          millions of files up front delays classification until the listing is done. The
+ *          walker descends into every subdirectory on a pool of threads and hands out paths
+ *          while the walk is still going, so consumers can start on the first documents right
+ *          away. File types come from the directory entries as read (d_type), so no extra stat
+ *          is needed per file unless file sizes are asked for; those are then stat'ed on the
+ *          walker threads, alongside the listing. Symbolic links to directories are not
+ *          followed, which keeps cycles out of the walk.
+ */
+#ifndef DIRECTORY_WALKER_H
+#define DIRECTORY_WALKER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Whether the file name at the end of path has one of the extensions (".txt" etc.).
+ * @details Same rule as std::filesystem::path::extension(): a leading dot of the file name
+ *          does not start an extension.
+ */
+inline bool hasExtension(const std::string& path, const std::vector<std::string>& extensions)
+{
+    size_t nameStart = path.find_last_of('/');
+    nameStart = nameStart == std::string::npos ? 0 : nameStart + 1;
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || dot <= nameStart) {
+        return false;
+    }
+    for (const std::string& extension : extensions) {
+        if (path.size() - dot == extension.size() && path.compare(dot, extension.size(), extension) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Walks a directory tree in the background and streams the matching file paths.
+ * @details With one thread the order of the paths is deterministic: every directory's files in
+ *          directory order, before the files of its subdirectories. With more threads paths come
+ *          in discovery order, which changes from run to run.
+ */
+class DirectoryWalker {
+public:
+    /**
+     * @brief Starts walking.
+     * @param root Directory to walk, including all its subdirectories.
+     * @param extensions Only files with one of these extensions are reported.
+     * @param threadCount Walker threads; 0 means one per hardware thread.
+     * @param recordSizes Also find the size of every file, for poll() to hand out.
+     */
+    DirectoryWalker(const std::string& root, std::vector<std::string> extensions, size_t threadCount = 1,
+                    bool recordSizes = false)
+        : extensions_(std::move(extensions)), recordSizes_(recordSizes)
+    {
+        pending_.push_back(root);
+        size_t count = threadCount == 0 ? std::max(1u, std::thread::hardware_concurrency()) : threadCount;
+        threads_.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            threads_.emplace_back([this] { run(); });
+        }
+    }
+
+    DirectoryWalker(const DirectoryWalker&) = delete;
+    DirectoryWalker& operator=(const DirectoryWalker&) = delete;
+
+    /**
+     * @brief Stops the walk early if it is still running and joins the threads.
+     */
+    ~DirectoryWalker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        work_.notify_all();
+        for (std::thread& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    /**
+     * @brief Appends the paths discovered since the last call to paths.
+     * @param wait Block until at least one new path is found or the walk is over.
+     * @param sizes When not null, receives the size of every appended path (0 if it could not be
+     *              read); needs recordSizes.
+     * @return False once the walk is over and every path has been handed out.
+     * @throws std::filesystem::filesystem_error if a directory could not be read.
+     */
+    bool poll(std::vector<std::string>& paths, bool wait, std::vector<uintmax_t>* sizes = nullptr)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (wait) {
+            found_.wait(lock, [this] { return !ready_.empty() || finished() || error_; });
+        }
+        if (error_) {
+            std::exception_ptr error = error_;
+            error_ = nullptr;
+            std::rethrow_exception(error);
+        }
+        if (ready_.empty()) {
+            return !finished();
+        }
+        if (sizes != nullptr) {
+            sizes->insert(sizes->end(), readySizes_.begin(), readySizes_.end());
+        }
+        readySizes_.clear();
+        if (paths.empty()) {
+            paths.swap(ready_);
+        } else {
+            std::move(ready_.begin(), ready_.end(), std::back_inserter(paths));
+            ready_.clear();
+        }
+        return true;
+    }
+
+private:
+    bool finished() const { return pending_.empty() && busy_ == 0; }
+
+    void run()
+    {
+        std::vector<std::string> files;
+        std::vector<uintmax_t> sizes;
+        std::vector<std::string> directories;
+        while (true) {
+            std::string directory;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                work_.wait(lock, [this] { return stopping_ || !pending_.empty() || finished(); });
+                if (stopping_ || finished()) {
+                    return;
+                }
+                directory = std::move(pending_.back());
+                pending_.pop_back();
+                ++busy_;
+            }
+
+            files.clear();
+            sizes.clear();
+            directories.clear();
+            std::exception_ptr error;
+            try {
+                list(directory, files, sizes, directories);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                std::move(files.begin(), files.end(), std::back_inserter(ready_));
+                readySizes_.insert(readySizes_.end(), sizes.begin(), sizes.end());
+                // Pushed in reverse so that a single thread descends in directory order.
+                std::move(directories.rbegin(), directories.rend(), std::back_inserter(pending_));
+                if (error && !error_) {
+                    error_ = error;
+                }
+                --busy_;
+            }
+            found_.notify_all();
+            work_.notify_all();
+        }
+    }
+
+    void list(const std::string& directory, std::vector<std::string>& files, std::vector<uintmax_t>& sizes,
+              std::vector<std::string>& directories) const
+    {
+        std::filesystem::directory_iterator entries(directory, std::filesystem::directory_options::skip_permission_denied);
+        for (const auto& entry : entries) {
+            // The entry caches the type read with the directory, so only symlinks cost a stat here.
+            std::error_code error;
+            std::string path = entry.path().string();
+            if (!entry.is_symlink(error) && entry.is_directory(error)) {
+                directories.push_back(std::move(path));
+                continue;
+            }
+            if (!entry.is_regular_file(error) || !hasExtension(path, extensions_)) {
+                continue;
+            }
+            files.push_back(std::move(path));
+            if (recordSizes_) {
+                uintmax_t size = entry.file_size(error);
+                sizes.push_back(error ? 0 : size);
+            }
+        }
+    }
+
+    std::vector<std::string> extensions_;
+    bool recordSizes_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable work_;
+    std::condition_variable found_;
+    std::vector<std::string> pending_; ///< Directories waiting to be listed, as a stack.
+    std::vector<std::string> ready_;   ///< Paths found but not yet handed out.
+    std::vector<uintmax_t> readySizes_; ///< Sizes of ready_ with recordSizes; empty otherwise.
+    size_t busy_ = 0;                  ///< Directories being listed right now.
+    bool stopping_ = false;
+    std::exception_ptr error_;
+};
+
+/**
+ * @brief Calls onFile(std::string path) for every matching file below root, as it is found.
+ * @details Runs on the calling thread while the walker threads list ahead.
+ */
+template <typename Callback>
+void forEachFileInTree(const std::string& root, const std::vector<std::string>& extensions, size_t threads, Callback&& onFile)
+{
+    DirectoryWalker walker(root, extensions, threads);
+    std::vector<std::string> paths;
+    while (walker.poll(paths, true)) {
+        for (std::string& path : paths) {
+            onFile(std::move(path));
+        }
+        paths.clear();
+    }
+}
+
+#endif // DIRECTORY_WALKER_H
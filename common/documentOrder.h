@@ -0,0 +1,228 @@
+/**
+ * @file documentOrder.h
+ * @brief The order documents are read in and how they are grouped into batches and shares.
+ * @details By default documents are processed in the order the directory walk lists them, and
+ *          the MPI schedules split them by count. Both ignore where the files are and how big
+ *          they are: a few huge files can end up on one worker, and small files read in listing
+ *          order jump around the disk. One stat per document gives its size and its inode,
+ *          which on common file systems follows allocation order on disk:
+ *
+ *          Locality reads the documents by (device, inode), so readahead covers neighbours.
+ *          LargestFirst schedules the largest documents first (LPT), so the last documents to
+ *          finish are small ones and the makespan stays short. Shares for the static schedule
+ *          are balanced by bytes rather than counts, and every batch or share is read in
+ *          locality order.
+ *
+ *          Only the processing order changes; callers still report results in listing order.
+ */
+#ifndef DOCUMENT_ORDER_H
+#define DOCUMENT_ORDER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#define DOCUMENT_ORDER_HAS_INODES 1
+#endif
+
+/**
+ * @brief In which order documents are processed.
+ */
+enum class DocumentOrder {
+    Listing,     ///< As the directory walk found them.
+    Locality,    ///< By device and inode.
+    LargestFirst ///< By descending size (LPT); batches and shares in locality order.
+};
+
+inline DocumentOrder parseDocumentOrder(std::string_view name)
+{
+    if (name == "listing") {
+        return DocumentOrder::Listing;
+    }
+    if (name == "locality") {
+        return DocumentOrder::Locality;
+    }
+    if (name == "largest-first") {
+        return DocumentOrder::LargestFirst;
+    }
+    throw std::invalid_argument("Unknown document order: " + std::string(name));
+}
+
+/**
+ * @brief Size of a document and where it lives.
+ */
+struct FileLocation {
+    uintmax_t size = 0;  ///< Bytes; 0 if the file cannot be stat'ed.
+    uint64_t device = 0;
+    uint64_t inode = 0;  ///< 0 where inodes are not available.
+
+    bool before(const FileLocation& other) const
+    {
+        return device != other.device ? device < other.device : inode < other.inode;
+    }
+};
+
+/**
+ * @brief Size, device and inode of a file from a single stat.
+ */
+inline FileLocation locateFile(const std::string& path)
+{
+    FileLocation location;
+#ifdef DOCUMENT_ORDER_HAS_INODES
+    struct stat info {};
+    if (::stat(path.c_str(), &info) == 0) {
+        location.size = static_cast<uintmax_t>(info.st_size);
+        location.device = static_cast<uint64_t>(info.st_dev);
+        location.inode = static_cast<uint64_t>(info.st_ino);
+    }
+#else
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(path, error);
+    location.size = error ? 0 : size;
+#endif
+    return location;
+}
+
+inline std::vector<FileLocation> locateFiles(const std::vector<std::string>& paths)
+{
+    std::vector<FileLocation> locations;
+    locations.reserve(paths.size());
+    for (const std::string& path : paths) {
+        locations.push_back(locateFile(path));
+    }
+    return locations;
+}
+
+/**
+ * @brief Documents as they are to be processed, cut into consecutive groups.
+ */
+struct DocumentPlan {
+    std::vector<size_t> order; ///< Index of every document in the listing, in processing order.
+    std::vector<size_t> ends;  ///< End of every group in order (exclusive), ascending.
+};
+
+namespace documentOrder {
+
+/**
+ * @brief Sorts order[first, last) by location.
+ */
+inline void sortByLocation(std::vector<size_t>& order, size_t first, size_t last, const std::vector<FileLocation>& files)
+{
+    std::sort(order.begin() + first, order.begin() + last,
+              [&files](size_t a, size_t b) { return files[a].before(files[b]) || (!files[b].before(files[a]) && a < b); });
+}
+
+} // namespace documentOrder
+
+/**
+ * @brief Indices of the documents in the order they are to be processed.
+ */
+inline std::vector<size_t> processingOrder(const std::vector<FileLocation>& files, DocumentOrder order)
+{
+    std::vector<size_t> indices(files.size());
+    std::iota(indices.begin(), indices.end(), size_t{0});
+    if (order == DocumentOrder::Locality) {
+        documentOrder::sortByLocation(indices, 0, indices.size(), files);
+    } else if (order == DocumentOrder::LargestFirst) {
+        std::stable_sort(indices.begin(), indices.end(), [&files](size_t a, size_t b) { return files[a].size > files[b].size; });
+    }
+    return indices;
+}
+
+/**
+ * @brief Cuts the processing order into batches for the dynamic schedule.
+ * @details A batch closes at batchSize documents or, with a byte budget, once its documents add
+ *          up to at least batchBytes, as BatchScheduler does. With LargestFirst the big documents
+ *          come first and end up in small batches; each batch is then read in locality order.
+ */
+inline DocumentPlan planBatches(const std::vector<FileLocation>& files, DocumentOrder order, size_t batchSize,
+                                uintmax_t batchBytes)
+{
+    DocumentPlan plan;
+    plan.order = processingOrder(files, order);
+    size_t first = 0;
+    uintmax_t bytes = 0;
+    for (size_t i = 0; i < plan.order.size(); ++i) {
+        bytes += files[plan.order[i]].size;
+        if (i + 1 - first >= batchSize || (batchBytes > 0 && bytes >= batchBytes) || i + 1 == plan.order.size()) {
+            if (order == DocumentOrder::LargestFirst) {
+                documentOrder::sortByLocation(plan.order, first, i + 1, files);
+            }
+            plan.ends.push_back(i + 1);
+            first = i + 1;
+            bytes = 0;
+        }
+    }
+    return plan;
+}
+
+/**
+ * @brief Splits the documents into one share per participant for the static schedule, balanced
+ *        by bytes.
+ * @details Locality cuts the locality order into consecutive shares of about equal bytes, so
+ *          every participant reads a run of neighbouring files. LargestFirst assigns documents,
+ *          largest first, to the share with the fewest bytes so far (LPT, at most 4/3 of the best
+ *          makespan), then reads every share in locality order. Listing cuts the listing by bytes.
+ */
+inline DocumentPlan planShares(const std::vector<FileLocation>& files, DocumentOrder order, size_t parts)
+{
+    DocumentPlan plan;
+    if (order != DocumentOrder::LargestFirst) {
+        plan.order = processingOrder(files, order);
+        uintmax_t total = 0;
+        for (const FileLocation& file : files) {
+            total += file.size;
+        }
+        // Share k ends at the boundary nearest to (k + 1) / parts of all bytes.
+        uintmax_t bytes = 0;
+        size_t i = 0;
+        for (size_t share = 0; share + 1 < parts; ++share) {
+            uintmax_t target = total / parts * (share + 1) + total % parts * (share + 1) / parts;
+            while (i < plan.order.size() && bytes < target) {
+                uintmax_t next = bytes + files[plan.order[i]].size;
+                if (next > target && next - target > target - bytes) {
+                    break;
+                }
+                bytes = next;
+                ++i;
+            }
+            plan.ends.push_back(i);
+        }
+        plan.ends.push_back(plan.order.size());
+        return plan;
+    }
+
+    using Load = std::pair<uintmax_t, size_t>; // bytes so far, share
+    std::priority_queue<Load, std::vector<Load>, std::greater<Load>> loads;
+    for (size_t share = 0; share < parts; ++share) {
+        loads.emplace(0, share);
+    }
+    std::vector<std::vector<size_t>> shares(parts);
+    for (size_t document : processingOrder(files, DocumentOrder::LargestFirst)) {
+        auto [bytes, share] = loads.top();
+        loads.pop();
+        shares[share].push_back(document);
+        loads.emplace(bytes + files[document].size, share);
+    }
+    for (const std::vector<size_t>& share : shares) {
+        size_t first = plan.order.size();
+        plan.order.insert(plan.order.end(), share.begin(), share.end());
+        documentOrder::sortByLocation(plan.order, first, plan.order.size(), files);
+        plan.ends.push_back(plan.order.size());
+    }
+    return plan;
+}
+
+#endif // DOCUMENT_ORDER_H
@@ -0,0 +1,237 @@
+/**
+ * @file documentReader.h
+ * @brief Zero-copy access to the contents of a document file.
+ * @details On POSIX systems the file is memory-mapped and the matcher reads the page cache
+ *          directly. When mapping is not possible (empty files, pipes, platforms without mmap)
+ *          the whole file is read with a single buffered read instead of line by line.
+ *          Documents too large to hold at once can be streamed in fixed-size chunks instead
+ *          (forEachChunk).
+ */
+#ifndef DOCUMENT_READER_H
+#define DOCUMENT_READER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "instrumentation.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define DOCUMENT_READER_HAS_MMAP 1
+#endif
+
+/**
+ * @brief Read-only view over the contents of one document.
+ * @details The view returned by text() stays valid for the lifetime of the object.
+ */
+class MappedDocument {
+public:
+    /**
+     * @brief Opens and maps (or reads) a document.
+     * @param filePath Path to the document.
+     * @throws std::invalid_argument if the file cannot be opened.
+     */
+    explicit MappedDocument(const std::string& filePath) : MappedDocument(filePath.c_str()) {}
+
+    /**
+     * @brief Opens and maps (or reads) a document given as a NUL-terminated path.
+     * @param filePath Path to the document.
+     * @throws std::invalid_argument if the file cannot be opened.
+     */
+    explicit MappedDocument(const char* filePath)
+    {
+        instrumentation::ScopedTimer timer(instrumentation::FileRead);
+#ifdef DOCUMENT_READER_HAS_MMAP
+        if (!tryMap(filePath)) {
+            readBuffered(filePath);
+        }
+#else
+        readBuffered(filePath);
+#endif
+        instrumentation::add(instrumentation::BytesRead, size_);
+    }
+
+    MappedDocument(const MappedDocument&) = delete;
+    MappedDocument& operator=(const MappedDocument&) = delete;
+
+    MappedDocument(MappedDocument&& other) noexcept
+        : data_(other.data_), size_(other.size_), mapped_(other.mapped_), buffer_(std::move(other.buffer_))
+    {
+        if (!mapped_) {
+            data_ = buffer_.data();
+        }
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.mapped_ = false;
+    }
+
+    MappedDocument& operator=(MappedDocument&& other) noexcept
+    {
+        if (this != &other) {
+            unmap();
+            data_ = other.data_;
+            size_ = other.size_;
+            mapped_ = other.mapped_;
+            buffer_ = std::move(other.buffer_);
+            if (!mapped_) {
+                data_ = buffer_.data();
+            }
+            other.data_ = nullptr;
+            other.size_ = 0;
+            other.mapped_ = false;
+        }
+        return *this;
+    }
+
+    ~MappedDocument() { unmap(); }
+
+    /**
+     * @brief The document contents, including line breaks.
+     */
+    std::string_view text() const { return {data_, size_}; }
+
+    /**
+     * @brief Whether the contents are served from a memory mapping.
+     */
+    bool isMapped() const { return mapped_; }
+
+    /**
+     * @brief Pulls the contents of a mapped document into memory now.
+     * @details Touches one byte per page, so the reads happen on the calling thread instead of as
+     *          page faults in whoever scans the text later. Buffered documents are already in memory.
+     */
+    void prefetch() const
+    {
+#ifdef DOCUMENT_READER_HAS_MMAP
+        if (!mapped_) {
+            return;
+        }
+        instrumentation::ScopedTimer timer(instrumentation::FileRead);
+        ::madvise(const_cast<char*>(data_), size_, MADV_WILLNEED);
+        const size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        volatile char sink = 0;
+        for (size_t offset = 0; offset < size_; offset += pageSize) {
+            sink = sink + data_[offset];
+        }
+#endif
+    }
+
+private:
+#ifdef DOCUMENT_READER_HAS_MMAP
+    bool tryMap(const char* filePath)
+    {
+        int fd = ::open(filePath, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info {};
+        if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* address = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED) {
+            return false;
+        }
+        ::madvise(address, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(address);
+        size_ = static_cast<size_t>(info.st_size);
+        mapped_ = true;
+        return true;
+    }
+#endif
+
+    void readBuffered(const char* filePath)
+    {
+        std::ifstream inputFile(filePath, std::ios::binary | std::ios::ate);
+        if (!inputFile.is_open()) {
+            std::cerr << "Error opening the file!" << std::endl;
+            throw std::invalid_argument("Document file does not exist");
+        }
+        std::streamoff size = inputFile.tellg();
+        if (size > 0) {
+            buffer_.resize(static_cast<size_t>(size));
+            inputFile.seekg(0);
+            inputFile.read(buffer_.data(), size);
+            buffer_.resize(static_cast<size_t>(inputFile.gcount()));
+        } else {
+            // Size unknown (pipe, special file): fall back to reading until EOF.
+            inputFile.clear();
+            inputFile.seekg(0);
+            buffer_.assign(std::istreambuf_iterator<char>(inputFile), std::istreambuf_iterator<char>());
+        }
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+    }
+
+    void unmap()
+    {
+#ifdef DOCUMENT_READER_HAS_MMAP
+        if (mapped_) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+        mapped_ = false;
+    }
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::string buffer_;
+};
+
+/**
+ * @brief Reads a document in fixed-size chunks through a single buffer.
+ * @param filePath Path to the document.
+ * @param chunkSize Maximum number of bytes passed to onChunk at a time.
+ * @param onChunk Called as onChunk(std::string_view) for each chunk, in file order. If it returns
+ *                a bool, returning false stops reading.
+ * @details Peak memory is one chunk no matter how large the document is, which bounds the
+ *          footprint of multi-gigabyte inputs that a mapping would pull into the page cache.
+ * @throws std::invalid_argument if the file cannot be opened.
+ */
+template <typename Callback>
+void forEachChunk(const char* filePath, size_t chunkSize, Callback&& onChunk)
+{
+    std::ifstream inputFile(filePath, std::ios::binary | std::ios::ate);
+    if (!inputFile.is_open()) {
+        std::cerr << "Error opening the file!" << std::endl;
+        throw std::invalid_argument("Document file does not exist");
+    }
+    // Small documents only need a buffer of their own size.
+    std::streamoff size = inputFile.tellg();
+    if (size > 0 && static_cast<uintmax_t>(size) < chunkSize) {
+        chunkSize = static_cast<size_t>(size);
+    }
+    inputFile.clear();
+    inputFile.seekg(0);
+    std::string buffer(std::max<size_t>(chunkSize, 1), '\0');
+    auto readChunk = [&] {
+        instrumentation::ScopedTimer timer(instrumentation::FileRead);
+        return inputFile.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) || inputFile.gcount() > 0;
+    };
+    while (readChunk()) {
+        instrumentation::add(instrumentation::BytesRead, static_cast<uint64_t>(inputFile.gcount()));
+        std::string_view chunk(buffer.data(), static_cast<size_t>(inputFile.gcount()));
+        if constexpr (std::is_same_v<decltype(onChunk(chunk)), bool>) {
+            if (!onChunk(chunk)) {
+                return;
+            }
+        } else {
+            onChunk(chunk);
+        }
+    }
+}
+
+#endif // DOCUMENT_READER_H
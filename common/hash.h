@@ -0,0 +1,29 @@
+/**
+ * @file hash.h
+ * @brief Small non-cryptographic hash shared by the catalog cache and the word matcher.
+ */
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <string_view>
+
+/**
+ * @brief Offset basis of 64-bit FNV-1a; the hash of the empty string.
+ */
+constexpr uint64_t fnv1a64Basis = 14695981039346656037ull;
+
+/**
+ * @brief 64-bit FNV-1a hash of a byte range.
+ * @param hash Hash of the bytes before this range, so a key can be hashed piece by piece.
+ */
+inline uint64_t fnv1a64(std::string_view bytes, uint64_t hash = fnv1a64Basis)
+{
+    for (unsigned char c : bytes) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+#endif // HASH_H
@@ -0,0 +1,257 @@
+/**
+ * @file instrumentation.h
+ * @brief Compile-time switchable counters and stage timers, kept per thread.
+ * @details Build with -DDCAT_INSTRUMENTATION=1 to enable. Every thread that records anything gets
+ *          its own Sample, so recording is a plain add to thread-local memory without atomics or
+ *          locks; samples are read when the program reports, after its worker threads have been
+ *          joined. Without the define every call compiles to nothing.
+ *
+ *          Stage timers may nest: MpiWait covers blocking MPI calls and is also counted inside the
+ *          stage that issued them, and with memory-mapped documents most of the reading happens as
+ *          page faults during Matching rather than in FileRead.
+ */
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef DCAT_INSTRUMENTATION
+#define DCAT_INSTRUMENTATION 0
+#endif
+
+namespace instrumentation {
+
+constexpr bool enabled = DCAT_INSTRUMENTATION != 0;
+
+enum Counter : size_t {
+    BytesRead,  ///< Bytes of documents (and the catalog) read or mapped.
+    Documents,  ///< Documents classified.
+    Matches,    ///< Counted term occurrences over all topics.
+    EarlyStops, ///< Documents whose scan ended early because the leading topic was decisive.
+    CounterCount
+};
+
+enum Stage : size_t {
+    CatalogLoad,      ///< Reading and compiling the catalog, or loading its cache.
+    CatalogBroadcast, ///< Distributing the compiled catalog to the ranks.
+    Enumerate,        ///< Listing the documents.
+    PathDistribution, ///< Handing paths to the workers.
+    FileRead,         ///< Opening, mapping or reading documents.
+    Matching,         ///< Counting topics in documents.
+    ResultWrite,      ///< Writing results.
+    Scoring,          ///< Document frequencies and TF-IDF scores after classification.
+    MpiWait,          ///< Blocked in MPI calls.
+    StageCount
+};
+
+inline constexpr const char* counterNames[CounterCount] = {"bytesRead", "documents", "matches", "earlyStops"};
+inline constexpr const char* stageNames[StageCount] = {"catalogLoad", "catalogBroadcast", "enumerate",
+                                                       "pathDistribution", "fileRead", "matching",
+                                                       "resultWrite", "scoring", "mpiWait"};
+
+/**
+ * @brief Counters and per-stage nanoseconds of one thread, as one flat array so it can be sent
+ *        with a single MPI message.
+ */
+struct Sample {
+    static constexpr size_t words = CounterCount + StageCount;
+
+    uint64_t& counter(Counter counter) { return values[counter]; }
+    uint64_t counter(Counter counter) const { return values[counter]; }
+    uint64_t& nanoseconds(Stage stage) { return values[CounterCount + stage]; }
+    uint64_t nanoseconds(Stage stage) const { return values[CounterCount + stage]; }
+
+    Sample& operator+=(const Sample& other)
+    {
+        for (size_t i = 0; i < words; ++i) {
+            values[i] += other.values[i];
+        }
+        return *this;
+    }
+
+    uint64_t values[words] = {};
+};
+
+/**
+ * @brief Owns the samples of all threads; they outlive the threads that wrote them.
+ */
+class Registry {
+public:
+    static Registry& instance()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    Sample& create()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        samples_.push_back(std::make_unique<Sample>());
+        return *samples_.back();
+    }
+
+    /**
+     * @brief Copies of every thread's sample, in the order the threads first recorded something.
+     */
+    std::vector<Sample> samples() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<Sample> copies;
+        copies.reserve(samples_.size());
+        for (const auto& sample : samples_) {
+            copies.push_back(*sample);
+        }
+        return copies;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Sample>> samples_;
+};
+
+inline Sample& threadSample()
+{
+    thread_local Sample& sample = Registry::instance().create();
+    return sample;
+}
+
+/**
+ * @brief Adds to a counter of the calling thread.
+ */
+inline void add(Counter counter, uint64_t amount)
+{
+    if constexpr (enabled) {
+        threadSample().counter(counter) += amount;
+    }
+}
+
+/**
+ * @brief Adds the time until the end of the scope to a stage of the calling thread.
+ */
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Stage stage) : stage_(stage)
+    {
+        if constexpr (enabled) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    ~ScopedTimer() { stop(); }
+
+    /**
+     * @brief Ends the measurement before the end of the scope.
+     */
+    void stop()
+    {
+        if constexpr (enabled) {
+            if (running_) {
+                auto elapsed = std::chrono::steady_clock::now() - start_;
+                threadSample().nanoseconds(stage_) += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+                running_ = false;
+            }
+        }
+    }
+
+private:
+    Stage stage_;
+    bool running_ = true;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * @brief Samples of every thread of this process.
+ */
+inline std::vector<Sample> threadSamples()
+{
+    return Registry::instance().samples();
+}
+
+inline Sample total(const std::vector<Sample>& samples)
+{
+    Sample sum;
+    for (const Sample& sample : samples) {
+        sum += sample;
+    }
+    return sum;
+}
+
+/**
+ * @brief Appends a sample as {"counters": {...}, "seconds": {...}}.
+ */
+inline void appendJson(std::string& json, const Sample& sample)
+{
+    json += "{\"counters\": {";
+    for (size_t c = 0; c < CounterCount; ++c) {
+        json += (c > 0 ? ", \"" : "\"") + std::string(counterNames[c]) + "\": " +
+                std::to_string(sample.counter(static_cast<Counter>(c)));
+    }
+    json += "}, \"seconds\": {";
+    for (size_t s = 0; s < StageCount; ++s) {
+        json += (s > 0 ? ", \"" : "\"") + std::string(stageNames[s]) + "\": " +
+                std::to_string(sample.nanoseconds(static_cast<Stage>(s)) / 1e9);
+    }
+    json += "}}";
+}
+
+/**
+ * @brief Counts one classified document and the matches in it.
+ */
+template <typename Counts>
+void addDocument(const Counts& counts)
+{
+    if constexpr (enabled) {
+        uint64_t matches = 0;
+        for (auto count : counts) {
+            matches += count;
+        }
+        Sample& sample = threadSample();
+        sample.counter(Documents) += 1;
+        sample.counter(Matches) += matches;
+    }
+}
+
+/**
+ * @brief Appends the fields describing a group of threads, without braces: the thread count,
+ *        documents per second of wall time, the summed sample and every thread's own sample.
+ */
+inline void appendGroupFields(std::string& json, const std::vector<Sample>& samples, double wallSeconds)
+{
+    Sample sum = total(samples);
+    json += "\"threads\": " + std::to_string(samples.size()) + ", \"documentsPerSecond\": " +
+            std::to_string(wallSeconds > 0 ? sum.counter(Documents) / wallSeconds : 0.0) + ", \"total\": ";
+    appendJson(json, sum);
+    json += ", \"perThread\": [";
+    for (size_t i = 0; i < samples.size(); ++i) {
+        if (i > 0) {
+            json += ", ";
+        }
+        appendJson(json, samples[i]);
+    }
+    json += "]";
+}
+
+/**
+ * @brief The summary of a single process: every thread of it and the wall time of the run.
+ */
+inline std::string summaryJson(const std::vector<Sample>& samples, double wallSeconds)
+{
+    std::string json = std::string("{\"instrumentation\": ") + (enabled ? "true" : "false") +
+                       ", \"wallSeconds\": " + std::to_string(wallSeconds) + ", ";
+    appendGroupFields(json, samples, wallSeconds);
+    json += "}\n";
+    return json;
+}
+
+} // namespace instrumentation
+
+#endif // INSTRUMENTATION_H
@@ -0,0 +1,335 @@
+/**
+ * @file pipeline.h
+ * @brief Enumerate -> read -> match -> output pipeline over bounded lock-free queues.
+ * @details Classifying a document serially opens and reads it and then matches it, so the CPU
+ *          waits for the storage and the storage waits for the CPU. The pipeline runs each of
+ *          these on its own threads: while match threads scan documents, read threads are already
+ *          opening the next ones and faulting their pages in, so throughput approaches the slower
+ *          of I/O and matching instead of their sum. Queues between the stages are bounded, which
+ *          caps the number of documents held in memory at once.
+ *
+ *          Reads go through the page cache with prefetching read threads; this tree does not
+ *          depend on io_uring, and pages faulted in by a read thread are what an asynchronous
+ *          read would have delivered.
+ */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "documentReader.h"
+
+/**
+ * @brief Fixed-capacity multi-producer multi-consumer queue without locks.
+ * @details Every cell carries a sequence number that tells producers and consumers whether it
+ *          is free or filled for their lap of the ring (Vyukov's bounded queue), so a push or pop
+ *          is one compare-and-swap on the tail or head. Blocking operations back off by
+ *          spinning, then yielding, then sleeping briefly. T must be default-constructible.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    /**
+     * @param capacity Maximum number of queued elements, rounded up to a power of two.
+     */
+    explicit BoundedQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        cells_ = std::make_unique<Cell[]>(size);
+        mask_ = size - 1;
+        for (size_t i = 0; i < size; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /**
+     * @brief Queues value unless the queue is full; value is only moved from on success.
+     */
+    bool tryPush(T& value)
+    {
+        size_t position = tail_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[position & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0) {
+                if (tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Takes the oldest element unless the queue is empty.
+     */
+    bool tryPop(T& value)
+    {
+        size_t position = head_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[position & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (difference == 0) {
+                if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = head_.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->value);
+        cell->sequence.store(position + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Queues value, waiting while the queue is full.
+     */
+    void push(T value)
+    {
+        for (unsigned attempt = 0; !tryPush(value); ++attempt) {
+            backOff(attempt);
+        }
+    }
+
+    /**
+     * @brief Takes the oldest element, waiting while the queue is empty.
+     * @return False once the queue is closed and drained.
+     */
+    bool pop(T& value)
+    {
+        for (unsigned attempt = 0; !tryPop(value); ++attempt) {
+            if (closed_.load(std::memory_order_acquire)) {
+                // Elements pushed before close() are visible now; take any that are left.
+                return tryPop(value);
+            }
+            backOff(attempt);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Marks the end of the input; called once all producers are done pushing.
+     */
+    void close() { closed_.store(true, std::memory_order_release); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence{0};
+        T value{};
+    };
+
+    static void backOff(unsigned attempt)
+    {
+        if (attempt < 64) {
+            return;
+        }
+        if (attempt < 128) {
+            std::this_thread::yield();
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) std::atomic<bool> closed_{false};
+};
+
+/**
+ * @brief Queue depth and parallelism of the pipeline stages.
+ */
+struct PipelineOptions {
+    size_t queueDepth = 64; ///< Capacity of each queue between two stages.
+    size_t readers = 2;     ///< Threads opening and prefetching documents.
+    size_t matchers = 0;    ///< Threads matching documents; 0 means one per hardware thread.
+};
+
+/**
+ * @brief Classifies documents through the four pipeline stages.
+ * @param enumerate Runs on its own thread as enumerate(emit) and calls emit(std::string path)
+ *                  for every document, in document order. It may wait for more input between
+ *                  calls, so one pipeline can serve input that arrives over time.
+ * @param match Called as match(const std::string& path, const MappedDocument& document,
+ *              size_t worker) on the match threads and returns the result of one document.
+ *              worker indexes per-thread state of the caller, below options.matchers.
+ * @param output Called as output(size_t index, const std::string& path, Result&& result) on the
+ *               calling thread, in document order, as soon as every earlier document is done.
+ * @param onFailure Called as onFailure() once, on the failing thread, as soon as a stage throws;
+ *                  lets an enumerate stage that waits for input, and whoever feeds it, stop
+ *                  early. Must not throw.
+ * @throws The first exception thrown by a stage, once all threads have stopped.
+ */
+template <typename Result, typename Enumerate, typename Match, typename Output, typename OnFailure>
+void runPipeline(const PipelineOptions& options, Enumerate&& enumerate, Match&& match, Output&& output,
+                 OnFailure&& onFailure)
+{
+    struct Path {
+        size_t index = 0;
+        std::string path;
+    };
+    struct Loaded {
+        size_t index = 0;
+        std::string path;
+        std::unique_ptr<MappedDocument> document;
+    };
+    struct Done {
+        size_t index = 0;
+        std::string path;
+        Result result{};
+    };
+
+    const size_t depth = std::max<size_t>(options.queueDepth, 1);
+    const size_t readerCount = std::max<size_t>(options.readers, 1);
+    const size_t matcherCount =
+        options.matchers == 0 ? std::max(1u, std::thread::hardware_concurrency()) : options.matchers;
+    BoundedQueue<Path> paths(depth);
+    BoundedQueue<Loaded> documents(depth);
+    BoundedQueue<Done> results(depth);
+
+    // After a failure every stage keeps draining its input without producing, so no thread
+    // blocks on a full queue, and the first exception is rethrown at the end.
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    std::atomic<bool> failed{false};
+    auto fail = [&] {
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (error) {
+                return;
+            }
+            error = std::current_exception();
+            failed.store(true, std::memory_order_relaxed);
+        }
+        onFailure();
+    };
+
+    std::vector<std::thread> threads;
+    threads.emplace_back([&] {
+        size_t index = 0;
+        try {
+            enumerate([&](std::string path) {
+                if (!failed.load(std::memory_order_relaxed)) {
+                    paths.push(Path {index++, std::move(path)});
+                }
+            });
+        } catch (...) {
+            fail();
+        }
+        paths.close();
+    });
+
+    std::atomic<size_t> activeReaders{readerCount};
+    for (size_t reader = 0; reader < readerCount; ++reader) {
+        threads.emplace_back([&] {
+            Path next;
+            while (paths.pop(next)) {
+                if (failed.load(std::memory_order_relaxed)) {
+                    continue;
+                }
+                try {
+                    auto document = std::make_unique<MappedDocument>(next.path);
+                    document->prefetch();
+                    documents.push(Loaded {next.index, std::move(next.path), std::move(document)});
+                } catch (...) {
+                    fail();
+                }
+            }
+            if (activeReaders.fetch_sub(1) == 1) {
+                documents.close();
+            }
+        });
+    }
+
+    std::atomic<size_t> activeMatchers{matcherCount};
+    for (size_t worker = 0; worker < matcherCount; ++worker) {
+        threads.emplace_back([&, worker] {
+            Loaded next;
+            while (documents.pop(next)) {
+                if (failed.load(std::memory_order_relaxed)) {
+                    next.document.reset();
+                    continue;
+                }
+                try {
+                    Result result = match(next.path, *next.document, worker);
+                    next.document.reset();
+                    results.push(Done {next.index, std::move(next.path), std::move(result)});
+                } catch (...) {
+                    fail();
+                }
+            }
+            if (activeMatchers.fetch_sub(1) == 1) {
+                results.close();
+            }
+        });
+    }
+
+    // Output stage: results arrive in completion order and are released in document order.
+    std::map<size_t, Done> waiting;
+    size_t nextIndex = 0;
+    Done done;
+    while (results.pop(done)) {
+        if (failed.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        size_t index = done.index;
+        waiting.emplace(index, std::move(done));
+        try {
+            for (auto it = waiting.begin(); it != waiting.end() && it->first == nextIndex; it = waiting.erase(it)) {
+                output(nextIndex++, it->second.path, std::move(it->second.result));
+            }
+        } catch (...) {
+            fail();
+        }
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+ * @brief runPipeline for input that is complete once enumerate returns.
+ */
+template <typename Result, typename Enumerate, typename Match, typename Output>
+void runPipeline(const PipelineOptions& options, Enumerate&& enumerate, Match&& match, Output&& output)
+{
+    runPipeline<Result>(options, std::forward<Enumerate>(enumerate), std::forward<Match>(match),
+                        std::forward<Output>(output), [] {});
+}
+
+#endif // PIPELINE_H
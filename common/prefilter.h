@@ -0,0 +1,337 @@
+/**
+ * @file prefilter.h
+ * @brief SIMD skip-ahead over text in which no catalog identifier can start.
+ * @details Most document text contains no candidate at all. While the automaton is in its root
+ *          state, a kernel scans ahead for the next position whose first two bytes are the
+ *          first two bytes of some identifier, and the automaton resumes only there.
+ *
+ *          The vector kernels test 16 or 32 positions at a time: a nibble-table lookup (pshufb /
+ *          tbl) checks each byte against the set of first bytes and the byte after it against
+ *          the set of second bytes. The lookup may report false positives; every hit is then
+ *          confirmed exactly with a first-byte table and a 64 Kbit table of byte pairs.
+ *          The kernel is chosen at run time from what the CPU supports, and can be forced to
+ *          compare the paths.
+ */
+#ifndef PREFILTER_H
+#define PREFILTER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PREFILTER_HAS_X86 1
+#endif
+#if defined(__GNUC__) && defined(__aarch64__)
+#include <arm_neon.h>
+#define PREFILTER_HAS_NEON 1
+#endif
+
+namespace prefilter {
+
+/**
+ * @brief Skip kernel implementations.
+ */
+enum class Kernel {
+    Off,    ///< No prefilter; the automaton reads every byte.
+    Scalar, ///< Portable byte-at-a-time loop over the exact tables.
+    Sse42,  ///< 16 bytes per step (x86 SSE4.2).
+    Avx2,   ///< 32 bytes per step (x86 AVX2).
+    Neon,   ///< 16 bytes per step (AArch64 NEON).
+    Auto    ///< The widest kernel the CPU supports.
+};
+
+/**
+ * @brief Lookup tables derived from the identifiers of a catalog.
+ * @details Plain arrays without padding or pointers, so the tables are stored in the compiled
+ *          catalog image and used from there in place; the kernels load them unaligned.
+ */
+struct Tables {
+    static constexpr uint8_t firstByte = 1;  ///< Some identifier starts with this byte.
+    static constexpr uint8_t singleByte = 2; ///< This byte alone is an identifier.
+
+    std::array<uint8_t, 256> flags{};
+    std::array<uint64_t, 256 * 256 / 64> pairs{}; ///< Bit (a << 8 | b) set if an identifier starts with "ab".
+    std::array<uint8_t, 16> lowNibble{};       ///< Bucket bits per low nibble of a first byte.
+    std::array<uint8_t, 16> highNibble{};      ///< Bucket bit per high nibble.
+    std::array<uint8_t, 16> secondLowNibble{}; ///< As lowNibble, for second bytes.
+
+    /**
+     * @brief Registers an identifier; empty ones are ignored.
+     */
+    void addTerm(std::string_view term)
+    {
+        if (term.empty()) {
+            return;
+        }
+        auto first = static_cast<unsigned char>(term[0]);
+        flags[first] |= firstByte;
+        addToBuckets(lowNibble, first);
+        if (term.size() == 1) {
+            // Any byte may follow a one-byte identifier.
+            flags[first] |= singleByte;
+            secondLowNibble.fill(0xff);
+            return;
+        }
+        auto second = static_cast<unsigned char>(term[1]);
+        addToBuckets(secondLowNibble, second);
+        unsigned pair = first << 8 | second;
+        pairs[pair >> 6] |= uint64_t{1} << (pair & 63);
+    }
+
+    /**
+     * @brief Finalizes the nibble tables after the last addTerm.
+     */
+    void finish()
+    {
+        // A line break may hide the real second byte, so positions before one are candidates.
+        addToBuckets(secondLowNibble, '\n');
+        for (unsigned high = 0; high < 16; ++high) {
+            highNibble[high] = static_cast<uint8_t>(1u << (high & 7));
+        }
+    }
+
+    /**
+     * @brief Whether an identifier may start at data[i].
+     * @details Conservative at the end of the range (the next byte is not known yet) and before a
+     *          line break (which the automaton may skip).
+     */
+    bool isCandidate(const unsigned char* data, size_t i, size_t n) const
+    {
+        uint8_t flag = flags[data[i]];
+        if ((flag & firstByte) == 0) {
+            return false;
+        }
+        if ((flag & singleByte) != 0 || i + 1 >= n || data[i + 1] == '\n') {
+            return true;
+        }
+        unsigned pair = static_cast<unsigned>(data[i]) << 8 | data[i + 1];
+        return (pairs[pair >> 6] >> (pair & 63) & 1) != 0;
+    }
+
+private:
+    static void addToBuckets(std::array<uint8_t, 16>& table, unsigned char byte)
+    {
+        // High nibbles h and h + 8 share a bucket, which only adds false positives.
+        table[byte & 15] |= static_cast<uint8_t>(1u << ((byte >> 4) & 7));
+    }
+};
+
+/**
+ * @brief Returns the first candidate position in [i, n), or n if there is none.
+ * @details newlines is increased by the number of '\n' bytes skipped before that position.
+ */
+using SkipFunction = size_t (*)(const Tables& tables, const unsigned char* data, size_t i, size_t n, size_t& newlines);
+
+inline size_t skipScalar(const Tables& tables, const unsigned char* data, size_t i, size_t n, size_t& newlines)
+{
+    for (; i < n; ++i) {
+        if (tables.isCandidate(data, i, n)) {
+            return i;
+        }
+        newlines += data[i] == '\n';
+    }
+    return n;
+}
+
+#ifdef PREFILTER_HAS_X86
+/**
+ * @brief Confirms the hits of one block; returns the first confirmed offset or -1.
+ */
+inline int confirmBlock(const Tables& tables, const unsigned char* data, size_t i, size_t n, uint32_t hits,
+                        uint32_t lineBreaks, size_t& newlines)
+{
+    while (hits != 0) {
+        int offset = __builtin_ctz(hits);
+        if (tables.isCandidate(data, i + offset, n)) {
+            newlines += __builtin_popcount(lineBreaks & ((uint32_t{1} << offset) - 1));
+            return offset;
+        }
+        hits &= hits - 1;
+    }
+    return -1;
+}
+
+__attribute__((target("sse4.2"))) inline size_t skipSse42(const Tables& tables, const unsigned char* data, size_t i,
+                                                            size_t n, size_t& newlines)
+{
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.lowNibble.data()));
+    const __m128i secondLow = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.secondLowNibble.data()));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.highNibble.data()));
+    const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+    const __m128i lineBreak = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    // The block ends one byte early so that the following bytes can be loaded as well.
+    for (; i + 17 <= n; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 1));
+        __m128i firstBuckets = _mm_and_si128(_mm_shuffle_epi8(low, _mm_and_si128(bytes, nibbleMask)),
+                                             _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibbleMask)));
+        __m128i secondBuckets = _mm_and_si128(_mm_shuffle_epi8(secondLow, _mm_and_si128(next, nibbleMask)),
+                                              _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi16(next, 4), nibbleMask)));
+        __m128i misses = _mm_or_si128(_mm_cmpeq_epi8(firstBuckets, zero), _mm_cmpeq_epi8(secondBuckets, zero));
+        auto hits = static_cast<uint32_t>(~_mm_movemask_epi8(misses) & 0xffff);
+        auto lineBreaks = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, lineBreak)));
+        int offset = confirmBlock(tables, data, i, n, hits, lineBreaks, newlines);
+        if (offset >= 0) {
+            return i + offset;
+        }
+        newlines += __builtin_popcount(lineBreaks);
+    }
+    return skipScalar(tables, data, i, n, newlines);
+}
+
+__attribute__((target("avx2"))) inline size_t skipAvx2(const Tables& tables, const unsigned char* data, size_t i,
+                                                        size_t n, size_t& newlines)
+{
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.lowNibble.data())));
+    const __m256i secondLow =
+        _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.secondLowNibble.data())));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables.highNibble.data())));
+    const __m256i nibbleMask = _mm256_set1_epi8(0x0f);
+    const __m256i lineBreak = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_setzero_si256();
+    for (; i + 33 <= n; i += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 1));
+        __m256i firstBuckets =
+            _mm256_and_si256(_mm256_shuffle_epi8(low, _mm256_and_si256(bytes, nibbleMask)),
+                             _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibbleMask)));
+        __m256i secondBuckets =
+            _mm256_and_si256(_mm256_shuffle_epi8(secondLow, _mm256_and_si256(next, nibbleMask)),
+                             _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi16(next, 4), nibbleMask)));
+        __m256i misses = _mm256_or_si256(_mm256_cmpeq_epi8(firstBuckets, zero), _mm256_cmpeq_epi8(secondBuckets, zero));
+        auto hits = ~static_cast<uint32_t>(_mm256_movemask_epi8(misses));
+        auto lineBreaks = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, lineBreak)));
+        int offset = confirmBlock(tables, data, i, n, hits, lineBreaks, newlines);
+        if (offset >= 0) {
+            return i + offset;
+        }
+        newlines += __builtin_popcount(lineBreaks);
+    }
+    return skipSse42(tables, data, i, n, newlines);
+}
+#endif
+
+#ifdef PREFILTER_HAS_NEON
+inline size_t skipNeon(const Tables& tables, const unsigned char* data, size_t i, size_t n, size_t& newlines)
+{
+    const uint8x16_t low = vld1q_u8(tables.lowNibble.data());
+    const uint8x16_t secondLow = vld1q_u8(tables.secondLowNibble.data());
+    const uint8x16_t high = vld1q_u8(tables.highNibble.data());
+    const uint8x16_t nibbleMask = vdupq_n_u8(0x0f);
+    const uint8x16_t lineBreak = vdupq_n_u8('\n');
+    for (; i + 17 <= n; i += 16) {
+        uint8x16_t bytes = vld1q_u8(data + i);
+        uint8x16_t next = vld1q_u8(data + i + 1);
+        uint8x16_t firstBuckets = vandq_u8(vqtbl1q_u8(low, vandq_u8(bytes, nibbleMask)), vqtbl1q_u8(high, vshrq_n_u8(bytes, 4)));
+        uint8x16_t secondBuckets = vandq_u8(vqtbl1q_u8(secondLow, vandq_u8(next, nibbleMask)), vqtbl1q_u8(high, vshrq_n_u8(next, 4)));
+        uint8x16_t candidates = vandq_u8(vtstq_u8(firstBuckets, firstBuckets), vtstq_u8(secondBuckets, secondBuckets));
+        // Narrow each 0x00/0xff byte lane to a nibble: 4 mask bits per input byte.
+        uint64_t hits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(candidates), 4)), 0);
+        uint64_t lineBreaks =
+            vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vceqq_u8(bytes, lineBreak)), 4)), 0);
+        while (hits != 0) {
+            int bit = __builtin_ctzll(hits);
+            if (tables.isCandidate(data, i + bit / 4, n)) {
+                newlines += __builtin_popcountll(lineBreaks & ((uint64_t{1} << bit) - 1)) / 4;
+                return i + bit / 4;
+            }
+            hits &= ~(uint64_t{0xf} << (bit & ~3));
+        }
+        newlines += __builtin_popcountll(lineBreaks) / 4;
+    }
+    return skipScalar(tables, data, i, n, newlines);
+}
+#endif
+
+/**
+ * @brief Whether a kernel can run on this machine.
+ */
+inline bool isSupported(Kernel kernel)
+{
+    switch (kernel) {
+    case Kernel::Off:
+    case Kernel::Scalar:
+    case Kernel::Auto:
+        return true;
+#ifdef PREFILTER_HAS_X86
+    case Kernel::Sse42:
+        return __builtin_cpu_supports("sse4.2");
+    case Kernel::Avx2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef PREFILTER_HAS_NEON
+    case Kernel::Neon:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Resolves Auto to the widest supported kernel.
+ * @throws std::invalid_argument if an explicitly requested kernel is not supported.
+ */
+inline Kernel resolve(Kernel kernel)
+{
+    if (kernel == Kernel::Auto) {
+        for (Kernel candidate : {Kernel::Avx2, Kernel::Neon, Kernel::Sse42}) {
+            if (isSupported(candidate)) {
+                return candidate;
+            }
+        }
+        return Kernel::Scalar;
+    }
+    if (!isSupported(kernel)) {
+        throw std::invalid_argument("Prefilter kernel is not supported on this CPU");
+    }
+    return kernel;
+}
+
+/**
+ * @brief The skip function of a resolved kernel; nullptr for Off.
+ */
+inline SkipFunction skipFunction(Kernel kernel)
+{
+    switch (resolve(kernel)) {
+#ifdef PREFILTER_HAS_X86
+    case Kernel::Sse42:
+        return skipSse42;
+    case Kernel::Avx2:
+        return skipAvx2;
+#endif
+#ifdef PREFILTER_HAS_NEON
+    case Kernel::Neon:
+        return skipNeon;
+#endif
+    case Kernel::Off:
+        return nullptr;
+    default:
+        return skipScalar;
+    }
+}
+
+/**
+ * @brief Parses a kernel name as given on the command line.
+ * @throws std::invalid_argument for unknown names.
+ */
+inline Kernel parseKernel(std::string_view name)
+{
+    if (name == "off") return Kernel::Off;
+    if (name == "scalar") return Kernel::Scalar;
+    if (name == "sse4.2") return Kernel::Sse42;
+    if (name == "avx2") return Kernel::Avx2;
+    if (name == "neon") return Kernel::Neon;
+    if (name == "auto") return Kernel::Auto;
+    throw std::invalid_argument("Unknown prefilter: " + std::string(name));
+}
+
+} // namespace prefilter
+
+#endif // PREFILTER_H
@@ -0,0 +1,505 @@
+/**
+ * @file resultFile.h
+ * @brief Compact binary, columnar classification results and a memory-mapped reader.
+ * @details A result file starts with the topic dictionary, followed by blocks of documents as
+ *          they are written, and ends with an index of the blocks. Within a block the document
+ *          names and the counts are stored column by column: a name table, then the count
+ *          matrix of the block as a dense uint32 matrix, as sparse (topic, count) pairs or
+ *          packed as varints. Only one block is held in memory while writing, so results can
+ *          be streamed as they arrive. The reader maps the file and reads names and counts in
+ *          place; any document is found with a binary search over the block index.
+ *
+ *          Layout, every section aligned to 8 bytes:
+ *          ResultFileHeader, topic name table, blocks (BlockHeader, name table, counts),
+ *          BlockIndexEntry[blockCount], ResultFileTrailer.
+ *          A name table is uint32 offsets[n + 1] followed by the concatenated names.
+ */
+#ifndef RESULT_FILE_H
+#define RESULT_FILE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "documentReader.h"
+
+/**
+ * @brief How the counts of a block are stored.
+ */
+enum class CountEncoding : uint32_t {
+    Dense = 0,  ///< topicCount uint32 per document.
+    Sparse = 1, ///< Per document, a row of (topic, count) uint32 pairs for non-zero counts.
+    Packed = 2, ///< Sparse rows as varints, topics delta-encoded: the compressed form.
+    Auto = 3    ///< Dense or Sparse, whichever is smaller, chosen per block.
+};
+
+inline CountEncoding parseCountEncoding(std::string_view name)
+{
+    if (name == "dense") {
+        return CountEncoding::Dense;
+    }
+    if (name == "sparse") {
+        return CountEncoding::Sparse;
+    }
+    if (name == "packed") {
+        return CountEncoding::Packed;
+    }
+    if (name == "auto") {
+        return CountEncoding::Auto;
+    }
+    throw std::invalid_argument("Unknown count encoding: " + std::string(name));
+}
+
+struct ResultFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t topicCount;
+    uint64_t topicTableSize; ///< Bytes of the topic name table, padding included.
+};
+
+struct BlockHeader {
+    uint32_t documentCount;
+    uint32_t encoding;       ///< A CountEncoding other than Auto.
+    uint64_t nameTableSize;  ///< Bytes of the name table, padding included.
+    uint64_t countsSize;     ///< Bytes of the counts, padding included.
+};
+
+struct BlockIndexEntry {
+    uint64_t offset;        ///< Offset of the BlockHeader in the file.
+    uint64_t firstDocument; ///< Index of the first document of the block.
+};
+
+struct ResultFileTrailer {
+    uint64_t indexOffset;
+    uint64_t blockCount;
+    uint64_t documentCount;
+    char magic[8];
+};
+
+namespace resultFile {
+
+constexpr char magic[8] = {'D', 'C', 'A', 'T', 'R', 'E', 'S', '1'};
+constexpr uint32_t version = 1;
+
+inline size_t padded(size_t size) { return (size + 7) & ~size_t{7}; }
+
+inline void appendPadding(std::string& bytes) { bytes.resize(padded(bytes.size()), '\0'); }
+
+template <typename T>
+void appendRaw(std::string& bytes, const T& value)
+{
+    bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+inline void appendVarint(std::string& bytes, uint32_t value)
+{
+    while (value >= 0x80) {
+        bytes.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back(static_cast<char>(value));
+}
+
+inline uint32_t readVarint(const unsigned char*& cursor, const unsigned char* end)
+{
+    uint32_t value = 0;
+    for (int shift = 0; cursor < end && shift < 35; shift += 7) {
+        unsigned char byte = *cursor++;
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    throw std::invalid_argument("Corrupt result file: truncated varint");
+}
+
+/**
+ * @brief Appends a name table: uint32 offsets[n + 1], the names, padding.
+ */
+template <typename Names>
+void appendNameTable(std::string& bytes, const Names& names)
+{
+    uint32_t offset = 0;
+    for (const auto& name : names) {
+        appendRaw(bytes, offset);
+        offset += static_cast<uint32_t>(name.size());
+    }
+    appendRaw(bytes, offset);
+    for (const auto& name : names) {
+        bytes.append(name.data(), name.size());
+    }
+    appendPadding(bytes);
+}
+
+} // namespace resultFile
+
+/**
+ * @brief Streams classification results into a result file.
+ * @details Documents are buffered until a block is full and then written, so memory stays
+ *          bounded by the block size. The file is only complete, and readable, once close()
+ *          has written the block index; until then it is a partial file.
+ */
+class ResultFileWriter {
+public:
+    /**
+     * @param path File to write.
+     * @param topicNames Name of every topic, by topic id.
+     * @param encoding How counts are stored.
+     * @param blockDocuments Documents per block.
+     */
+    ResultFileWriter(const std::string& path, const std::vector<std::string>& topicNames,
+                     CountEncoding encoding = CountEncoding::Auto, size_t blockDocuments = 4096)
+        : outputFile_(path, std::ios::binary | std::ios::trunc), topicCount_(topicNames.size()), encoding_(encoding),
+          blockDocuments_(std::max<size_t>(1, blockDocuments))
+    {
+        if (!outputFile_.is_open()) {
+            std::cerr << "Error opening result file for writing!" << std::endl;
+            return;
+        }
+        std::string bytes;
+        resultFile::appendNameTable(bytes, topicNames);
+        ResultFileHeader header{};
+        std::memcpy(header.magic, resultFile::magic, sizeof(header.magic));
+        header.version = resultFile::version;
+        header.topicCount = static_cast<uint32_t>(topicCount_);
+        header.topicTableSize = bytes.size();
+        write(reinterpret_cast<const char*>(&header), sizeof(header));
+        write(bytes.data(), bytes.size());
+    }
+
+    ResultFileWriter(const ResultFileWriter&) = delete;
+    ResultFileWriter& operator=(const ResultFileWriter&) = delete;
+
+    ~ResultFileWriter() { close(); }
+
+    /**
+     * @brief Appends the counts of the next document.
+     * @param counts topicCount counts.
+     */
+    void add(std::string_view document, const uint32_t* counts)
+    {
+        names_.emplace_back(document);
+        counts_.insert(counts_.end(), counts, counts + topicCount_);
+        if (names_.size() == blockDocuments_) {
+            flushBlock();
+        }
+    }
+
+    /**
+     * @brief Writes the last block and the block index. Further calls do nothing.
+     */
+    void close()
+    {
+        if (closed_) {
+            return;
+        }
+        closed_ = true;
+        flushBlock();
+        ResultFileTrailer trailer{};
+        trailer.indexOffset = offset_;
+        trailer.blockCount = index_.size();
+        trailer.documentCount = documentCount_;
+        std::memcpy(trailer.magic, resultFile::magic, sizeof(trailer.magic));
+        write(reinterpret_cast<const char*>(index_.data()), index_.size() * sizeof(BlockIndexEntry));
+        write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+        outputFile_.close();
+        if (outputFile_.fail()) {
+            std::cerr << "Error writing result file!" << std::endl;
+        }
+    }
+
+private:
+    void write(const char* data, size_t size)
+    {
+        outputFile_.write(data, static_cast<std::streamsize>(size));
+        offset_ += size;
+    }
+
+    void flushBlock()
+    {
+        if (names_.empty()) {
+            return;
+        }
+        const size_t documents = names_.size();
+        CountEncoding encoding = encoding_;
+        if (encoding == CountEncoding::Auto) {
+            size_t nonZero = static_cast<size_t>(std::count_if(counts_.begin(), counts_.end(), [](uint32_t count) { return count != 0; }));
+            // Sparse rows cost a row start plus two words per non-zero count.
+            encoding = documents + 1 + 2 * nonZero < counts_.size() ? CountEncoding::Sparse : CountEncoding::Dense;
+        }
+
+        std::string nameTable;
+        resultFile::appendNameTable(nameTable, names_);
+        std::string counts;
+        if (encoding == CountEncoding::Dense) {
+            counts.append(reinterpret_cast<const char*>(counts_.data()), counts_.size() * sizeof(uint32_t));
+        } else {
+            // Row starts first, in pairs for Sparse and in bytes for Packed, then the rows.
+            std::string rows;
+            std::vector<uint32_t> rowStarts;
+            rowStarts.reserve(documents + 1);
+            for (size_t document = 0; document < documents; ++document) {
+                rowStarts.push_back(static_cast<uint32_t>(encoding == CountEncoding::Sparse ? rows.size() / 8 : rows.size()));
+                const uint32_t* row = counts_.data() + document * topicCount_;
+                uint32_t nextTopic = 0;
+                for (uint32_t topic = 0; topic < topicCount_; ++topic) {
+                    if (row[topic] == 0) {
+                        continue;
+                    }
+                    if (encoding == CountEncoding::Sparse) {
+                        resultFile::appendRaw(rows, topic);
+                        resultFile::appendRaw(rows, row[topic]);
+                    } else {
+                        resultFile::appendVarint(rows, topic - nextTopic);
+                        resultFile::appendVarint(rows, row[topic]);
+                    }
+                    nextTopic = topic + 1;
+                }
+            }
+            rowStarts.push_back(static_cast<uint32_t>(encoding == CountEncoding::Sparse ? rows.size() / 8 : rows.size()));
+            counts.append(reinterpret_cast<const char*>(rowStarts.data()), rowStarts.size() * sizeof(uint32_t));
+            resultFile::appendPadding(counts);
+            counts += rows;
+        }
+        resultFile::appendPadding(counts);
+
+        BlockHeader header{};
+        header.documentCount = static_cast<uint32_t>(documents);
+        header.encoding = static_cast<uint32_t>(encoding);
+        header.nameTableSize = nameTable.size();
+        header.countsSize = counts.size();
+        index_.push_back(BlockIndexEntry {offset_, documentCount_});
+        write(reinterpret_cast<const char*>(&header), sizeof(header));
+        write(nameTable.data(), nameTable.size());
+        write(counts.data(), counts.size());
+
+        documentCount_ += documents;
+        names_.clear();
+        counts_.clear();
+    }
+
+    std::ofstream outputFile_;
+    size_t topicCount_;
+    CountEncoding encoding_;
+    size_t blockDocuments_;
+    std::vector<std::string> names_;
+    std::vector<uint32_t> counts_;
+    std::vector<BlockIndexEntry> index_;
+    uint64_t offset_ = 0;
+    uint64_t documentCount_ = 0;
+    bool closed_ = false;
+};
+
+/**
+ * @brief Reads a result file in place from a memory mapping.
+ * @details Names are returned as views into the mapping and stay valid for the lifetime of the
+ *          reader.
+ */
+class ResultFileReader {
+public:
+    /**
+     * @throws std::invalid_argument if the file cannot be opened or is not a complete result file.
+     */
+    explicit ResultFileReader(const std::string& path) : file_(path)
+    {
+        bytes_ = file_.text();
+        ResultFileHeader header{};
+        ResultFileTrailer trailer{};
+        if (bytes_.size() < sizeof(header) + sizeof(trailer)) {
+            throw std::invalid_argument("Result file is truncated");
+        }
+        std::memcpy(&header, bytes_.data(), sizeof(header));
+        std::memcpy(&trailer, bytes_.data() + bytes_.size() - sizeof(trailer), sizeof(trailer));
+        if (std::memcmp(header.magic, resultFile::magic, sizeof(header.magic)) != 0 ||
+            std::memcmp(trailer.magic, resultFile::magic, sizeof(trailer.magic)) != 0 || header.version != resultFile::version) {
+            throw std::invalid_argument("Not a complete result file of this version");
+        }
+        topicCount_ = header.topicCount;
+        documentCount_ = trailer.documentCount;
+        const size_t indexBytes = trailer.blockCount * sizeof(BlockIndexEntry);
+        if (sizeof(header) + header.topicTableSize > bytes_.size() || trailer.indexOffset % 8 != 0 ||
+            trailer.indexOffset + indexBytes + sizeof(trailer) != bytes_.size()) {
+            throw std::invalid_argument("Corrupt result file");
+        }
+        topics_ = nameTable(sizeof(header), header.topicTableSize, topicCount_);
+        index_ = reinterpret_cast<const BlockIndexEntry*>(bytes_.data() + trailer.indexOffset);
+        blockCount_ = trailer.blockCount;
+    }
+
+    size_t documentCount() const { return documentCount_; }
+
+    size_t topicCount() const { return topicCount_; }
+
+    std::string_view topicName(size_t topic) const { return topics_.name(topic); }
+
+    std::string_view documentName(size_t document) const
+    {
+        Block block = locate(document);
+        return block.names.name(document - block.first);
+    }
+
+    /**
+     * @brief Calls onCount(topic, count) for every non-zero count of a document, by topic id.
+     */
+    template <typename Callback>
+    void forEachCount(size_t document, Callback&& onCount) const
+    {
+        Block block = locate(document);
+        const size_t row = document - block.first;
+        switch (block.encoding) {
+        case CountEncoding::Dense:
+            for (uint32_t topic = 0; topic < topicCount_; ++topic) {
+                uint32_t count = block.words[row * topicCount_ + topic];
+                if (count != 0) {
+                    onCount(topic, count);
+                }
+            }
+            return;
+        case CountEncoding::Sparse: {
+            const uint32_t* pairs = block.words + padded32(block.documentCount + 1);
+            checkRow(block, block.words[row], block.words[row + 1], 8);
+            for (uint32_t entry = block.words[row]; entry < block.words[row + 1]; ++entry) {
+                onCount(pairs[2 * entry], pairs[2 * entry + 1]);
+            }
+            return;
+        }
+        case CountEncoding::Packed: {
+            const unsigned char* rows = reinterpret_cast<const unsigned char*>(block.words + padded32(block.documentCount + 1));
+            checkRow(block, block.words[row], block.words[row + 1], 1);
+            const unsigned char* cursor = rows + block.words[row];
+            const unsigned char* end = rows + block.words[row + 1];
+            uint32_t topic = 0;
+            while (cursor < end) {
+                topic += resultFile::readVarint(cursor, end);
+                onCount(topic, resultFile::readVarint(cursor, end));
+                ++topic;
+            }
+            return;
+        }
+        default:
+            throw std::invalid_argument("Corrupt result file: unknown count encoding");
+        }
+    }
+
+    /**
+     * @brief All topicCount counts of a document.
+     */
+    std::vector<uint32_t> counts(size_t document) const
+    {
+        std::vector<uint32_t> row(topicCount_, 0);
+        forEachCount(document, [&row](uint32_t topic, uint32_t count) {
+            if (topic < row.size()) {
+                row[topic] = count;
+            }
+        });
+        return row;
+    }
+
+private:
+    /**
+     * @brief A name table in the mapping.
+     */
+    struct NameTable {
+        const uint32_t* offsets = nullptr;
+        const char* names = nullptr;
+        size_t count = 0;
+
+        std::string_view name(size_t i) const
+        {
+            if (i >= count) {
+                throw std::out_of_range("Result file name index out of range");
+            }
+            return std::string_view(names + offsets[i], offsets[i + 1] - offsets[i]);
+        }
+    };
+
+    struct Block {
+        size_t first = 0;
+        uint32_t documentCount = 0;
+        CountEncoding encoding = CountEncoding::Dense;
+        NameTable names;
+        const uint32_t* words = nullptr; ///< Start of the counts section.
+        size_t countsSize = 0;           ///< Bytes of the counts section.
+    };
+
+    /**
+     * @brief Row starts are padded to 8 bytes, i.e. to an even number of words.
+     */
+    static size_t padded32(size_t words) { return (words + 1) & ~size_t{1}; }
+
+    NameTable nameTable(size_t offset, size_t size, size_t count) const
+    {
+        const size_t offsetBytes = (count + 1) * sizeof(uint32_t);
+        if (offset % 8 != 0 || size < offsetBytes || offset + size > bytes_.size()) {
+            throw std::invalid_argument("Corrupt result file: name table");
+        }
+        NameTable table;
+        table.offsets = reinterpret_cast<const uint32_t*>(bytes_.data() + offset);
+        table.names = bytes_.data() + offset + offsetBytes;
+        table.count = count;
+        if (table.offsets[count] > size - offsetBytes) {
+            throw std::invalid_argument("Corrupt result file: name table");
+        }
+        return table;
+    }
+
+    /**
+     * @brief Checks that a sparse or packed row lies within the counts of its block.
+     */
+    static void checkRow(const Block& block, uint32_t begin, uint32_t end, size_t unit)
+    {
+        const size_t rowsBytes = block.countsSize - padded32(block.documentCount + 1) * sizeof(uint32_t);
+        if (begin > end || end * unit > rowsBytes) {
+            throw std::invalid_argument("Corrupt result file: count row");
+        }
+    }
+
+    Block locate(size_t document) const
+    {
+        if (document >= documentCount_) {
+            throw std::out_of_range("Result file document index out of range");
+        }
+        const BlockIndexEntry* entry = std::upper_bound(index_, index_ + blockCount_, document,
+                                                        [](size_t value, const BlockIndexEntry& block) {
+                                                            return value < block.firstDocument;
+                                                        }) - 1;
+        BlockHeader header{};
+        if (entry->offset + sizeof(header) > bytes_.size()) {
+            throw std::invalid_argument("Corrupt result file: block");
+        }
+        std::memcpy(&header, bytes_.data() + entry->offset, sizeof(header));
+        Block block;
+        block.first = entry->firstDocument;
+        block.documentCount = header.documentCount;
+        block.encoding = static_cast<CountEncoding>(header.encoding);
+        const size_t namesOffset = entry->offset + sizeof(header);
+        block.names = nameTable(namesOffset, header.nameTableSize, header.documentCount);
+        const size_t countsOffset = namesOffset + header.nameTableSize;
+        const size_t minimumCounts = block.encoding == CountEncoding::Dense
+                                         ? size_t{header.documentCount} * topicCount_ * sizeof(uint32_t)
+                                         : padded32(header.documentCount + 1) * sizeof(uint32_t);
+        if (countsOffset + header.countsSize > bytes_.size() || header.countsSize < minimumCounts ||
+            document - block.first >= block.documentCount) {
+            throw std::invalid_argument("Corrupt result file: block");
+        }
+        block.words = reinterpret_cast<const uint32_t*>(bytes_.data() + countsOffset);
+        block.countsSize = header.countsSize;
+        return block;
+    }
+
+    MappedDocument file_;
+    std::string_view bytes_;
+    size_t topicCount_ = 0;
+    size_t documentCount_ = 0;
+    NameTable topics_;
+    const BlockIndexEntry* index_ = nullptr;
+    size_t blockCount_ = 0;
+};
+
+#endif // RESULT_FILE_H
@@ -0,0 +1,269 @@
+/**
+ * @file resultIndex.h
+ * @brief Persistent per-document results for incremental re-classification.
+ * @details The index records, for every document of a run, its size, modification time and
+ *          content hash together with its topic counts, under the version of the catalog and
+ *          engine that produced them. A later run that finds a document unchanged reuses its
+ *          counts instead of reading and matching it again. Any change to the catalog or the
+ *          engine changes the version and invalidates the whole index.
+ */
+#ifndef RESULT_INDEX_H
+#define RESULT_INDEX_H
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+#include "ahoCorasick.h"
+#include "catalogCache.h"
+#include "documentReader.h"
+#include "hash.h"
+
+/**
+ * @brief Identity of a document's contents; hash 0 means the hash was not computed.
+ */
+struct DocumentKey {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = 0;
+};
+
+/**
+ * @brief Header at the start of a result index file.
+ * @details It is followed by entryCount records, each an IndexEntryHeader, the path padded to a
+ *          multiple of 4 bytes and topicCount uint32 counts.
+ */
+struct ResultIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t topicCount;
+    uint64_t catalogVersion;
+    uint64_t entryCount;
+};
+
+struct IndexEntryHeader {
+    DocumentKey key;
+    uint32_t pathLength;
+    uint32_t reserved;
+};
+
+/**
+ * @brief Results of the previous run, and the results of this run as they are recorded.
+ * @details lookup() and record() may be called from several threads at once.
+ */
+class ResultIndex {
+public:
+    static constexpr char magic[8] = {'D', 'C', 'A', 'T', 'I', 'D', 'X', '1'};
+    static constexpr uint32_t version = 1;
+
+    /**
+     * @brief Version of the results produced by a compiled catalog and an engine.
+     */
+    static uint64_t catalogVersion(const AhoCorasick& matcher, std::string_view engine)
+    {
+        return fnv1a64(engine, fnv1a64(std::string_view(matcher.imageData(), matcher.imageSize())));
+    }
+
+    /**
+     * @brief Reads size and modification time of a document.
+     * @return False if the document cannot be stat'ed.
+     */
+    static bool statDocument(const std::string& path, DocumentKey& key)
+    {
+        std::error_code error;
+        key.size = std::filesystem::file_size(path, error);
+        if (error) {
+            return false;
+        }
+        key.mtime = static_cast<int64_t>(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+        key.hash = 0;
+        return !error;
+    }
+
+    /**
+     * @brief Loads the index at path; a missing, damaged or outdated index is treated as empty.
+     */
+    ResultIndex(std::string path, uint64_t catalogVersion, size_t topicCount)
+        : path_(std::move(path)), catalogVersion_(catalogVersion), topicCount_(topicCount)
+    {
+        std::error_code error;
+        if (std::filesystem::is_regular_file(path_, error)) {
+            load();
+        }
+    }
+
+    /**
+     * @brief Counts from the previous run, if the document has not changed since.
+     * @param key Size and modification time of the document now; on success the hash is
+     *            filled in from the index.
+     * @details Size and modification time are compared first; if only the modification time
+     *          differs, the document is hashed, so touching an unchanged document does not cost
+     *          a re-classification.
+     */
+    bool lookup(const std::string& path, DocumentKey& key, std::vector<uint32_t>& counts) const
+    {
+        auto it = previous_.find(path);
+        if (it == previous_.end() || it->second.key.size != key.size) {
+            return false;
+        }
+        const DocumentKey& known = it->second.key;
+        if (known.mtime != key.mtime) {
+            if (known.hash == 0 || catalogCache::hashFile(path) != known.hash) {
+                return false;
+            }
+        }
+        key.hash = known.hash;
+        const uint32_t* first = previousCounts_.data() + it->second.counts;
+        counts.assign(first, first + topicCount_);
+        return true;
+    }
+
+    /**
+     * @brief Records the counts of a document for the next run.
+     */
+    void record(const std::string& path, const DocumentKey& key, const uint32_t* counts)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto [it, inserted] = current_.try_emplace(path, Entry {key, currentCounts_.size()});
+        if (inserted) {
+            currentCounts_.insert(currentCounts_.end(), counts, counts + topicCount_);
+        } else {
+            it->second.key = key;
+            std::memcpy(currentCounts_.data() + it->second.counts, counts, topicCount_ * sizeof(uint32_t));
+        }
+    }
+
+    /**
+     * @brief Returns the counts of a document, reusing them from the index when it is unchanged.
+     * @param classify Called as classify(uint64_t& hash) to count a new or changed document. It
+     *                 folds every byte of the document into hash with fnv1a64 as it reads them,
+     *                 so the document is not read a second time for its content hash.
+     */
+    template <typename Classify>
+    std::vector<uint32_t> classify(const std::string& path, Classify&& classify)
+    {
+        DocumentKey key;
+        std::vector<uint32_t> counts;
+        uint64_t hash = fnv1a64Basis;
+        if (!statDocument(path, key)) {
+            return classify(hash);
+        }
+        if (!lookup(path, key, counts)) {
+            counts = classify(hash);
+            key.hash = hash;
+        }
+        record(path, key, counts.data());
+        return counts;
+    }
+
+    /**
+     * @brief Replaces the index file with the documents recorded in this run.
+     * @details Documents that were not seen in this run are dropped. The file is written to a
+     *          temporary file first and renamed, so an interrupted run leaves the old index.
+     */
+    void store() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ResultIndexHeader header{};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.topicCount = static_cast<uint32_t>(topicCount_);
+        header.catalogVersion = catalogVersion_;
+        header.entryCount = current_.size();
+
+        std::string temporaryPath = path_ + ".tmp";
+        {
+            std::ofstream outputFile(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!outputFile.is_open()) {
+                std::cerr << "Error opening result index for writing!" << std::endl;
+                return;
+            }
+            const char padding[4] = {};
+            outputFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            for (const auto& [path, entry] : current_) {
+                IndexEntryHeader entryHeader{};
+                entryHeader.key = entry.key;
+                entryHeader.pathLength = static_cast<uint32_t>(path.size());
+                outputFile.write(reinterpret_cast<const char*>(&entryHeader), sizeof(entryHeader));
+                outputFile.write(path.data(), path.size());
+                outputFile.write(padding, paddedLength(path.size()) - path.size());
+                outputFile.write(reinterpret_cast<const char*>(currentCounts_.data() + entry.counts),
+                                 topicCount_ * sizeof(uint32_t));
+            }
+            if (!outputFile) {
+                std::cerr << "Error writing result index!" << std::endl;
+                return;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(temporaryPath, path_, error);
+        if (error) {
+            std::cerr << "Error replacing result index: " << error.message() << std::endl;
+        }
+    }
+
+private:
+    struct Entry {
+        DocumentKey key;
+        size_t counts; ///< Offset of the document's counts in the counts array.
+    };
+
+    static size_t paddedLength(size_t length) { return (length + 3) & ~size_t{3}; }
+
+    void load()
+    {
+        MappedDocument file(path_);
+        std::string_view bytes = file.text();
+        ResultIndexHeader header{};
+        if (bytes.size() < sizeof(header)) {
+            return;
+        }
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version ||
+            header.catalogVersion != catalogVersion_ || header.topicCount != topicCount_) {
+            return;
+        }
+
+        size_t offset = sizeof(header);
+        const size_t countBytes = topicCount_ * sizeof(uint32_t);
+        for (uint64_t i = 0; i < header.entryCount; ++i) {
+            IndexEntryHeader entryHeader{};
+            if (bytes.size() - offset < sizeof(entryHeader)) {
+                break;
+            }
+            std::memcpy(&entryHeader, bytes.data() + offset, sizeof(entryHeader));
+            offset += sizeof(entryHeader);
+            size_t pathBytes = paddedLength(entryHeader.pathLength);
+            if (bytes.size() - offset < pathBytes + countBytes) {
+                break;
+            }
+            std::string path(bytes.data() + offset, entryHeader.pathLength);
+            offset += pathBytes;
+            size_t counts = previousCounts_.size();
+            previousCounts_.resize(counts + topicCount_);
+            std::memcpy(previousCounts_.data() + counts, bytes.data() + offset, countBytes);
+            offset += countBytes;
+            previous_.emplace(std::move(path), Entry {entryHeader.key, counts});
+        }
+    }
+
+    std::string path_;
+    uint64_t catalogVersion_;
+    size_t topicCount_;
+
+    std::unordered_map<std::string, Entry> previous_;
+    std::vector<uint32_t> previousCounts_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> current_;
+    std::vector<uint32_t> currentCounts_;
+};
+
+#endif // RESULT_INDEX_H
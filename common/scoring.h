@@ -0,0 +1,163 @@
+/**
+ * @file scoring.h
+ * @brief TF-IDF scores per topic, computed from the term counts of every document.
+ * @details Classifying a document with scoring enabled also records how often each distinct
+ *          term (pattern) of the catalog occurs in it, as a sparse array. Once every document has
+ *          been classified, the document frequency of each term gives its inverse document
+ *          frequency, and a second pass over the recorded arrays, without reading any document
+ *          again, scores every document:
+ *
+ *            x(p)     = count(p) * idf(p),  idf(p) = ln((1 + N) / (1 + df(p))) + 1
+ *            score(t) = sum over the listings of term p under topic t of weight * x(p) / |x|
+ *
+ *          Dividing by the Euclidean norm |x| of the document's term vector removes the bias
+ *          towards long documents, and the IDF the bias towards terms common to the whole
+ *          corpus. Weights come from the "^weight" suffixes of a catalog parsed with
+ *          term weights (Catalog::weighted). The MPI build sums
+ *          the document frequencies of all ranks with a single MPI_Allreduce.
+ */
+#ifndef SCORING_H
+#define SCORING_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "ahoCorasick.h"
+
+/**
+ * @brief The distinct terms found in one document and how often, as parallel arrays.
+ */
+struct TermCounts {
+    std::vector<uint32_t> patterns; ///< Pattern ids, ascending.
+    std::vector<uint32_t> counts;   ///< Occurrences of patterns[i].
+};
+
+/**
+ * @brief The non-zero entries of a dense per-pattern count array.
+ */
+inline TermCounts sparseTermCounts(const std::vector<uint32_t>& patternCounts)
+{
+    TermCounts terms;
+    for (size_t pattern = 0; pattern < patternCounts.size(); ++pattern) {
+        if (patternCounts[pattern] != 0) {
+            terms.patterns.push_back(static_cast<uint32_t>(pattern));
+            terms.counts.push_back(patternCounts[pattern]);
+        }
+    }
+    return terms;
+}
+
+/**
+ * @brief Term counts of the documents classified so far, by document path.
+ * @details record() may be called from several threads at once.
+ */
+class TermCountLog {
+public:
+    void record(std::string_view document, const std::vector<uint32_t>& patternCounts)
+    {
+        TermCounts terms = sparseTermCounts(patternCounts);
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.emplace_back(std::string(document), std::move(terms));
+    }
+
+    /**
+     * @brief The recorded documents, in the order they were recorded.
+     */
+    const std::vector<std::pair<std::string, TermCounts>>& entries() const { return entries_; }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::pair<std::string, TermCounts>> entries_;
+};
+
+/**
+ * @brief Document frequencies of the terms of a matcher and the TF-IDF scores they give.
+ */
+class TfIdfScorer {
+public:
+    explicit TfIdfScorer(const AhoCorasick& matcher)
+        : matcher_(&matcher), documentFrequencies_(matcher.patternCount(), 0)
+    {
+    }
+
+    /**
+     * @brief Counts a document towards the document frequencies of its terms.
+     */
+    void addDocument(const TermCounts& terms)
+    {
+        for (uint32_t pattern : terms.patterns) {
+            ++documentFrequencies_[pattern];
+        }
+        ++documents_;
+    }
+
+    /**
+     * @brief Documents containing each pattern; summed over ranks in place before computeIdf().
+     */
+    std::vector<uint64_t>& documentFrequencies() { return documentFrequencies_; }
+
+    /**
+     * @brief Documents counted; summed over ranks in place before computeIdf().
+     */
+    uint64_t& documents() { return documents_; }
+
+    /**
+     * @brief Derives the inverse document frequency of every pattern from the frequencies.
+     */
+    void computeIdf()
+    {
+        idf_.resize(documentFrequencies_.size());
+        const double corpus = static_cast<double>(documents_) + 1;
+        for (size_t pattern = 0; pattern < idf_.size(); ++pattern) {
+            idf_[pattern] = static_cast<float>(std::log(corpus / (static_cast<double>(documentFrequencies_[pattern]) + 1)) + 1);
+        }
+    }
+
+    /**
+     * @brief Scores of one document indexed by topic id; all zero without matches.
+     * @details The weighting and the norm are straight loops over the document's contiguous
+     *          term arrays, which the compiler vectorizes; only the final scatter to the topics
+     *          follows the catalog's pattern -> topic listings.
+     */
+    std::vector<float> score(const TermCounts& terms) const
+    {
+        const size_t n = terms.patterns.size();
+        std::vector<float> weighted(n);
+        const uint32_t* patterns = terms.patterns.data();
+        const uint32_t* counts = terms.counts.data();
+        const float* idf = idf_.data();
+        for (size_t i = 0; i < n; ++i) {
+            weighted[i] = static_cast<float>(counts[i]) * idf[patterns[i]];
+        }
+        float squares = 0;
+        for (size_t i = 0; i < n; ++i) {
+            squares += weighted[i] * weighted[i];
+        }
+        std::vector<float> scores(matcher_->topicCount(), 0.0f);
+        if (squares <= 0) {
+            return scores;
+        }
+        const float scale = 1.0f / std::sqrt(squares);
+        for (size_t i = 0; i < n; ++i) {
+            AhoCorasick::Listings listings = matcher_->listings(patterns[i]);
+            const float value = weighted[i] * scale;
+            for (size_t j = 0; j < listings.size; ++j) {
+                scores[listings.topics[j]] += listings.weights[j] * value;
+            }
+        }
+        return scores;
+    }
+
+private:
+    const AhoCorasick* matcher_;
+    std::vector<uint64_t> documentFrequencies_;
+    uint64_t documents_ = 0;
+    std::vector<float> idf_;
+};
+
+#endif // SCORING_H
@@ -0,0 +1,197 @@
+/**
+ * @file threadPool.h
+ * @brief Work-stealing thread pool used by the shared-memory classifier modes.
+ * @details Every worker owns a task deque. Workers take work from the back of their own deque
+ *          and, when it runs dry, steal from the front of the other workers' deques, so long
+ *          documents on one worker do not leave the others idle.
+ */
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed-size pool of worker threads with per-worker deques and stealing.
+ */
+class WorkStealingPool {
+public:
+    /**
+     * @brief A unit of work. It receives the index of the worker that runs it, which callers
+     *        use to address per-thread state without locking.
+     */
+    using Task = std::function<void(size_t worker)>;
+
+    /**
+     * @brief Starts the workers.
+     * @param threadCount Number of worker threads; 0 means one per hardware thread.
+     */
+    explicit WorkStealingPool(size_t threadCount)
+        : queues_(threadCount == 0 ? std::max(1u, std::thread::hardware_concurrency()) : threadCount)
+    {
+        threads_.reserve(queues_.size());
+        for (size_t worker = 0; worker < queues_.size(); ++worker) {
+            threads_.emplace_back([this, worker] { run(worker); });
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    /**
+     * @brief Finishes the queued work and joins the workers.
+     */
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    /**
+     * @brief Number of worker threads.
+     */
+    size_t size() const { return threads_.size(); }
+
+    /**
+     * @brief Queues a task.
+     * @details Tasks submitted from inside a worker go to that worker's own deque; tasks
+     *          submitted from outside are spread round-robin.
+     */
+    void submit(Task task)
+    {
+        size_t target = currentWorker() < queues_.size() && currentPool() == this
+                            ? currentWorker()
+                            : nextQueue_++ % queues_.size();
+        // Count the task before publishing it, so a worker can never finish it first.
+        {
+            std::lock_guard<std::mutex> lock(stateMutex_);
+            ++queued_;
+            ++pending_;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues_[target].mutex);
+            queues_[target].tasks.push_back(std::move(task));
+        }
+        wake_.notify_one();
+    }
+
+    /**
+     * @brief Blocks until every submitted task has finished.
+     * @throws The first exception thrown by a task, if any.
+     */
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(stateMutex_);
+        done_.wait(lock, [this] { return pending_ == 0; });
+        if (error_) {
+            std::exception_ptr error = error_;
+            error_ = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    static size_t& currentWorker()
+    {
+        thread_local size_t worker = static_cast<size_t>(-1);
+        return worker;
+    }
+
+    static const WorkStealingPool*& currentPool()
+    {
+        thread_local const WorkStealingPool* pool = nullptr;
+        return pool;
+    }
+
+    bool popOwn(size_t worker, Task& task)
+    {
+        std::lock_guard<std::mutex> lock(queues_[worker].mutex);
+        if (queues_[worker].tasks.empty()) {
+            return false;
+        }
+        task = std::move(queues_[worker].tasks.back());
+        queues_[worker].tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t worker, Task& task)
+    {
+        for (size_t offset = 1; offset < queues_.size(); ++offset) {
+            Queue& victim = queues_[(worker + offset) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t worker)
+    {
+        currentWorker() = worker;
+        currentPool() = this;
+        while (true) {
+            Task task;
+            if (popOwn(worker, task) || steal(worker, task)) {
+                {
+                    std::lock_guard<std::mutex> lock(stateMutex_);
+                    --queued_;
+                }
+                try {
+                    task(worker);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(stateMutex_);
+                    if (!error_) {
+                        error_ = std::current_exception();
+                    }
+                }
+                std::lock_guard<std::mutex> lock(stateMutex_);
+                if (--pending_ == 0) {
+                    done_.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(stateMutex_);
+            wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+            if (stopping_ && queued_ == 0) {
+                return;
+            }
+        }
+    }
+
+    std::vector<Queue> queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> nextQueue_{0};
+
+    std::mutex stateMutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    size_t queued_ = 0;
+    size_t pending_ = 0;
+    bool stopping_ = false;
+    std::exception_ptr error_;
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,164 @@
+/**
+ * @file topicSelection.h
+ * @brief Reporting only the leading topics of a document, and stopping its scan once the leader
+ *        is clear.
+ * @details A TopicSelection keeps the top K topics by count, or the topics counted at least a
+ *          minimum number of times, or both. An EarlyStop is an opt-in heuristic: the text is
+ *          scanned in windows of decisiveBytes and the scan ends after the first window at which
+ *          the leading topic is ahead of the runner-up by at least margin matches. The counts of
+ *          a stopped document cover only the text scanned so far, so they are not comparable with
+ *          full counts and are never stored in a result index.
+ */
+#ifndef TOPIC_SELECTION_H
+#define TOPIC_SELECTION_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "ahoCorasick.h"
+#include "instrumentation.h"
+
+/**
+ * @brief Which topics of a document are reported.
+ */
+struct TopicSelection {
+    size_t topK = 0;       ///< Report at most this many topics; 0 does not limit them.
+    uint32_t minCount = 0; ///< Report only topics counted at least this often; 0 does not limit them.
+
+    bool active() const { return topK > 0 || minCount > 0; }
+};
+
+/**
+ * @brief The selected topics as (topic id, count) pairs, by descending count and ascending topic
+ *        id among equal counts. With an active selection, topics without matches are left out.
+ * @details Count is uint32_t for match counts and float for scores.
+ */
+template <typename Count>
+std::vector<std::pair<size_t, Count>> selectTopics(const Count* counts, size_t topicCount, const TopicSelection& selection)
+{
+    std::vector<std::pair<size_t, Count>> selected;
+    for (size_t topic = 0; topic < topicCount; ++topic) {
+        if (!selection.active() || (counts[topic] > 0 && counts[topic] >= static_cast<Count>(selection.minCount))) {
+            selected.emplace_back(topic, counts[topic]);
+        }
+    }
+    if (!selection.active()) {
+        return selected;
+    }
+    auto ranksBefore = [](const auto& a, const auto& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    };
+    if (selection.topK > 0 && selected.size() > selection.topK) {
+        std::partial_sort(selected.begin(), selected.begin() + selection.topK, selected.end(), ranksBefore);
+        selected.resize(selection.topK);
+    } else {
+        std::sort(selected.begin(), selected.end(), ranksBefore);
+    }
+    return selected;
+}
+
+/**
+ * @brief Sets the counts of all topics that are not selected to zero.
+ */
+inline void keepSelected(std::vector<uint32_t>& counts, const TopicSelection& selection)
+{
+    if (!selection.active()) {
+        return;
+    }
+    std::vector<uint32_t> kept(counts.size(), 0);
+    for (const auto& [topic, count] : selectTopics(counts.data(), counts.size(), selection)) {
+        kept[topic] = count;
+    }
+    counts = std::move(kept);
+}
+
+/**
+ * @brief When the scan of a document may end early.
+ */
+struct EarlyStop {
+    size_t decisiveBytes = 0; ///< Check the leader after every this many bytes; 0 always scans everything.
+    uint32_t margin = 3;      ///< Matches the leader must be ahead of the runner-up by.
+
+    bool active() const { return decisiveBytes > 0; }
+};
+
+/**
+ * @brief Whether the leading topic is ahead of every other topic by at least margin matches.
+ */
+inline bool isDecisive(const std::vector<uint32_t>& counts, uint32_t margin)
+{
+    uint32_t leader = 0;
+    uint32_t runnerUp = 0;
+    for (uint32_t count : counts) {
+        if (count > leader) {
+            runnerUp = leader;
+            leader = count;
+        } else if (count > runnerUp) {
+            runnerUp = count;
+        }
+    }
+    return leader > 0 && leader - runnerUp >= margin;
+}
+
+/**
+ * @brief Counts topics over consecutive chunks of a text, like AhoCorasick::StreamCounter, and
+ *        tells the caller to stop once the leader is decisive.
+ * @details The chunks may have any size; the leader is checked whenever the text fed so far
+ *          reaches a multiple of decisiveBytes, so the result does not depend on how the text is
+ *          split. Each check sums the pattern counts once, so windows should be a few KB at least.
+ *          With an inactive EarlyStop it counts the whole text, like a plain StreamCounter.
+ */
+class EarlyStopCounter {
+public:
+    EarlyStopCounter(const AhoCorasick& matcher, const EarlyStop& stop)
+        : counter_(matcher), stop_(stop), nextCheck_(stop.active() ? stop.decisiveBytes : SIZE_MAX)
+    {
+    }
+
+    /**
+     * @brief Scans the next chunk of the text.
+     * @param positions As for AhoCorasick::StreamCounter::feed.
+     * @return False once the leader is decisive; later chunks are ignored.
+     */
+    bool feed(std::string_view chunk, std::vector<MatchPosition>* positions = nullptr)
+    {
+        while (!chunk.empty() && !decided_) {
+            size_t take = std::min(chunk.size(), nextCheck_ - fed_);
+            counter_.feed(chunk.substr(0, take), positions);
+            fed_ += take;
+            chunk.remove_prefix(take);
+            if (fed_ == nextCheck_) {
+                decided_ = isDecisive(counter_.topicCounts(), stop_.margin);
+                nextCheck_ += stop_.decisiveBytes;
+                if (decided_) {
+                    instrumentation::add(instrumentation::EarlyStops, 1);
+                }
+            }
+        }
+        return !decided_;
+    }
+
+    /**
+     * @brief Counts per topic id for the text scanned.
+     */
+    std::vector<uint32_t> topicCounts() const { return counter_.topicCounts(); }
+
+    /**
+     * @brief Counts per pattern id for the text scanned.
+     */
+    const std::vector<uint32_t>& patternCounts() const { return counter_.patternCounts(); }
+
+    bool stoppedEarly() const { return decided_; }
+
+private:
+    AhoCorasick::StreamCounter counter_;
+    EarlyStop stop_;
+    size_t fed_ = 0;
+    size_t nextCheck_;
+    bool decided_ = false;
+};
+
+#endif // TOPIC_SELECTION_H
@@ -0,0 +1,314 @@
+/**
+ * @file wordMatcher.h
+ * @brief Whole-word classification engine backed by a flat hash table of catalog terms.
+ * @details The substring engine (AhoCorasick) finds "AI" inside "maintain". This engine splits a
+ *          document into words once and looks every word up in an open-addressing hash table,
+ *          so only whole words count. Terms of several words ("machine learning") are matched as
+ *          n-grams: the table also holds every proper word prefix of such terms, and a lookup is
+ *          only extended to the next word while the words so far are such a prefix.
+ */
+#ifndef WORD_MATCHER_H
+#define WORD_MATCHER_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ahoCorasick.h"
+#include "hash.h"
+
+/**
+ * @brief Bytes that belong to a word: ASCII letters and digits, and every byte of a multi-byte
+ *        UTF-8 sequence (>= 0x80), so non-ASCII words are kept whole without decoding them.
+ */
+struct WordBytes {
+    constexpr WordBytes() : table()
+    {
+        for (int c = 0; c < 256; ++c) {
+            table[c] = (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c >= 0x80;
+        }
+    }
+    bool table[256];
+};
+
+inline constexpr WordBytes wordBytes{};
+
+/**
+ * @brief Calls onWord(std::string_view) for every word of a text, in order.
+ * @details Everything that is not a word byte separates words, including line breaks. The views
+ *          point into text; nothing is allocated.
+ *
+ *          The text is classified 64 bytes at a time into a bit mask without branches, and word
+ *          starts and ends are read off the mask's 0/1 transitions, so the loop does not mispredict
+ *          at every word boundary.
+ */
+template <typename Callback>
+void forEachWord(std::string_view text, Callback&& onWord)
+{
+    const auto* data = reinterpret_cast<const unsigned char*>(text.data());
+    const size_t length = text.size();
+    size_t start = 0;
+    uint64_t inWord = 0;
+    for (size_t block = 0; block < length; block += 64) {
+        size_t count = std::min<size_t>(64, length - block);
+        uint64_t mask = 0;
+        for (size_t j = 0; j < count; ++j) {
+            mask |= uint64_t{wordBytes.table[data[block + j]]} << j;
+        }
+        uint64_t previous = mask << 1 | inWord;
+        uint64_t starts = mask & ~previous;
+        uint64_t ends = ~mask & previous;
+        if (count < 64) {
+            ends &= (uint64_t{1} << count) - 1;
+        }
+        while ((starts | ends) != 0) {
+            int nextStart = starts != 0 ? __builtin_ctzll(starts) : 64;
+            int nextEnd = ends != 0 ? __builtin_ctzll(ends) : 64;
+            if (nextEnd < nextStart) {
+                onWord(text.substr(start, block + nextEnd - start));
+                ends &= ends - 1;
+            } else {
+                start = block + nextStart;
+                starts &= starts - 1;
+            }
+        }
+        inWord = mask >> (count - 1) & 1;
+    }
+    if (inWord != 0) {
+        onWord(text.substr(start));
+    }
+}
+
+/**
+ * @brief Counts whole-word occurrences of catalog terms per topic.
+ * @details A term is split into words with the same rules as documents, so "C++" is the word
+ *          "C" and "machine-learning" is the two-word term "machine learning". Occurrences of one
+ *          term do not overlap, matching the default of the substring engine; a term listed under
+ *          several topics is credited to each listing.
+ */
+class WordMatcher {
+public:
+    WordMatcher() = default;
+
+    /**
+     * @brief Builds the term table from the topics and terms of a compiled catalog.
+     */
+    explicit WordMatcher(const AhoCorasick& catalog) : topicCount_(catalog.topicCount())
+    {
+        struct Key {
+            int32_t term = -1;
+            bool prefix = false;
+        };
+        std::unordered_map<std::string, Key> keys;
+        std::vector<std::vector<int32_t>> termTopics;
+        std::vector<std::string_view> words;
+        for (size_t topic = 0; topic < topicCount_; ++topic) {
+            for (size_t i = 0; i < catalog.termCount(topic); ++i) {
+                words.clear();
+                forEachWord(catalog.term(topic, i), [&](std::string_view word) { words.push_back(word); });
+                if (words.empty()) {
+                    continue;
+                }
+                maxWords_ = std::max(maxWords_, words.size());
+                firstWordLengths_[static_cast<unsigned char>(words[0][0])] |= lengthBit(words[0].size());
+                std::string key;
+                for (size_t w = 0; w < words.size(); ++w) {
+                    if (w > 0) {
+                        keys[key].prefix = true;
+                        key += ' ';
+                    }
+                    key += words[w];
+                }
+                Key& entry = keys[key];
+                if (entry.term < 0) {
+                    entry.term = static_cast<int32_t>(termTopics.size());
+                    termTopics.emplace_back();
+                }
+                termTopics[entry.term].push_back(static_cast<int32_t>(topic));
+            }
+        }
+
+        termTopicOffsets_.push_back(0);
+        for (const auto& topics : termTopics) {
+            topicIds_.insert(topicIds_.end(), topics.begin(), topics.end());
+            termTopicOffsets_.push_back(static_cast<uint32_t>(topicIds_.size()));
+        }
+
+        size_t capacity = 16;
+        while (capacity < keys.size() * 2) {
+            capacity *= 2;
+        }
+        slots_.assign(capacity, Slot{});
+        mask_ = capacity - 1;
+        for (const auto& [key, entry] : keys) {
+            Slot slot;
+            slot.hash = fnv1a64(key);
+            slot.keyBegin = static_cast<uint32_t>(keyBytes_.size());
+            slot.keyLength = static_cast<uint32_t>(key.size());
+            slot.term = entry.term;
+            slot.flags = static_cast<uint8_t>(occupied | (entry.prefix ? prefixOfLonger : 0));
+            keyBytes_ += key;
+            size_t index = slot.hash & mask_;
+            while (slots_[index].flags != 0) {
+                index = (index + 1) & mask_;
+            }
+            slots_[index] = slot;
+        }
+    }
+
+    /**
+     * @brief Number of topics counted.
+     */
+    size_t topicCount() const { return topicCount_; }
+
+    /**
+     * @brief Counts term occurrences per topic.
+     * @param positions When given, cleared and filled with every counted occurrence, as byte
+     *                  offsets into text; ordered by where the occurrence ends.
+     * @return Vector of counts indexed by topic id.
+     */
+    std::vector<uint32_t> countTopics(std::string_view text, std::vector<MatchPosition>* positions = nullptr) const
+    {
+        if (positions != nullptr) {
+            positions->clear();
+        }
+        const size_t termCount = termTopicOffsets_.empty() ? 0 : termTopicOffsets_.size() - 1;
+        std::vector<uint32_t> termCounts(termCount, 0);
+        std::vector<size_t> nextAllowed(termCount, 0);
+        // The last maxWords_ words, and the unfinished n-grams ending at the previous word.
+        std::vector<std::string_view> window(std::max<size_t>(maxWords_, 1));
+        std::vector<std::pair<uint64_t, size_t>> open, extended;
+
+        size_t wordIndex = 0;
+        auto probe = [&](uint64_t hash, size_t first) {
+            const Slot* slot = find(hash, window, first, wordIndex);
+            if (slot == nullptr) {
+                return;
+            }
+            if (slot->term >= 0 && first >= nextAllowed[slot->term]) {
+                ++termCounts[slot->term];
+                nextAllowed[slot->term] = wordIndex + 1;
+                if (positions != nullptr) {
+                    record(*positions, slot->term, text, window[first % window.size()], window[wordIndex % window.size()]);
+                }
+            }
+            if ((slot->flags & prefixOfLonger) != 0) {
+                extended.emplace_back(hash, first);
+            }
+        };
+
+        forEachWord(text, [&](std::string_view word) {
+            window[wordIndex % window.size()] = word;
+            extended.clear();
+            for (const auto& [hash, first] : open) {
+                probe(fnv1a64(word, fnv1a64(" ", hash)), first);
+            }
+            // Most words cannot start a key; reject them by first byte and length before hashing.
+            if ((firstWordLengths_[static_cast<unsigned char>(word[0])] & lengthBit(word.size())) != 0) {
+                probe(fnv1a64(word), wordIndex);
+            }
+            open.swap(extended);
+            ++wordIndex;
+        });
+
+        std::vector<uint32_t> topicCounts(topicCount_, 0);
+        for (size_t term = 0; term < termCount; ++term) {
+            if (termCounts[term] == 0) {
+                continue;
+            }
+            for (uint32_t i = termTopicOffsets_[term]; i < termTopicOffsets_[term + 1]; ++i) {
+                topicCounts[topicIds_[i]] += termCounts[term];
+            }
+        }
+        return topicCounts;
+    }
+
+private:
+    static constexpr uint8_t occupied = 1;
+    static constexpr uint8_t prefixOfLonger = 2;
+
+    /**
+     * @brief Bit for a word length; lengths of 63 and more share the top bit.
+     */
+    static uint64_t lengthBit(size_t length) { return uint64_t{1} << std::min<size_t>(length, 63); }
+
+    /**
+     * @brief Appends the position of an occurrence spanning the words first through last.
+     */
+    void record(std::vector<MatchPosition>& positions, int32_t term, std::string_view text, std::string_view first,
+                std::string_view last) const
+    {
+        MatchPosition match {0, static_cast<size_t>(first.data() - text.data()),
+                             static_cast<size_t>(last.data() + last.size() - text.data())};
+        int32_t previous = -1;
+        for (uint32_t i = termTopicOffsets_[term]; i < termTopicOffsets_[term + 1]; ++i) {
+            if (topicIds_[i] != previous) {
+                previous = topicIds_[i];
+                match.topic = static_cast<uint32_t>(previous);
+                positions.push_back(match);
+            }
+        }
+    }
+
+    struct Slot {
+        uint64_t hash = 0;
+        uint32_t keyBegin = 0;
+        uint32_t keyLength = 0;
+        int32_t term = -1; ///< Term id, or -1 for a key that is only a prefix of longer terms.
+        uint8_t flags = 0; ///< 0 marks an empty slot.
+    };
+
+    /**
+     * @brief Looks up the words [first, last] of the window, joined by single spaces.
+     */
+    const Slot* find(uint64_t hash, const std::vector<std::string_view>& window, size_t first, size_t last) const
+    {
+        if (slots_.empty()) {
+            return nullptr;
+        }
+        for (size_t index = hash & mask_; slots_[index].flags != 0; index = (index + 1) & mask_) {
+            const Slot& slot = slots_[index];
+            if (slot.hash == hash && keyEquals(slot, window, first, last)) {
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+
+    bool keyEquals(const Slot& slot, const std::vector<std::string_view>& window, size_t first, size_t last) const
+    {
+        std::string_view key(keyBytes_.data() + slot.keyBegin, slot.keyLength);
+        size_t offset = 0;
+        for (size_t w = first; w <= last; ++w) {
+            if (w > first) {
+                if (offset >= key.size() || key[offset] != ' ') {
+                    return false;
+                }
+                ++offset;
+            }
+            std::string_view word = window[w % window.size()];
+            if (offset + word.size() > key.size() || key.compare(offset, word.size(), word) != 0) {
+                return false;
+            }
+            offset += word.size();
+        }
+        return offset == key.size();
+    }
+
+    size_t topicCount_ = 0;
+    size_t maxWords_ = 0;
+    std::array<uint64_t, 256> firstWordLengths_{}; ///< Lengths of the first word of keys, by first byte.
+    std::vector<Slot> slots_;
+    size_t mask_ = 0;
+    std::string keyBytes_;
+    std::vector<uint32_t> termTopicOffsets_;
+    std::vector<int32_t> topicIds_;
+};
+
+#endif // WORD_MATCHER_H
@@ -8,126 +8,264 @@
 #include <vector>
 #include <stdexcept>
 #include <map>
+#include <memory>
 #include <filesystem>
 #include <algorithm>
-std::map<std::string, std::vector<std::string>> catalog {};
+#include <numeric>
+#include <sstream>
+#include <unordered_map>
+#include <chrono>
+#include "ahoCorasick.h"
+#include "catalog.h"
+#include "catalogCache.h"
+#include "classificationServer.h"
+#include "directoryWalker.h"
+#include "documentOrder.h"
+#include "documentReader.h"
+#include "instrumentation.h"
+#include "pipeline.h"
+#include "resultFile.h"
+#include "resultIndex.h"
+#include "scoring.h"
+#include "threadPool.h"
+#include "topicSelection.h"
+#include "wordMatcher.h"
+Catalog catalog {};
+AhoCorasick matcher {};
+const std::string catalogPath = "../catalog.txt";
+size_t streamChunkSize = 0; ///< Scan documents in chunks of this many bytes; 0 maps them whole.
+TopicSelection selection {}; ///< Topics reported per document with --top-k and --min-count.
+EarlyStop earlyStop {}; ///< When the scan of a document ends early with --decisive-bytes.
+
+/**
+ * @brief How documents are matched against the catalog.
+ */
+enum class Engine {
+    Substring, ///< Every occurrence of a term anywhere in the text (Aho-Corasick).
+    Words      ///< Whole words and multi-word terms only (hashed dictionary).
+};
+Engine engine = Engine::Substring;
+WordMatcher wordMatcher {};
+std::unique_ptr<ResultIndex> resultIndex {}; ///< Results of earlier runs with --incremental; null otherwise.
+std::unique_ptr<TermCountLog> termLog {}; ///< Term counts of every document with --scores; null otherwise.
 
 struct SearchResult {
     std::string topicName;
     int count{};
 };
 
+/**
+ * @brief Classification result of one document: match counts indexed by topic id.
+ * @details Topic names are not copied per document; they are looked up in the matcher only
+ *          when results are written or printed.
+ */
+struct DocumentResult {
+    std::string fileName;
+    std::vector<uint32_t> counts;
+};
 
-std::vector<std::string> tokenize(const std::string& s, const std::string_view &del = " ")
-{
-    std::vector<std::string> tokens;
-    size_t start = 0;
-    size_t end = s.find(del);
 
-    while (end != std::string::npos) {
-        tokens.push_back(s.substr(start, end - start));
-        start = end + del.size();
-        end = s.find(del, start);
+void readCatalog(bool termWeights) {
+    // Map the catalog file and parse it in place; every line is echoed while it is parsed
+    std::cout << "File Content: " << std::endl;
+    catalog = Catalog::load(catalogPath, [](std::string_view line) {
+        std::cout << line << std::endl; // Print the current line
+    }, termWeights);
+}
+
+/**
+ * @brief Counts the topics of a document that is already in memory.
+ * @param positions When given, cleared and filled with where every counted occurrence is; the
+ *                  caller passes the same buffer for every document so its capacity is reused.
+ * @details With --decisive-bytes only as much of the text is scanned as it takes for the leading
+ *          topic to become decisive. With --scores the term counts are recorded under fileName.
+ */
+std::vector<uint32_t> countDocument(const std::string& fileName, std::string_view text, std::vector<MatchPosition>* positions) {
+    instrumentation::ScopedTimer timer(instrumentation::Matching);
+    if (engine == Engine::Words) {
+        return wordMatcher.countTopics(text, positions);
+    }
+    if (earlyStop.active() || termLog != nullptr) {
+        if (positions != nullptr) {
+            positions->clear();
+        }
+        EarlyStopCounter counter(matcher, earlyStop);
+        counter.feed(text, positions);
+        if (termLog != nullptr) {
+            termLog->record(fileName, counter.patternCounts());
+        }
+        return counter.topicCounts();
     }
-    tokens.push_back(s.substr(start)); // Add the last token after the last delimiter
-    return tokens;
+    if (positions != nullptr) {
+        return matcher.countTopics(text, MatchMode::NonOverlapping, *positions);
+    }
+    return matcher.countTopics(text);
 }
 
-void readCatalog() {
-    // Open the input file named "input.txt"
-    std::ifstream inputFile("../catalog.txt");
-    // Check if the file is successfully opened
-    if (!inputFile.is_open()) {
-        std::cerr << "Error opening the file!" << std::endl;
-        throw std::invalid_argument("Catalog file does not exist");
+/**
+ * @brief Reads a document and counts its topics.
+ * @param positions As for countDocument.
+ * @param hash When given, every byte read is folded into it with fnv1a64, for the result index.
+ */
+std::vector<uint32_t> countFile(const std::string& fileName, std::vector<MatchPosition>* positions,
+                                uint64_t* hash = nullptr) {
+    std::vector<uint32_t> counts {};
+    if (streamChunkSize > 0) {
+        // Bounded memory: the matcher state carries over between chunks
+        if (positions != nullptr) {
+            positions->clear();
+        }
+        EarlyStopCounter counter(matcher, earlyStop);
+        forEachChunk(fileName.c_str(), streamChunkSize, [&](std::string_view chunk) {
+            if (hash != nullptr) {
+                *hash = fnv1a64(chunk, *hash);
+            }
+            instrumentation::ScopedTimer timer(instrumentation::Matching);
+            return counter.feed(chunk, positions);
+        });
+        if (termLog != nullptr) {
+            termLog->record(fileName, counter.patternCounts());
+        }
+        counts = counter.topicCounts();
+    } else {
+        // Map the file and let the matcher read it in place; line breaks are skipped by the matcher
+        MappedDocument document(fileName);
+        counts = countDocument(fileName, document.text(), positions);
+        if (hash != nullptr) {
+            *hash = fnv1a64(document.text(), *hash);
+        }
     }
+    instrumentation::addDocument(counts);
+    return counts;
+}
 
-    std::string line; // Declare a string variable to store each
-    // line of the file
+/**
+ * @brief Counts the topics of one document, or takes them from the result index if it is unchanged.
+ * @param positions As for countDocument.
+ */
+DocumentResult findAllOccurrences(const std::string& fileName, std::vector<MatchPosition>* positions = nullptr) {
+    if (resultIndex != nullptr) {
+        return DocumentResult {fileName, resultIndex->classify(fileName, [&](uint64_t& hash) {
+            return countFile(fileName, positions, &hash);
+        })};
+    }
+    return DocumentResult {fileName, countFile(fileName, positions)};
+}
 
-    // Read each line of the file and print it to the
-    // standard output stream
-    std::cout << "File Content: " << std::endl;
-    while (getline(inputFile, line)) {
-        std::vector<std::string> vector =  tokenize(line, "@%");
-        catalog.emplace(vector[0], tokenize(vector[1], ","));
-        std::cout << line << std::endl; // Print the current line
+/**
+ * @brief Formats match positions as "document,topic,begin,end" lines, end exclusive.
+ */
+std::string formatPositions(const std::string& fileName, const std::vector<MatchPosition>& positions) {
+    std::string lines;
+    for (const MatchPosition& position : positions) {
+        lines += fileName;
+        lines += ',';
+        lines += matcher.topicName(position.topic);
+        lines += ',' + std::to_string(position.begin) + ',' + std::to_string(position.end) + '\n';
     }
+    return lines;
+}
 
-    // Close the file
-    inputFile.close();
+
+/**
+ * @brief Lists the files with one of the extensions in a directory and all its subdirectories.
+ * @param walkThreads Threads walking the tree; with more than one the order of the files varies.
+ */
+std::vector<std::string> getAllFilesInDirectory(const std::string& directoryPath, const std::vector<std::string>& extensions,
+                                                size_t walkThreads = 1) {
+    instrumentation::ScopedTimer timer(instrumentation::Enumerate);
+    std::vector<std::string> files;
+    forEachFileInTree(directoryPath, extensions, walkThreads, [&files](std::string path) { files.push_back(std::move(path)); });
+    return files;
 }
 
- std::pair<std::string, std::vector<SearchResult>> findAllOccurrences(const std::string& fileName) {
-    std::ifstream inputFile(fileName);
-    // Check if the file is successfully opened
-    if (!inputFile.is_open()) {
-        std::cerr << "Error opening the file!" << std::endl;
-        throw std::invalid_argument("Catalog file does not exist");
+/**
+ * @brief Calls onTopic(topicId, count) for every reported topic of a document: all topics in id
+ *        order, or with --top-k and --min-count only the selected ones, leading topic first.
+ */
+template <typename Callback>
+void forEachReportedTopic(const std::vector<uint32_t>& counts, Callback&& onTopic) {
+    for (const auto& [topicId, count] : selectTopics(counts.data(), counts.size(), selection)) {
+        onTopic(topicId, count);
     }
+}
 
-    std::string line; // Declare a string variable to store each
-    std::string text; // Declare a string variable to store each
-    // line of the file
+void writeResult(std::ostream& outputFile, const DocumentResult& result) {
+    outputFile << result.fileName << '\n';
+    forEachReportedTopic(result.counts, [&](size_t topicId, uint32_t count) {
+        outputFile << matcher.topicName(topicId) << "," << count << "\n";
+    });
+    outputFile << "\n"; // Separate sets of search results
+}
 
-    // Read each line of the file and print it to the
-    // standard output stream
-    std::cout << "File Content: " << std::endl;
-    while (getline(inputFile, line)) {
-        text += line;
-    }
-    std::vector<SearchResult> matches {};
-    for (auto const& [topic, identifiers] : catalog) {
-        std::vector<int> occurrences;
-        int count = 0;
-        for (const std::string& term : identifiers) {
-            size_t pos = text.find(term, 0);
-            while (pos != std::string::npos) {
-                occurrences.push_back(pos);
-                pos = text.find(term, pos + term.length());
-                count++;
-            }
-        }
-        matches.emplace_back(SearchResult {topic, static_cast<int>(occurrences.size())});
+/**
+ * @brief Names of all topics of the matcher, by topic id.
+ */
+std::vector<std::string> topicNames() {
+    std::vector<std::string> names;
+    for (size_t topicId = 0; topicId < matcher.topicCount(); ++topicId) {
+        names.emplace_back(matcher.topicName(topicId));
     }
+    return names;
+}
 
-    return std::pair {fileName, matches} ;
+/**
+ * @brief Writes the results in the binary columnar format of resultFile.h.
+ */
+void writeBinaryResults(const std::vector<DocumentResult>& matches, const std::string& filename, CountEncoding encoding) {
+    instrumentation::ScopedTimer timer(instrumentation::ResultWrite);
+    ResultFileWriter writer(filename, topicNames(), encoding);
+    for (const auto& result : matches) {
+        std::vector<uint32_t> counts = result.counts;
+        keepSelected(counts, selection);
+        writer.add(result.fileName, counts.data());
+    }
 }
 
+/**
+ * @brief Scores every classified document with TF-IDF and writes the scores in the layout of
+ *        results.csv; --top-k applies to the scores, --min-count only to counts.
+ */
+void writeScores(const std::vector<DocumentResult>& matches, const std::string& filename) {
+    instrumentation::ScopedTimer timer(instrumentation::Scoring);
+    TfIdfScorer scorer(matcher);
+    std::unordered_map<std::string_view, const TermCounts*> termsOf;
+    for (const auto& [document, terms] : termLog->entries()) {
+        scorer.addDocument(terms);
+        termsOf.emplace(document, &terms);
+    }
+    scorer.computeIdf();
 
-std::vector<std::string> getAllFilesInDirectory(const std::string& directoryPath, const std::vector<std::string>& extensions) {
-    std::vector<std::string> files;
-    for (const auto& entry : std::filesystem::directory_iterator(directoryPath)) {
-        if (std::filesystem::is_regular_file(entry.path())) {
-            std::string extension = entry.path().extension().string();
-            if (std::find(extensions.begin(), extensions.end(), extension) != extensions.end()) {
-                files.push_back(entry.path().string());
-            }
+    std::ofstream outputFile(filename);
+    if (!outputFile.is_open()) {
+        std::cerr << "Error opening scores file for writing!" << std::endl;
+        return;
+    }
+    TopicSelection topK {selection.topK, 0};
+    for (const auto& result : matches) {
+        auto terms = termsOf.find(result.fileName);
+        if (terms == termsOf.end()) {
+            continue;
+        }
+        std::vector<float> scores = scorer.score(*terms->second);
+        outputFile << result.fileName << '\n';
+        for (const auto& [topicId, score] : selectTopics(scores.data(), scores.size(), topK)) {
+            outputFile << matcher.topicName(topicId) << "," << score << "\n";
         }
+        outputFile << "\n";
     }
-    return files;
-}
-
-SearchResult fillSearchResult(const std::string& name, int count) { // Update to only accept count
-    SearchResult sr;
-    sr.topicName = name;
-    sr.count = count;
-    return sr;
 }
 
-void writeResultsToFile(const std::vector<std::pair<std::string, std::vector<SearchResult>>> matches, const std::string& filename) {
+void writeResultsToFile(const std::vector<DocumentResult>& matches, const std::string& filename) {
+    instrumentation::ScopedTimer timer(instrumentation::ResultWrite);
     std::ofstream outputFile(filename);
     if (!outputFile.is_open()) {
         std::cerr << "Error opening file for writing!" << std::endl;
         return;
     }
 
-    for (const auto&[docName, topics] : matches) {
-        outputFile << docName << '\n';
-        for (const auto&[topicName, count] : topics) {
-            outputFile << topicName << "," << count << "\n";
-        }
-        outputFile << "\n"; // Separate sets of search results
+    for (const auto& result : matches) {
+        writeResult(outputFile, result);
     }
 
     outputFile.close();
@@ -143,38 +281,39 @@ std::vector<std::vector<SearchResult>> readResultsFromFile(const std::string& fi
     }
 
     std::string line;
+    std::vector<SearchResult> searchResults;
     while (std::getline(inputFile, line)) {
-        std::vector<SearchResult> searchResults;
         if (line.empty()) {
             // Empty line indicates the end of one set of search results
             matches.push_back(std::move(searchResults));
+            searchResults.clear();
             continue;
         }
 
+        // The document name line has no count and is skipped
         std::istringstream iss(line);
         std::string topicName;
         int count;
         if (std::getline(iss, topicName, ',') && (iss >> count)) {
             searchResults.push_back({topicName, count});
         }
-        matches.push_back(std::move(searchResults));
     }
 
     inputFile.close();
     return matches;
 }
 
-std::unordered_map<std::string, std::string> determineRelevantTopics(const std::vector<std::pair<std::string, std::vector<SearchResult>>>& matches) {
-    std::unordered_map<std::string, std::string> relevantTopics;
+std::unordered_map<std::string_view, std::string_view> determineRelevantTopics(const std::vector<DocumentResult>& matches) {
+    std::unordered_map<std::string_view, std::string_view> relevantTopics;
 
-    for (const auto& [docName, topics] : matches) {
-        int maxCount = 0;
-        std::string relevantTopic;
+    for (const auto& [docName, counts] : matches) {
+        uint32_t maxCount = 0;
+        std::string_view relevantTopic;
 
-        for (const auto& [topicName, count] : topics) {
-            if (count > maxCount) {
-                maxCount = count;
-                relevantTopic = topicName;
+        for (size_t topicId = 0; topicId < counts.size(); ++topicId) {
+            if (counts[topicId] > maxCount) {
+                maxCount = counts[topicId];
+                relevantTopic = matcher.topicName(topicId);
             }
         }
 
@@ -184,38 +323,459 @@ std::unordered_map<std::string, std::string> determineRelevantTopics(const std::
     return relevantTopics;
 }
 
-int main() {
-    readCatalog();
+/**
+ * @brief Command line options of the single-process classifier.
+ */
+struct Options {
+    size_t threads = 1; ///< Worker threads used for classification; 0 means one per hardware thread.
+    std::string catalogCache; ///< Compiled catalog cache file; empty disables the cache.
+    size_t streamChunk = 0; ///< Stream documents in chunks of this many bytes; 0 maps them whole.
+    prefilter::Kernel prefilter = prefilter::Kernel::Auto; ///< SIMD kernel that skips text without candidates.
+    CaseFold caseFold = CaseFold::None; ///< Letters matched regardless of case.
+    Engine engine = Engine::Substring;
+    std::string positions; ///< File that receives the position of every match; empty disables it.
+    size_t walkThreads = 1; ///< Threads walking the document tree; more than one makes the order vary.
+    DocumentOrder order = DocumentOrder::Listing; ///< Order documents are read in; results stay in listing order.
+    bool pipeline = false; ///< Enumerate, read, match and write on separate pipeline stages.
+    PipelineOptions stages; ///< Queue depth and stage parallelism of the pipeline.
+    std::string incremental; ///< Result index reused and updated between runs; empty disables it.
+    std::string stats; ///< File that receives the JSON timing summary; empty disables it.
+    std::string binaryResults; ///< File that also receives the results in binary columnar form; empty disables it.
+    CountEncoding resultEncoding = CountEncoding::Auto; ///< How counts are stored in the binary results.
+    TopicSelection selection; ///< Topics reported per document.
+    EarlyStop earlyStop; ///< When the scan of a document may end early.
+    std::string serve; ///< Unix socket to serve classification requests on; empty runs one batch.
+    size_t maxBatch = 256; ///< Most requests the server classifies in one batch.
+    size_t maxRequest = 64 << 20; ///< Largest TEXT request the server accepts, in bytes.
+    std::string scores; ///< File that receives the TF-IDF scores of every document; empty disables scoring.
+};
+
+/**
+ * @brief Parses the command line.
+ * @details Supported options:
+ *          --threads N             classify documents on a work-stealing pool of N threads
+ *          --catalog-cache PATH    load the compiled catalog from PATH, rebuilding it when stale
+ *          --stream-chunk B        scan documents in chunks of B bytes to bound memory per document
+ *          --prefilter KERNEL      auto, avx2, sse4.2, neon, scalar or off (default auto)
+ *          --case-fold F           none (default), ascii or unicode: match terms regardless of case
+ *                                  (substring engine, see caseFold.h)
+ *          --engine substring|words   match terms anywhere (default) or as whole words only
+ *          --positions PATH        also write where every counted match is to PATH
+ *          --walk-threads N        walk the document tree with N threads (default 1)
+ *          --order O               read documents in listing (default), locality (inode) or
+ *                                  largest-first order; results stay in listing order
+ *          --pipeline              overlap reading and matching on separate pipeline stages
+ *          --queue-depth N         documents queued between two pipeline stages (default 64)
+ *          --read-threads N        pipeline threads opening and prefetching documents (default 2)
+ *          --match-threads N       pipeline threads matching documents; 0 (default) uses one per hardware thread
+ *          --incremental PATH      only classify documents that changed since the run that wrote PATH
+ *          --binary-results PATH   also write the results to PATH in the binary columnar format
+ *          --result-encoding E     dense, sparse, packed (varint-compressed) or auto (default)
+ *          --top-k K               report only the K topics with the most matches per document
+ *          --min-count N           report only topics with at least N matches
+ *          --decisive-bytes B      stop scanning a document at the first multiple of B bytes at which
+ *                                  the leading topic is decisive (opt-in heuristic, substring engine)
+ *          --decisive-margin M     matches the leader must be ahead of the runner-up by (default 3)
+ *          --scores PATH           also score every document by TF-IDF with the catalog's term weights
+ *                                  and write the scores to PATH (substring engine)
+ *          --serve SOCKET          keep the catalog loaded and answer requests on a Unix socket,
+ *                                  classifying on --threads threads (see classificationServer.h)
+ *          --max-batch N           most requests the server classifies in one batch (default 256)
+ *          --max-request B         largest TEXT request the server accepts, in bytes (default 64 MiB)
+ *          --stats PATH            write per-thread counters and stage timings to PATH as JSON
+ *                                  (build with -DDCAT_INSTRUMENTATION=1, otherwise only wall time)
+ */
+Options parseArguments(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            options.threads = std::stoul(argv[++i]);
+        } else if (arg == "--catalog-cache" && i + 1 < argc) {
+            options.catalogCache = argv[++i];
+        } else if (arg == "--stream-chunk" && i + 1 < argc) {
+            options.streamChunk = std::stoul(argv[++i]);
+        } else if (arg == "--prefilter" && i + 1 < argc) {
+            options.prefilter = prefilter::parseKernel(argv[++i]);
+        } else if (arg == "--case-fold" && i + 1 < argc) {
+            options.caseFold = parseCaseFold(argv[++i]);
+        } else if (arg == "--engine" && i + 1 < argc) {
+            std::string_view value = argv[++i];
+            if (value == "substring") {
+                options.engine = Engine::Substring;
+            } else if (value == "words") {
+                options.engine = Engine::Words;
+            } else {
+                throw std::invalid_argument("Unknown engine: " + std::string(value));
+            }
+        } else if (arg == "--positions" && i + 1 < argc) {
+            options.positions = argv[++i];
+        } else if (arg == "--walk-threads" && i + 1 < argc) {
+            options.walkThreads = std::stoul(argv[++i]);
+        } else if (arg == "--order" && i + 1 < argc) {
+            options.order = parseDocumentOrder(argv[++i]);
+        } else if (arg == "--incremental" && i + 1 < argc) {
+            options.incremental = argv[++i];
+        } else if (arg == "--binary-results" && i + 1 < argc) {
+            options.binaryResults = argv[++i];
+        } else if (arg == "--result-encoding" && i + 1 < argc) {
+            options.resultEncoding = parseCountEncoding(argv[++i]);
+        } else if (arg == "--top-k" && i + 1 < argc) {
+            options.selection.topK = std::stoul(argv[++i]);
+        } else if (arg == "--min-count" && i + 1 < argc) {
+            options.selection.minCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--decisive-bytes" && i + 1 < argc) {
+            options.earlyStop.decisiveBytes = std::stoul(argv[++i]);
+        } else if (arg == "--decisive-margin" && i + 1 < argc) {
+            options.earlyStop.margin = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--scores" && i + 1 < argc) {
+            options.scores = argv[++i];
+        } else if (arg == "--serve" && i + 1 < argc) {
+            options.serve = argv[++i];
+        } else if (arg == "--max-batch" && i + 1 < argc) {
+            options.maxBatch = std::stoul(argv[++i]);
+        } else if (arg == "--max-request" && i + 1 < argc) {
+            options.maxRequest = std::stoul(argv[++i]);
+        } else if (arg == "--stats" && i + 1 < argc) {
+            options.stats = argv[++i];
+        } else if (arg == "--pipeline") {
+            options.pipeline = true;
+        } else if (arg == "--queue-depth" && i + 1 < argc) {
+            options.stages.queueDepth = std::stoul(argv[++i]);
+        } else if (arg == "--read-threads" && i + 1 < argc) {
+            options.stages.readers = std::stoul(argv[++i]);
+        } else if (arg == "--match-threads" && i + 1 < argc) {
+            options.stages.matchers = std::stoul(argv[++i]);
+        } else {
+            throw std::invalid_argument("Unknown argument: " + std::string(arg));
+        }
+    }
+    if (options.engine == Engine::Words && options.streamChunk > 0) {
+        throw std::invalid_argument("--stream-chunk is only supported by the substring engine");
+    }
+    if (options.engine == Engine::Words && options.caseFold != CaseFold::None) {
+        throw std::invalid_argument("--case-fold is only supported by the substring engine");
+    }
+    if (options.pipeline && options.streamChunk > 0) {
+        throw std::invalid_argument("--pipeline reads documents whole and cannot be combined with --stream-chunk");
+    }
+    if (options.pipeline && options.order != DocumentOrder::Listing) {
+        throw std::invalid_argument("--pipeline reads documents as the walk finds them and cannot be combined with --order");
+    }
+    if (!options.incremental.empty() && (options.pipeline || !options.positions.empty())) {
+        throw std::invalid_argument("--incremental cannot be combined with --pipeline or --positions");
+    }
+    if (options.earlyStop.active() && (options.engine == Engine::Words || !options.incremental.empty())) {
+        // Partial counts must not be stored in the result index as if they covered the document
+        throw std::invalid_argument("--decisive-bytes needs the substring engine and cannot be combined with --incremental");
+    }
+    if (!options.scores.empty() &&
+        (options.engine == Engine::Words || !options.incremental.empty() || options.earlyStop.active())) {
+        // Documents reused from the index were not scanned and early stops truncate the scan, so
+        // their term counts would not cover the document
+        throw std::invalid_argument(
+            "--scores needs the substring engine and cannot be combined with --incremental or --decisive-bytes");
+    }
+    if (!options.serve.empty() && (options.pipeline || options.streamChunk > 0 || !options.incremental.empty() ||
+                                   !options.positions.empty() || !options.binaryResults.empty() || !options.scores.empty())) {
+        throw std::invalid_argument("--serve answers requests one document at a time and cannot be combined with "
+                                    "--pipeline, --stream-chunk, --incremental, --positions, --binary-results or --scores");
+    }
+    if (!options.serve.empty() && !CLASSIFICATION_SERVER_AVAILABLE) {
+        throw std::invalid_argument("--serve needs Unix domain sockets");
+    }
+    if (options.earlyStop.active() && options.earlyStop.margin == 0) {
+        throw std::invalid_argument("--decisive-margin must be at least 1");
+    }
+    return options;
+}
+
+/**
+ * @brief Classifies all files, serially or on a thread pool.
+ * @param order Indices into files in the order they are read (see documentOrder.h).
+ * @param positionLines When given, receives the formatted match positions of each file, by file
+ *                      index. Every worker collects positions in one reusable buffer.
+ * @details Every worker appends to its own result list; the lists are merged by file index
+ *          afterwards, so the output order always matches the order of files, whatever the
+ *          processing order.
+ */
+std::vector<DocumentResult> classifyFiles(const std::vector<std::string>& files, const std::vector<size_t>& order,
+                                          size_t threads, std::vector<std::string>* positionLines = nullptr) {
+    std::vector<DocumentResult> matches(files.size());
+    if (positionLines != nullptr) {
+        positionLines->assign(files.size(), std::string());
+    }
+    if (threads == 1) {
+        std::vector<MatchPosition> positions {};
+        for (size_t index : order) {
+            if (positionLines == nullptr) {
+                matches[index] = findAllOccurrences(files[index]);
+                continue;
+            }
+            matches[index] = findAllOccurrences(files[index], &positions);
+            (*positionLines)[index] = formatPositions(files[index], positions);
+        }
+        return matches;
+    }
+
+    WorkStealingPool pool(threads);
+    std::vector<std::vector<std::pair<size_t, DocumentResult>>> perThread(pool.size());
+    std::vector<std::vector<MatchPosition>> positionBuffers(positionLines != nullptr ? pool.size() : 0);
+    // Workers run their own deque from the back, so submitting in reverse runs each share in order
+    // and leaves the end of the order, the smallest documents with largest-first, to the thieves.
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        size_t index = *it;
+        pool.submit([&files, &perThread, &positionBuffers, positionLines, index](size_t worker) {
+            if (positionLines == nullptr) {
+                perThread[worker].emplace_back(index, findAllOccurrences(files[index]));
+                return;
+            }
+            perThread[worker].emplace_back(index, findAllOccurrences(files[index], &positionBuffers[worker]));
+            (*positionLines)[index] = formatPositions(files[index], positionBuffers[worker]);
+        });
+    }
+    pool.wait();
+
+    for (auto& results : perThread) {
+        for (auto& [index, result] : results) {
+            matches[index] = std::move(result);
+        }
+    }
+    return matches;
+}
+
+/**
+ * @brief Enumerates, reads, classifies and writes the documents of a directory as a pipeline.
+ * @param positionsPath When not empty, match positions are written there as well.
+ * @param binaryPath When not empty, results are also streamed there in the binary columnar format.
+ * @details The directory tree is walked on its own threads while read threads open and prefetch
+ *          the documents found so far, so matching never waits for a file to be opened or read.
+ *          results.csv (and the positions and binary files) are written as documents complete, in
+ *          directory order, the same order the other modes use.
+ */
+std::vector<DocumentResult> classifyPipelined(const std::string& directoryPath, const std::vector<std::string>& extensions,
+                                              size_t walkThreads, const PipelineOptions& stages,
+                                              const std::string& positionsPath, const std::string& binaryPath,
+                                              CountEncoding encoding) {
+    struct Classified {
+        std::vector<uint32_t> counts;
+        std::string positionLines;
+    };
+    std::ofstream outputFile("results.csv");
+    if (!outputFile.is_open()) {
+        std::cerr << "Error opening file for writing!" << std::endl;
+    }
+    std::ofstream positionsFile;
+    if (!positionsPath.empty()) {
+        positionsFile.open(positionsPath);
+        if (!positionsFile.is_open()) {
+            std::cerr << "Error opening positions file for writing!" << std::endl;
+        }
+    }
+    std::unique_ptr<ResultFileWriter> binaryFile {};
+    if (!binaryPath.empty()) {
+        binaryFile = std::make_unique<ResultFileWriter>(binaryPath, topicNames(), encoding);
+    }
+    size_t matchers = stages.matchers == 0 ? std::max(1u, std::thread::hardware_concurrency()) : stages.matchers;
+    std::vector<std::vector<MatchPosition>> positionBuffers(positionsPath.empty() ? 0 : matchers);
+
+    std::vector<DocumentResult> matches {};
+    runPipeline<Classified>(
+        stages,
+        [&](auto&& emit) {
+            instrumentation::ScopedTimer timer(instrumentation::Enumerate);
+            forEachFileInTree(directoryPath, extensions, walkThreads, emit);
+        },
+        [&](const std::string& fileName, const MappedDocument& document, size_t worker) {
+            Classified classified {};
+            if (positionBuffers.empty()) {
+                classified.counts = countDocument(fileName, document.text(), nullptr);
+            } else {
+                classified.counts = countDocument(fileName, document.text(), &positionBuffers[worker]);
+                classified.positionLines = formatPositions(fileName, positionBuffers[worker]);
+            }
+            instrumentation::addDocument(classified.counts);
+            return classified;
+        },
+        [&](size_t, const std::string& fileName, Classified&& classified) {
+            instrumentation::ScopedTimer timer(instrumentation::ResultWrite);
+            positionsFile << classified.positionLines;
+            matches.push_back(DocumentResult {fileName, std::move(classified.counts)});
+            writeResult(outputFile, matches.back());
+            if (binaryFile != nullptr) {
+                std::vector<uint32_t> counts = matches.back().counts;
+                keepSelected(counts, selection);
+                binaryFile->add(fileName, counts.data());
+            }
+        });
+    return matches;
+}
+
+/**
+ * @brief Writes the JSON timing summary of this process, after its worker threads have been joined.
+ */
+void writeStats(const std::string& path, std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> wallTime = std::chrono::steady_clock::now() - start;
+    std::ofstream statsFile(path);
+    if (!statsFile.is_open()) {
+        std::cerr << "Error opening stats file for writing!" << std::endl;
+    }
+    statsFile << instrumentation::summaryJson(instrumentation::threadSamples(), wallTime.count());
+}
+
+#if CLASSIFICATION_SERVER_AVAILABLE
+/**
+ * @brief Loads and compiles the catalog for the server, as configured by the options.
+ * @details Called again on every RELOAD request; with --catalog-cache a changed catalog is
+ *          recompiled and the cache refreshed.
+ */
+std::shared_ptr<const ServedCatalog> loadServedCatalog(const Options& options) {
+    instrumentation::ScopedTimer timer(instrumentation::CatalogLoad);
+    auto served = std::make_shared<ServedCatalog>();
+    const CaseFold fold = options.caseFold;
+    if (options.catalogCache.empty()) {
+        served->matcher = AhoCorasick(Catalog::load(catalogPath), true, fold);
+    } else {
+        served->matcher = loadCompiledCatalog(
+            catalogPath, options.catalogCache, [fold] { return AhoCorasick(Catalog::load(catalogPath), true, fold); }, fold);
+    }
+    served->matcher.setPrefilter(options.prefilter);
+    served->words = options.engine == Engine::Words;
+    if (served->words) {
+        served->wordMatcher = WordMatcher(served->matcher);
+    }
+    served->earlyStop = options.earlyStop;
+    return served;
+}
+
+/**
+ * @brief Serves classification requests until a SHUTDOWN request arrives.
+ */
+void serveRequests(const Options& options) {
+    ClassificationServer server(options.serve, [&options] { return loadServedCatalog(options); }, options.threads,
+                                options.selection, options.maxBatch, options.maxRequest);
+    std::cout << "Serving classification requests on " << options.serve << std::endl;
+    server.run();
+}
+#endif
+
+int main(int argc, char** argv) {
+    auto start = std::chrono::steady_clock::now();
+    Options options;
+    try {
+        options = parseArguments(argc, argv);
+    } catch (const std::logic_error& error) {
+        // Unknown or conflicting options, or a malformed number
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    streamChunkSize = options.streamChunk;
+    selection = options.selection;
+    earlyStop = options.earlyStop;
+#if CLASSIFICATION_SERVER_AVAILABLE
+    if (!options.serve.empty()) {
+        serveRequests(options);
+        if (!options.stats.empty()) {
+            writeStats(options.stats, start);
+        }
+        return 0;
+    }
+#endif
+    {
+        instrumentation::ScopedTimer timer(instrumentation::CatalogLoad);
+        const CaseFold fold = options.caseFold;
+        // "^weight" suffixes only mean something to scoring; otherwise terms are read verbatim.
+        const bool weighted = !options.scores.empty();
+        if (options.catalogCache.empty()) {
+            readCatalog(weighted);
+            matcher = AhoCorasick(catalog, true, fold);
+        } else {
+            matcher = loadCompiledCatalog(catalogPath, options.catalogCache, [fold, weighted] {
+                readCatalog(weighted);
+                return AhoCorasick(catalog, true, fold);
+            }, fold, weighted);
+        }
+    }
+    matcher.setPrefilter(options.prefilter);
+    engine = options.engine;
+    if (engine == Engine::Words) {
+        wordMatcher = WordMatcher(matcher);
+    }
+    if (!options.incremental.empty()) {
+        uint64_t version = ResultIndex::catalogVersion(matcher, engine == Engine::Words ? "words" : "substring");
+        resultIndex = std::make_unique<ResultIndex>(options.incremental, version, matcher.topicCount());
+    }
     // std::string directoryPath = "../sample_documents/";
     std::string directoryPath = "../testDocuments/";
     // Specify the file extensions to filter
     std::vector<std::string> extensions = {".html", ".txt", ".tex"};
 
-    std::vector<std::string> files = getAllFilesInDirectory(directoryPath, extensions);
+    if (!options.scores.empty()) {
+        termLog = std::make_unique<TermCountLog>();
+    }
+    std::vector<DocumentResult> matches {};
+    if (options.pipeline) {
+        std::cout << "Files in directory with extensions (.html, .txt, .tex):" << std::endl;
+        matches = classifyPipelined(directoryPath, extensions, options.walkThreads, options.stages, options.positions,
+                                    options.binaryResults, options.resultEncoding);
+    } else {
+        std::vector<std::string> files = getAllFilesInDirectory(directoryPath, extensions, options.walkThreads);
+
+        std::cout << "Files in directory with extensions (.html, .txt, .tex):" << std::endl;
+
+
+        std::vector<size_t> order(files.size());
+        if (options.order == DocumentOrder::Listing) {
+            std::iota(order.begin(), order.end(), size_t{0});
+        } else {
+            instrumentation::ScopedTimer timer(instrumentation::Enumerate);
+            order = processingOrder(locateFiles(files), options.order);
+        }
 
-    std::cout << "Files in directory with extensions (.html, .txt, .tex):" << std::endl;
+        std::vector<std::string> positionLines {};
+        matches = classifyFiles(files, order, options.threads, options.positions.empty() ? nullptr : &positionLines);
+        writeResultsToFile(matches, "results.csv");
+        if (!options.binaryResults.empty()) {
+            writeBinaryResults(matches, options.binaryResults, options.resultEncoding);
+        }
+        if (resultIndex != nullptr) {
+            instrumentation::ScopedTimer timer(instrumentation::ResultWrite);
+            resultIndex->store();
+        }
+        if (!options.positions.empty()) {
+            instrumentation::ScopedTimer timer(instrumentation::ResultWrite);
+            std::ofstream positionsFile(options.positions);
+            if (!positionsFile.is_open()) {
+                std::cerr << "Error opening positions file for writing!" << std::endl;
+            }
+            for (const auto& lines : positionLines) {
+                positionsFile << lines;
+            }
+        }
+    }
 
+    if (termLog != nullptr) {
+        writeScores(matches, options.scores);
+    }
 
-    std::vector<std::pair<std::string, std::vector<SearchResult>>> matches {};
-    matches.reserve(files.size());
-    for (const auto& file : files) {
-        matches.emplace_back(findAllOccurrences(file));
+    if (!options.stats.empty()) {
+        // Worker threads are joined by now, so their samples are final
+        writeStats(options.stats, start);
     }
-    writeResultsToFile(matches, "results.csv");
 
     // Read the data from the file
     std::vector<std::vector<SearchResult>> resultsFromFile = readResultsFromFile("results.csv");
 
     // Print the read data
-    for (const auto&[docName, topics] : matches) {
+    for (const auto&[docName, counts] : matches) {
         std::cout  << docName << '\n';
-        for (const auto& [topicName, count] : topics) {
-            std::cout << "Topic: " << topicName << ", Count: " << count << std::endl;
-        }
+        forEachReportedTopic(counts, [&](size_t topicId, uint32_t count) {
+            std::cout << "Topic: " << matcher.topicName(topicId) << ", Count: " << count << std::endl;
+        });
         std::cout << std::endl;
     }
 
-    std::unordered_map<std::string, std::string> relevantTopics = determineRelevantTopics(matches);
+    std::unordered_map<std::string_view, std::string_view> relevantTopics = determineRelevantTopics(matches);
 
     // Print the relevant topics
     for (const auto& [docName, relevantTopic] : relevantTopics) {
@@ -9,173 +9,1595 @@
 #include <fstream>
 #include <stdexcept>
 #include <filesystem>
+#include <functional>
 #include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 #include <mpi.h>
+#include "ahoCorasick.h"
+#include "catalog.h"
+#include "catalogCache.h"
+#include "directoryWalker.h"
+#include "documentOrder.h"
+#include "documentReader.h"
+#include "instrumentation.h"
+#include "pipeline.h"
+#include "resultFile.h"
+#include "resultIndex.h"
+#include "scoring.h"
+#include "threadPool.h"
+#include "topicSelection.h"
+#include "wordMatcher.h"
 
 using namespace std;
 
-std::map<std::string, std::vector<std::string>> catalog{};
+Catalog catalog{};
 /**
- * @brief Tokenizes a string based on a delimiter.
- * @param s The input string to tokenize.
- * @param del The delimiter to use for tokenization.
- * @return Vector of tokens.
+ * @brief Automaton compiled from the catalog on rank 0; workers use the broadcast image in place.
  */
-std::vector<std::string> tokenize(const std::string& s, const std::string& del = " ")
+AhoCorasick matcher{};
+
+/**
+ * @brief Chunk size for streaming documents instead of mapping them whole; 0 maps every document.
+ */
+size_t streamChunkSize = 0;
+
+/**
+ * @brief Topics rank 0 reports per document with --top-k and --min-count; all topics by default.
+ */
+TopicSelection selection{};
+
+/**
+ * @brief When every rank ends the scan of a document early with --decisive-bytes; never by default.
+ */
+EarlyStop earlyStop{};
+
+/**
+ * @brief Term counts of the documents this rank classified when --scores is used; null otherwise.
+ */
+std::unique_ptr<TermCountLog> termLog;
+
+/**
+ * @brief How documents are matched against the catalog.
+ */
+enum class Engine
 {
-    std::vector<std::string> tokens;
-    size_t start = 0;
-    size_t end = s.find(del);
+    Substring, ///< Every occurrence of a term anywhere in the text (Aho-Corasick).
+    Words      ///< Whole words and multi-word terms only (hashed dictionary).
+};
+Engine engine = Engine::Substring;
+
+/**
+ * @brief Whole-word matcher, built on every rank from the broadcast catalog when --engine words is used.
+ */
+WordMatcher wordMatcher{};
+
+/**
+ * @brief Stages used to classify the documents a rank gets when --pipeline is used; null classifies them serially.
+ */
+std::unique_ptr<PipelineOptions> pipelineStages;
+
+/**
+ * @brief Threads classifying the documents a rank gets when --threads is used; null classifies them on the main thread.
+ * @details All threads of a rank share its single read-only matcher. Only the main thread makes MPI calls.
+ */
+std::unique_ptr<WorkStealingPool> rankPool;
+
+/**
+ * @brief Node-local shared memory holding the catalog image when --shared-catalog is used; MPI_WIN_NULL otherwise.
+ */
+MPI_Win catalogWindow = MPI_WIN_NULL;
+
+const std::string catalogPath = "./actualCatalog.txt";
 
-    while (end != std::string::npos)
-    {
-        tokens.push_back(s.substr(start, end - start));
-        start = end + del.size();
-        end = s.find(del, start);
-    }
-    tokens.push_back(s.substr(start));
-    return tokens;
-}
 /**
  * @brief Reads the catalog data from a file.
  * @details The catalog file format is expected to be:
  *          Topic1@%Identifier1,Identifier2,Identifier3
  *          Topic2@%Identifier4,Identifier5,Identifier6
+ *          The file is mapped and parsed in place into a single byte arena.
+ * @param termWeights Split "^weight" suffixes off the terms, for --scores.
+ */
+void readCatalog(bool termWeights)
+{
+    catalog = Catalog::load(catalogPath, termWeights);
+}
+/**
+ * @brief Extracts the file name from a given file path.
+ * @param filePath The full path of the file.
+ * @return The file name.
+ */
+std::string getFileNameFromPath(std::string_view filePath) {
+    // Use filesystem::path to get the filename
+    std::filesystem::path pathObj(filePath);
+    return pathObj.filename().string();
+}
+/**
+ * @brief Counts the topics of a document that is already in memory, with the selected engine.
+ * @param filePath Path the term counts are recorded under with --scores.
+ */
+std::vector<uint32_t> classifyText(std::string_view text, std::string_view filePath)
+{
+    instrumentation::ScopedTimer timer(instrumentation::Matching);
+    if (engine == Engine::Words)
+        return wordMatcher.countTopics(text);
+    if (earlyStop.active() || termLog)
+    {
+        EarlyStopCounter counter(matcher, earlyStop);
+        counter.feed(text);
+        if (termLog)
+            termLog->record(filePath, counter.patternCounts());
+        return counter.topicCounts();
+    }
+    return matcher.countTopics(text);
+}
+/**
+ * @brief Classifies a document based on the catalog.
+ * @param filePath The NUL-terminated path to the document file. Paths in a packed batch are
+ *                 passed straight from the receive buffer.
+ * @return Match counts indexed by topic id.
+ * @details Maps the contents of the document and counts matches with identifiers from the
+ *          catalog in a single pass of the compiled matcher. With --stream-chunk the document
+ *          is read and scanned one chunk at a time instead; identifiers straddling a chunk
+ *          boundary or a line break are counted exactly as in the mapped case. With
+ *          --engine words only whole words are matched, against the hashed dictionary.
  */
-void readCatalog()
+std::vector<uint32_t> classifyDocument(const char* filePath)
 {
+    if (streamChunkSize > 0)
+    {
+        // Bounded memory: the matcher state carries over between chunks
+        EarlyStopCounter counter(matcher, earlyStop);
+        forEachChunk(filePath, streamChunkSize, [&](std::string_view chunk) {
+            instrumentation::ScopedTimer timer(instrumentation::Matching);
+            return counter.feed(chunk);
+        });
+        if (termLog)
+            termLog->record(filePath, counter.patternCounts());
+        instrumentation::addDocument(counter.topicCounts());
+        return counter.topicCounts();
+    }
+    // Map the file and let the matcher read it in place; line breaks are skipped by the matcher
+    MappedDocument document(filePath);
+    std::vector<uint32_t> counts = classifyText(document.text(), filePath);
+    instrumentation::addDocument(counts);
+    return counts;
+}
+/**
+ * @brief Writes classification results to "classification_results.txt" in document order.
+ * @details Results arrive at rank 0 in batches of consecutive documents, in whatever order the
+ *          ranks finish them. Batches are held back until every earlier document has been
+ *          written, so the file is written once, by one process, in the order of the document list.
+ *          Each line in the file has the format:
+ *          FileName:    Topic1;MatchCount1,    Topic2;MatchCount2,    ...
+ */
+class OrderedResultWriter
+{
+public:
+    /**
+     * @param binaryPath When not empty, every line is also added to this binary columnar file.
+     */
+    OrderedResultWriter(const std::string& filename, const std::vector<std::string>& documents, size_t topicCount,
+                        const std::string& binaryPath = "", CountEncoding encoding = CountEncoding::Auto)
+        : outputFile_(filename), documents_(documents), topicCount_(topicCount)
+    {
+        if (!outputFile_.is_open())
+            std::cerr << "Error opening file for writing!" << std::endl;
+        if (!binaryPath.empty())
+        {
+            std::vector<std::string> topicNames;
+            for (size_t topicId = 0; topicId < topicCount_; ++topicId)
+                topicNames.emplace_back(matcher.topicName(topicId));
+            binaryFile_ = std::make_unique<ResultFileWriter>(binaryPath, std::move(topicNames), encoding);
+        }
+    }
+
+    /**
+     * @brief Makes the indices passed to add() refer to a subset of the documents.
+     * @param scheduled Index in the document list of every scheduled document, in the order they
+     *                  are scheduled.
+     *                  Documents left out must be added with addDocument().
+     */
+    void setSchedule(std::vector<size_t> scheduled)
+    {
+        scheduled_ = std::move(scheduled);
+        mapped_ = true;
+    }
 
-    std::ifstream inputFile("./actualCatalog.txt");
+    /**
+     * @brief Calls onResult(documentIndex, counts) for every document as soon as its counts
+     *        arrive, before they are written in order.
+     */
+    void setResultHook(std::function<void(size_t, const uint32_t*)> onResult)
+    {
+        onResult_ = std::move(onResult);
+    }
+
+    /**
+     * @brief Adds the counts of scheduled documents first .. first + numDocs - 1.
+     * @param counts numDocs rows of topicCount counts each, in document order.
+     */
+    void add(size_t first, const uint32_t* counts, size_t numDocs)
+    {
+        if (numDocs == 0)
+            return;
+        if (mapped_)
+        {
+            for (size_t row = 0; row < numDocs; ++row)
+                addDocument(scheduled_[first + row], counts + row * topicCount_);
+            return;
+        }
+        insert(first, counts, numDocs);
+    }
+
+    /**
+     * @brief Adds the counts of one document, by its index in the document list.
+     */
+    void addDocument(size_t index, const uint32_t* counts)
+    {
+        insert(index, counts, 1);
+    }
 
-    if (!inputFile.is_open())
+private:
+    void insert(size_t first, const uint32_t* counts, size_t numDocs)
     {
-        std::cerr << "Error opening the file!" << std::endl;
-        throw std::invalid_argument("Catalog file does not exist");
+        instrumentation::ScopedTimer timer(instrumentation::ResultWrite);
+        if (onResult_)
+        {
+            for (size_t row = 0; row < numDocs; ++row)
+                onResult_(first + row, counts + row * topicCount_);
+        }
+        waiting_.emplace(first, std::make_pair(numDocs, std::vector<uint32_t>(counts, counts + numDocs * topicCount_)));
+        while (!waiting_.empty() && waiting_.begin()->first == next_)
+        {
+            const auto& [rows, batch] = waiting_.begin()->second;
+            for (size_t row = 0; row < rows; ++row)
+                writeLine(next_++, batch.data() + row * topicCount_);
+            waiting_.erase(waiting_.begin());
+        }
     }
 
-    std::string line;
-    while (getline(inputFile, line))
+    void writeLine(size_t index, const uint32_t* counts)
     {
-        std::vector<std::string> vector = tokenize(line, "@%");
-        catalog.emplace(vector[0], tokenize(vector[1], ","));
+        outputFile_ << getFileNameFromPath(documents_[index]) << ":\t";
+        for (const auto& [topicId, count] : selectTopics(counts, topicCount_, selection))
+            outputFile_ << matcher.topicName(topicId) << ';' << count << ",\t";
+        outputFile_ << '\n';
+        if (binaryFile_)
+        {
+            std::vector<uint32_t> kept(counts, counts + topicCount_);
+            keepSelected(kept, selection);
+            binaryFile_->add(documents_[index], kept.data());
+        }
     }
 
-    inputFile.close();
+    std::ofstream outputFile_;
+    const std::vector<std::string>& documents_;
+    size_t topicCount_;
+    std::map<size_t, std::pair<size_t, std::vector<uint32_t>>> waiting_; // first -> rows, counts
+    size_t next_ = 0;
+    std::vector<size_t> scheduled_;
+    bool mapped_ = false;
+    std::function<void(size_t, const uint32_t*)> onResult_;
+    std::unique_ptr<ResultFileWriter> binaryFile_;
+};
+/**
+ * @brief Retrieves all files with specific extensions in a directory.
+ * @param directoryPath The path to the directory.
+ * @param extensions The list of file extensions to consider.
+ * @param walkThreads Threads walking the directory tree; with more than one the order of the files varies.
+ * @return Vector of file paths.
+ * @details Searches the specified directory and all its subdirectories for files with extensions
+ *          provided in the 'extensions' parameter. Returns a vector containing the paths of these files.
+ */
+std::vector<std::string> getAllFilesInDirectory(const std::string& directoryPath, const std::vector<std::string>& extensions,
+                                                size_t walkThreads = 1) {
+    instrumentation::ScopedTimer timer(instrumentation::Enumerate);
+    std::vector<std::string> files;
+    forEachFileInTree(directoryPath, extensions, walkThreads, [&files](std::string path) { files.push_back(std::move(path)); });
+    return files;
 }
 /**
- * @brief Represents the result of a document classification.
+ * @brief Message tags used between the manager and the workers.
  */
-struct SearchResult {
-    string fileName;
-    vector<pair<string, int>> TopicsList;
+enum MessageTag
+{
+    TAG_WORK_REQUEST = 1, ///< Worker -> manager: ready for the next batch, carrying earlier counts.
+    TAG_WORK_BATCH,       ///< Manager -> worker: packed batch of paths, empty when done.
+    TAG_RESULTS           ///< Worker -> manager: counts of the last batch, sent after the empty batch.
 };
+
 /**
- * @brief Writes the classification results to a file.
- * @param match The SearchResult object containing the classification results.
- * @details Appends the classification results to a file named "classification_results.txt".
- *          Each line in the file has the format:
- *          FileName:    Topic1;MatchCount1,    Topic2;MatchCount2,    ...
+ * @brief How documents are assigned to workers.
+ */
+enum class Schedule
+{
+    Static,   ///< Contiguous chunks scattered to every worker before any work starts.
+    Dynamic   ///< Workers pull batches from the manager as they finish their previous one.
+};
+
+/**
+ * @brief Command line options shared by all ranks.
+ */
+struct Options
+{
+    Schedule schedule = Schedule::Dynamic;
+    size_t batchSize = 16;      ///< Maximum number of paths per dynamic batch; 16 per thread unless given.
+    uintmax_t batchBytes = 0;   ///< Byte budget per dynamic batch (sum of file sizes); 0 disables it.
+    DocumentOrder order = DocumentOrder::Listing; ///< Order documents are scheduled in; results stay in listing order.
+    bool managerWorks = false;  ///< Rank 0 also classifies documents between scheduling rounds.
+    size_t threads = 1;         ///< Classification threads per rank, sharing the rank's matcher.
+    bool sharedCatalog = false; ///< Keep one copy of the catalog image per node in an MPI shared-memory window.
+    string catalogCache;        ///< Compiled catalog cache file read by rank 0; empty disables it.
+    size_t streamChunk = 0;     ///< Stream documents in chunks of this many bytes; 0 maps them whole.
+    prefilter::Kernel prefilter = prefilter::Kernel::Auto; ///< SIMD kernel that skips text without candidates.
+    CaseFold caseFold = CaseFold::None; ///< Letters matched regardless of case.
+    Engine engine = Engine::Substring;
+    size_t walkThreads = 1;     ///< Threads walking the document tree on rank 0.
+    bool pipeline = false;      ///< Classify each rank's documents on pipelined read and match stages.
+    PipelineOptions stages;     ///< Queue depth and stage parallelism of the pipeline.
+    string incremental;         ///< Result index read and rewritten by rank 0; empty disables it.
+    string stats;               ///< File rank 0 writes the JSON timing summary of all ranks to; empty disables it.
+    string binaryResults;       ///< File rank 0 also writes the results to in binary columnar form; empty disables it.
+    CountEncoding resultEncoding = CountEncoding::Auto; ///< How counts are stored in the binary results.
+    string checkpoint;          ///< Result index rank 0 stores periodically while the run progresses; empty disables it.
+    double checkpointInterval = 60; ///< Seconds between two checkpoints.
+    bool resume = false;        ///< Skip the documents already finished in the checkpoint.
+    TopicSelection selection;   ///< Topics reported per document.
+    EarlyStop earlyStop;        ///< When the scan of a document may end early.
+    string scores;              ///< File rank 0 writes the TF-IDF scores of every document to; empty disables scoring.
+};
+
+/**
+ * @brief Parses the command line.
+ * @details Supported options:
+ *          --schedule static|dynamic   work distribution strategy (default dynamic)
+ *          --batch-size N              paths per dynamic batch (default 16)
+ *          --batch-bytes B             close a dynamic batch once its files reach B bytes
+ *          --manager-works             let rank 0 classify documents too
+ *          --threads N                 classify on N threads per rank; 0 uses one per hardware thread
+ *          --shared-catalog            share one copy of the compiled catalog between the ranks of a node
+ *          --catalog-cache PATH        load the compiled catalog from PATH, rebuilding it when stale
+ *          --stream-chunk B            scan documents in chunks of B bytes to bound memory per document
+ *          --prefilter KERNEL          auto, avx2, sse4.2, neon, scalar or off (default auto)
+ *          --case-fold F               none (default), ascii or unicode: match terms regardless of case
+ *                                      (substring engine, see caseFold.h)
+ *          --engine substring|words    match terms anywhere (default) or as whole words only
+ *          --walk-threads N            walk the document tree with N threads (default 1)
+ *          --order O                   schedule documents in listing (default), locality (inode) or
+ *                                      largest-first order, with shares balanced by bytes; results
+ *                                      stay in listing order
+ *          --pipeline                  overlap reading and matching within every rank
+ *          --queue-depth N             documents queued between two pipeline stages (default 64)
+ *          --read-threads N            pipeline threads opening and prefetching documents (default 2)
+ *          --match-threads N           pipeline threads matching documents per rank; 0 (default) uses one per hardware thread
+ *          --incremental PATH          only classify documents that changed since the run that wrote PATH
+ *          --checkpoint PATH           store finished documents and their counts in PATH while the run progresses
+ *          --checkpoint-interval S     seconds between two checkpoints (default 60)
+ *          --resume                    skip the documents already finished in the checkpoint
+ *          --binary-results PATH       also write the results to PATH in the binary columnar format
+ *          --result-encoding E         dense, sparse, packed (varint-compressed) or auto (default)
+ *          --top-k K                   report only the K topics with the most matches per document
+ *          --min-count N               report only topics with at least N matches
+ *          --decisive-bytes B          stop scanning a document at the first multiple of B bytes at which
+ *                                      the leading topic is decisive (opt-in heuristic, substring engine)
+ *          --decisive-margin M         matches the leader must be ahead of the runner-up by (default 3)
+ *          --scores PATH               also score every document by TF-IDF with the catalog's term weights
+ *                                      and write the scores to PATH (substring engine)
+ *          --stats PATH                write counters and stage timings of every rank and thread to PATH
+ *                                      as JSON (build with -DDCAT_INSTRUMENTATION=1, otherwise only wall time)
  */
-void writeResultsToFile(const SearchResult& match) {
-    std::ofstream outputFile("classification_results.txt", std::ios_base::app);
-    if (!outputFile.is_open()) {
-        std::cerr << "Error opening file for writing!" << std::endl;
+Options parseArguments(int argc, char** argv)
+{
+    Options options;
+    bool batchSizeGiven = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--schedule" && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (value == "static")
+                options.schedule = Schedule::Static;
+            else if (value == "dynamic")
+                options.schedule = Schedule::Dynamic;
+            else
+                throw std::invalid_argument("Unknown schedule: " + value);
+        }
+        else if (arg == "--batch-size" && i + 1 < argc)
+        {
+            options.batchSize = std::max<size_t>(1, std::stoul(argv[++i]));
+            batchSizeGiven = true;
+        }
+        else if (arg == "--batch-bytes" && i + 1 < argc)
+        {
+            options.batchBytes = std::stoull(argv[++i]);
+        }
+        else if (arg == "--manager-works")
+        {
+            options.managerWorks = true;
+        }
+        else if (arg == "--shared-catalog")
+        {
+            options.sharedCatalog = true;
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            options.threads = std::stoul(argv[++i]);
+            if (options.threads == 0)
+                options.threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        else if (arg == "--catalog-cache" && i + 1 < argc)
+        {
+            options.catalogCache = argv[++i];
+        }
+        else if (arg == "--stream-chunk" && i + 1 < argc)
+        {
+            options.streamChunk = std::stoul(argv[++i]);
+        }
+        else if (arg == "--prefilter" && i + 1 < argc)
+        {
+            options.prefilter = prefilter::parseKernel(argv[++i]);
+        }
+        else if (arg == "--case-fold" && i + 1 < argc)
+        {
+            options.caseFold = parseCaseFold(argv[++i]);
+        }
+        else if (arg == "--engine" && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (value == "substring")
+                options.engine = Engine::Substring;
+            else if (value == "words")
+                options.engine = Engine::Words;
+            else
+                throw std::invalid_argument("Unknown engine: " + value);
+        }
+        else if (arg == "--walk-threads" && i + 1 < argc)
+        {
+            options.walkThreads = std::stoul(argv[++i]);
+        }
+        else if (arg == "--order" && i + 1 < argc)
+        {
+            options.order = parseDocumentOrder(argv[++i]);
+        }
+        else if (arg == "--incremental" && i + 1 < argc)
+        {
+            options.incremental = argv[++i];
+        }
+        else if (arg == "--checkpoint" && i + 1 < argc)
+        {
+            options.checkpoint = argv[++i];
+        }
+        else if (arg == "--checkpoint-interval" && i + 1 < argc)
+        {
+            options.checkpointInterval = std::stod(argv[++i]);
+        }
+        else if (arg == "--resume")
+        {
+            options.resume = true;
+        }
+        else if (arg == "--binary-results" && i + 1 < argc)
+        {
+            options.binaryResults = argv[++i];
+        }
+        else if (arg == "--result-encoding" && i + 1 < argc)
+        {
+            options.resultEncoding = parseCountEncoding(argv[++i]);
+        }
+        else if (arg == "--top-k" && i + 1 < argc)
+        {
+            options.selection.topK = std::stoul(argv[++i]);
+        }
+        else if (arg == "--min-count" && i + 1 < argc)
+        {
+            options.selection.minCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--decisive-bytes" && i + 1 < argc)
+        {
+            options.earlyStop.decisiveBytes = std::stoul(argv[++i]);
+        }
+        else if (arg == "--decisive-margin" && i + 1 < argc)
+        {
+            options.earlyStop.margin = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--scores" && i + 1 < argc)
+        {
+            options.scores = argv[++i];
+        }
+        else if (arg == "--stats" && i + 1 < argc)
+        {
+            options.stats = argv[++i];
+        }
+        else if (arg == "--pipeline")
+        {
+            options.pipeline = true;
+        }
+        else if (arg == "--queue-depth" && i + 1 < argc)
+        {
+            options.stages.queueDepth = std::stoul(argv[++i]);
+        }
+        else if (arg == "--read-threads" && i + 1 < argc)
+        {
+            options.stages.readers = std::stoul(argv[++i]);
+        }
+        else if (arg == "--match-threads" && i + 1 < argc)
+        {
+            options.stages.matchers = std::stoul(argv[++i]);
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown argument: " + arg);
+        }
+    }
+    if (options.engine == Engine::Words && options.streamChunk > 0)
+        throw std::invalid_argument("--stream-chunk is only supported by the substring engine");
+    if (options.engine == Engine::Words && options.caseFold != CaseFold::None)
+        throw std::invalid_argument("--case-fold is only supported by the substring engine");
+    if (options.pipeline && options.streamChunk > 0)
+        throw std::invalid_argument("--pipeline reads documents whole and cannot be combined with --stream-chunk");
+    if (options.resume && options.checkpoint.empty())
+        throw std::invalid_argument("--resume needs the --checkpoint to resume from");
+    if (!options.checkpoint.empty() && !options.incremental.empty())
+        throw std::invalid_argument("--checkpoint and --incremental both keep a result index; use one of them");
+    if (options.pipeline && options.threads > 1)
+        throw std::invalid_argument("--pipeline has its own match threads; use --match-threads instead of --threads");
+    // Partial counts must not be stored in a result index as if they covered the document.
+    if (options.earlyStop.active() && (options.engine == Engine::Words || !options.incremental.empty() ||
+                                       !options.checkpoint.empty()))
+        throw std::invalid_argument("--decisive-bytes needs the substring engine and no result index");
+    // Documents reused from a result index were not scanned, and --decisive-bytes stops scans early,
+    // so their term counts would not cover the document.
+    if (!options.scores.empty() && (options.engine == Engine::Words || !options.incremental.empty() ||
+                                    !options.checkpoint.empty() || options.earlyStop.active()))
+        throw std::invalid_argument("--scores needs the substring engine, no --decisive-bytes and no result index");
+    if (options.earlyStop.active() && options.earlyStop.margin == 0)
+        throw std::invalid_argument("--decisive-margin must be at least 1");
+    // A batch has to keep every thread of the rank busy until the next one arrives.
+    if (!batchSizeGiven)
+        options.batchSize *= options.threads;
+    return options;
+}
+
+/**
+ * @brief Hands out documents in batches on request from the workers.
+ * @details A batch closes when it holds batchSize paths or, if a byte budget is set, when the
+ *          files in it add up to at least batchBytes. Small batches balance load better, large
+ *          batches need fewer messages.
+ *          With a walker the document list grows while batches are handed out: the first batches
+ *          leave as soon as the walk finds their files, instead of after the whole tree is listed.
+ */
+class BatchScheduler
+{
+public:
+    /**
+     * @brief A range of consecutive documents and their packed paths.
+     */
+    struct Batch
+    {
+        size_t first = 0;   ///< Index of the first document in the batch.
+        size_t count = 0;   ///< Number of documents in the batch.
+        std::string paths;  ///< Consecutive NUL-terminated paths; empty once the documents run out.
+    };
+
+    /**
+     * @param documents Documents to hand out; the walker, if any, appends the ones it discovers.
+     * @param walker Walk still in progress that feeds documents, or null if the list is complete.
+     *               With batchBytes it must record sizes.
+     * @param sizes Size of every document in a complete list, for batchBytes; sizes of documents
+     *              the walker finds are appended. No file is stat'ed while batches are handed out.
+     */
+    BatchScheduler(std::vector<std::string>& documents, DirectoryWalker* walker, size_t batchSize, uintmax_t batchBytes,
+                   std::vector<uintmax_t> sizes = {})
+        : documents_(documents), walker_(walker), batchSize_(batchSize), batchBytes_(batchBytes), sizes_(std::move(sizes))
+    {
+    }
+
+    /**
+     * @brief Hands out the batches of a plan instead of cutting batches as they are taken.
+     * @param ends End of every batch in the document list (see planBatches); needs a complete list.
+     */
+    void setBatchEnds(std::vector<size_t> ends)
+    {
+        batchEnds_ = std::move(ends);
+    }
+
+    /**
+     * @brief Takes the next batch of documents.
+     */
+    Batch nextBatch()
+    {
+        Batch batch;
+        batch.first = next_;
+        if (!batchEnds_.empty())
+        {
+            // The plan already knows the sizes, so no file is stat'ed here.
+            auto end = std::upper_bound(batchEnds_.begin(), batchEnds_.end(), next_);
+            size_t last = end == batchEnds_.end() ? documents_.size() : *end;
+            for (; next_ < last; ++next_, ++batch.count)
+                batch.paths.append(documents_[next_]).push_back('\0');
+            return batch;
+        }
+        uintmax_t bytes = 0;
+        // Wait for the walk only while the batch is still empty; otherwise send what there is.
+        while (batch.count < batchSize_ && (next_ < documents_.size() || discover(batch.count == 0)))
+        {
+            size_t document = next_++;
+            batch.paths.append(documents_[document]).push_back('\0');
+            ++batch.count;
+            if (batchBytes_ > 0)
+            {
+                bytes += sizes_[document];
+                if (bytes >= batchBytes_)
+                    break;
+            }
+        }
+        return batch;
+    }
+
+    /**
+     * @brief Takes a single document for the manager to classify itself.
+     * @param index Set to the index of the document in the document list.
+     * @return False if the walk ended without finding another document.
+     */
+    bool nextDocument(size_t& index)
+    {
+        if (next_ == documents_.size() && !discover(true))
+            return false;
+        index = next_++;
+        return true;
+    }
+
+    /**
+     * @brief Whether documents remain to be handed out, or may still be discovered.
+     */
+    bool hasMore()
+    {
+        return next_ < documents_.size() || discover(false) || walker_ != nullptr;
+    }
+
+    const std::vector<std::string>& documents() const { return documents_; }
+
+private:
+    /**
+     * @brief Appends documents the walker found since the last call.
+     * @param wait Block until the walker finds one or finishes.
+     * @return Whether a document is available now.
+     */
+    bool discover(bool wait)
+    {
+        instrumentation::ScopedTimer timer(instrumentation::Enumerate);
+        if (walker_ != nullptr && !walker_->poll(documents_, wait, batchBytes_ > 0 ? &sizes_ : nullptr))
+            walker_ = nullptr;
+        return next_ < documents_.size();
+    }
+
+    std::vector<std::string>& documents_;
+    DirectoryWalker* walker_;
+    size_t batchSize_;
+    uintmax_t batchBytes_;
+    std::vector<uintmax_t> sizes_;
+    std::vector<size_t> batchEnds_;
+    size_t next_ = 0;
+};
+
+/**
+ * @brief Document paths packed into one contiguous buffer.
+ */
+struct PackedPaths
+{
+    std::string buffer;         ///< Paths back to back, each followed by a NUL byte.
+    std::vector<int> offsets;   ///< Start of every path in buffer, plus the total size at the end.
+};
+
+/**
+ * @brief Packs paths into a single buffer that can be sent with one message.
+ */
+PackedPaths packPaths(const std::vector<std::string>& paths)
+{
+    PackedPaths packed;
+    packed.offsets.reserve(paths.size() + 1);
+    size_t total = 0;
+    for (const auto& path : paths)
+        total += path.size() + 1;
+    packed.buffer.reserve(total);
+    for (const auto& path : paths)
+    {
+        packed.offsets.push_back(packed.buffer.size());
+        packed.buffer.append(path).push_back('\0');
+    }
+    packed.offsets.push_back(packed.buffer.size());
+    return packed;
+}
+
+/**
+ * @brief Calls callback with a view of every path in a packed buffer.
+ * @details Each view is followed by its NUL terminator inside the buffer, so view.data() can be
+ *          used as a C string without copying.
+ */
+template <typename Callback>
+void forEachPackedPath(const char* data, size_t length, Callback&& callback)
+{
+    for (size_t start = 0; start < length;)
+    {
+        std::string_view path(data + start);
+        callback(path);
+        start += path.size() + 1;
+    }
+}
+
+/**
+ * @brief Match stage of the pipeline: counts a document the read stage has mapped.
+ */
+std::vector<uint32_t> matchLoaded(const std::string& path, const MappedDocument& document, size_t)
+{
+    std::vector<uint32_t> counts = classifyText(document.text(), path);
+    instrumentation::addDocument(counts);
+    return counts;
+}
+
+/**
+ * @brief Classifies every document of a packed buffer and appends their counts to results, in order.
+ * @details With --threads the documents are classified on the rank's thread pool. With --pipeline
+ *          the paths go through the read and match stages of the pipeline, so the next documents are
+ *          opened and read while earlier ones are matched. Workers of the dynamic schedule use one
+ *          BatchPipeline for all their batches instead.
+ */
+void classifyPacked(const char* data, size_t length, std::vector<uint32_t>& results)
+{
+    if (rankPool)
+    {
+        // Every document has its own slot in results, so the threads write without locking.
+        std::vector<const char*> paths;
+        forEachPackedPath(data, length, [&paths](std::string_view path) { paths.push_back(path.data()); });
+        const size_t topicCount = matcher.topicCount();
+        const size_t first = results.size();
+        results.resize(first + paths.size() * topicCount);
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+            rankPool->submit([&paths, &results, topicCount, first, i](size_t) {
+                std::vector<uint32_t> counts = classifyDocument(paths[i]);
+                std::copy(counts.begin(), counts.end(), results.begin() + first + i * topicCount);
+            });
+        }
+        rankPool->wait();
         return;
     }
+    if (!pipelineStages)
+    {
+        forEachPackedPath(data, length, [&results](std::string_view path) {
+            std::vector<uint32_t> counts = classifyDocument(path.data());
+            results.insert(results.end(), counts.begin(), counts.end());
+        });
+        return;
+    }
+    runPipeline<std::vector<uint32_t>>(
+        *pipelineStages,
+        [data, length](auto&& emit) { forEachPackedPath(data, length, [&emit](std::string_view path) { emit(std::string(path)); }); },
+        matchLoaded,
+        [&results](size_t, const std::string&, std::vector<uint32_t>&& counts) {
+            results.insert(results.end(), counts.begin(), counts.end());
+        });
+}
 
-        outputFile << match.fileName << ":\t";
-        for(auto [topic, matchCount] : match.TopicsList) {
-            outputFile << topic << ';' << matchCount << ",\t";
+/**
+ * @brief A single pipeline that classifies every batch a worker of the dynamic schedule receives.
+ * @details A pipeline per batch drains at the end of every batch, so reading batch N + 1 never
+ *          overlaps matching batch N, and every batch starts and joins all stage threads again.
+ *          This pipeline runs on its own thread for the whole schedule: its enumerate stage pulls
+ *          the paths of the batches the main thread feeds it, in order, and the counts of a batch
+ *          are handed back once all of its documents are done. Only the main thread makes MPI calls.
+ */
+class BatchPipeline
+{
+public:
+    explicit BatchPipeline(const PipelineOptions& stages)
+        : thread_([this, stages] { run(stages); })
+    {
+    }
+
+    BatchPipeline(const BatchPipeline&) = delete;
+    BatchPipeline& operator=(const BatchPipeline&) = delete;
+
+    /**
+     * @brief Ends the input and waits for the documents still queued.
+     */
+    ~BatchPipeline()
+    {
+        if (thread_.joinable())
+        {
+            close();
+            thread_.join();
+        }
+    }
+
+    /**
+     * @brief Queues the documents of a packed batch behind those fed earlier.
+     * @param batch Consecutive NUL-terminated paths, at least one.
+     */
+    void feed(std::vector<char> batch)
+    {
+        size_t count = 0;
+        forEachPackedPath(batch.data(), batch.size(), [&count](std::string_view) { ++count; });
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            batches_.push_back(std::move(batch));
+            batchSizes_.push_back(count);
+        }
+        input_.notify_one();
+    }
+
+    /**
+     * @brief Counts of the oldest batch not taken yet, waiting until all its documents are done.
+     * @throws The first exception a stage failed with.
+     */
+    std::vector<uint32_t> takeBatch()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        finished_.wait(lock, [this] { return !done_.empty() || failed_; });
+        if (failed_)
+        {
+            // The failure is only known in full once the pipeline has stopped.
+            lock.unlock();
+            close();
+            thread_.join();
+            std::rethrow_exception(error_);
+        }
+        std::vector<uint32_t> counts = std::move(done_.front());
+        done_.pop_front();
+        return counts;
+    }
+
+private:
+    void run(PipelineOptions stages)
+    {
+        try
+        {
+            runPipeline<std::vector<uint32_t>>(
+                stages,
+                [this](auto&& emit) {
+                    std::vector<char> batch;
+                    while (nextBatch(batch))
+                        forEachPackedPath(batch.data(), batch.size(), [&emit](std::string_view path) { emit(std::string(path)); });
+                },
+                matchLoaded,
+                [this](size_t, const std::string&, std::vector<uint32_t>&& counts) { addCounts(counts); },
+                [this] {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        failed_ = true;
+                    }
+                    input_.notify_all();
+                    finished_.notify_all();
+                });
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            error_ = std::current_exception();
+            failed_ = true;
+        }
+        finished_.notify_all();
+    }
+
+    /**
+     * @brief Enumerate stage: waits for the next batch; false once the input ends or a stage failed.
+     */
+    bool nextBatch(std::vector<char>& batch)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        input_.wait(lock, [this] { return !batches_.empty() || closed_ || failed_; });
+        if (failed_ || batches_.empty())
+            return false;
+        batch = std::move(batches_.front());
+        batches_.pop_front();
+        return true;
+    }
+
+    /**
+     * @brief Output stage: appends the counts of the next document, completing its batch at the end.
+     */
+    void addCounts(const std::vector<uint32_t>& counts)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            assembling_.insert(assembling_.end(), counts.begin(), counts.end());
+            if (++assembled_ < batchSizes_.front())
+                return;
+            batchSizes_.pop_front();
+            done_.push_back(std::move(assembling_));
+            assembling_.clear();
+            assembled_ = 0;
         }
-    outputFile << '\n';
-    outputFile.close();
+        finished_.notify_one();
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        input_.notify_all();
+    }
+
+    std::mutex mutex_;
+    std::condition_variable input_;       ///< A batch was fed, the input ended or a stage failed.
+    std::condition_variable finished_;    ///< A batch was completed or a stage failed.
+    std::deque<std::vector<char>> batches_; ///< Batches fed but not yet enumerated.
+    std::deque<size_t> batchSizes_;       ///< Document count of every batch not yet completed.
+    std::vector<uint32_t> assembling_;    ///< Counts of the documents done so far of the oldest batch.
+    size_t assembled_ = 0;
+    std::deque<std::vector<uint32_t>> done_; ///< Counts of completed batches not yet taken.
+    bool closed_ = false;
+    bool failed_ = false;
+    std::exception_ptr error_;
+    std::thread thread_; ///< Runs the pipeline; last, so it starts once everything above exists.
+};
+
+/**
+ * @brief Manager side of the static schedule: scatters every worker its contiguous chunk up front.
+ * @details All paths are packed into one buffer; each rank gets its byte count with MPI_Scatter
+ *          and its slice of the buffer with a single MPI_Iscatterv.
+ * @param managerWorks When true rank 0 keeps the first chunk and classifies it while the
+ *                     scatter to the workers is in flight.
+ * @param shareEnds End of every participant's chunk (see planShares); when empty the documents
+ *                  are split into chunks of equal counts.
+ */
+void distributeStatic(const std::vector<std::string>& documents, int size, bool managerWorks, OrderedResultWriter& writer,
+                      const std::vector<size_t>& shareEnds = {})
+{
+    instrumentation::ScopedTimer distribution(instrumentation::PathDistribution);
+    PackedPaths packed = packPaths(documents);
+    int participants = managerWorks ? size : size - 1;
+    int numDocumentsPerWorker = documents.size() / participants;
+    int remainingDocuments = documents.size() % participants;
+
+    std::vector<int> byteCounts(size, 0);
+    std::vector<int> displacements(size, 0);
+    std::vector<int> firstDocument(size, 0);
+    std::vector<int> documentCounts(size, 0);
+    int startIdx = 0;
+    for (int chunk = 0; chunk < participants; ++chunk)
+    {
+        int numDocs = shareEnds.empty() ? numDocumentsPerWorker + (chunk < remainingDocuments ? 1 : 0)
+                                        : static_cast<int>(shareEnds[chunk]) - startIdx;
+        int worker = managerWorks ? chunk : chunk + 1;
+        firstDocument[worker] = startIdx;
+        documentCounts[worker] = numDocs;
+        displacements[worker] = packed.offsets[startIdx];
+        byteCounts[worker] = packed.offsets[startIdx + numDocs] - packed.offsets[startIdx];
+        startIdx += numDocs;
+    }
+
+    int ownBytes;
+    MPI_Request request;
+    {
+        instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+        MPI_Scatter(byteCounts.data(), 1, MPI_INT, &ownBytes, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Iscatterv(packed.buffer.data(), byteCounts.data(), displacements.data(), MPI_CHAR,
+                      MPI_IN_PLACE, 0, MPI_CHAR, 0, MPI_COMM_WORLD, &request);
+    }
+    distribution.stop();
+
+    std::vector<uint32_t> ownResults;
+    if (managerWorks)
+    {
+        classifyPacked(packed.buffer.data() + displacements[0], ownBytes, ownResults);
+    }
+
+    // Collect every worker's counts; chunk r holds documents firstDocument[r] onwards.
+    std::vector<int> resultSizes(size, 0);
+    std::vector<int> resultDisplacements(size, 0);
+    std::vector<uint32_t> results;
+    {
+        instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        int ownSize = 0;
+        MPI_Gather(&ownSize, 1, MPI_INT, resultSizes.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+        for (int r = 1; r < size; ++r)
+            resultDisplacements[r] = resultDisplacements[r - 1] + resultSizes[r - 1];
+        results.resize(resultDisplacements[size - 1] + resultSizes[size - 1]);
+        MPI_Gatherv(nullptr, 0, MPI_UINT32_T, results.data(), resultSizes.data(), resultDisplacements.data(), MPI_UINT32_T, 0, MPI_COMM_WORLD);
+    }
+
+    // Row counts come from the shares, not from the sizes of the counts: with no topics those are 0.
+    writer.add(0, ownResults.data(), managerWorks ? documentCounts[0] : 0);
+    for (int r = 1; r < size; ++r)
+    {
+        if (static_cast<size_t>(resultSizes[r]) != static_cast<size_t>(documentCounts[r]) * matcher.topicCount())
+            throw std::runtime_error("Worker " + std::to_string(r) + " sent counts of the wrong size");
+        writer.add(firstDocument[r], results.data() + resultDisplacements[r], documentCounts[r]);
+    }
 }
+
 /**
- * @brief Extracts the file name from a given file path.
- * @param filePath The full path of the file.
- * @return The file name.
+ * @brief Worker side of the static schedule: receives and classifies its chunk, then sends
+ *        the counts of the whole chunk to rank 0 with one MPI_Gatherv.
  */
-std::string getFileNameFromPath(const std::string& filePath) {
-    // Use filesystem::path to get the filename
-    std::filesystem::path pathObj(filePath);
-    return pathObj.filename().string();
+void receiveStatic()
+{
+    std::vector<char> chunk;
+    {
+        instrumentation::ScopedTimer distribution(instrumentation::PathDistribution);
+        instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+        int numBytes;
+        MPI_Scatter(nullptr, 1, MPI_INT, &numBytes, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        chunk.resize(numBytes);
+        MPI_Request request;
+        MPI_Iscatterv(nullptr, nullptr, nullptr, MPI_CHAR, chunk.data(), numBytes, MPI_CHAR, 0, MPI_COMM_WORLD, &request);
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+    }
+
+    std::vector<uint32_t> results;
+    classifyPacked(chunk.data(), chunk.size(), results);
+
+    instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+    int resultSize = results.size();
+    MPI_Gather(&resultSize, 1, MPI_INT, nullptr, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(results.data(), resultSize, MPI_UINT32_T, nullptr, nullptr, nullptr, MPI_UINT32_T, 0, MPI_COMM_WORLD);
 }
+
 /**
- * @brief Classifies a document based on the catalog.
- * @param filePath The path to the document file.
- * @details Reads the contents of the document, counts matches with identifiers from the catalog,
- *          and stores the results in a SearchResult object.
+ * @brief Manager side of the dynamic schedule.
+ * @details Answers work requests from any worker with the next batch until the documents run
+ *          out, then answers each worker once more with an empty batch to release it.
+ *          Every request carries the counts of the oldest batch the worker has not reported
+ *          yet, and a final TAG_RESULTS message carries the rest, so results stream back to
+ *          rank 0 with the requests instead of being written by every rank.
+ *          Requests are polled with MPI_Iprobe and batches sent with MPI_Isend, so with
+ *          managerWorks rank 0 classifies one document at a time whenever no request is
+ *          waiting, instead of idling in a blocking receive; with --threads it classifies a
+ *          whole batch on its thread pool instead.
+ *          Lost workers are not recovered: without a fault-tolerant MPI the job cannot go on
+ *          once a rank dies, so only a final checkpoint is saved (see classifyWithIndex).
+ * @throws std::runtime_error if an MPI call fails while errors are returned (as with --checkpoint).
  */
-void classifyDocument(const string& filePath)
+void serveBatches(BatchScheduler& scheduler, int size, bool managerWorks, OrderedResultWriter& writer)
 {
-    std::string fileName = getFileNameFromPath(filePath);
-    std::ifstream inputFile(filePath);
-    // Check if the file is successfully opened
-    if (!inputFile.is_open()) {
-        std::cerr << "Error opening the file!" << std::endl;
-        throw std::invalid_argument("Catalog file does not exist");
-    }
-
-    std::string line; // Declare a string variable to store each
-    std::string text; // Declare a string variable to store each
-    // line of the file
-
-    // Read each line of the file and print it to the
-    // standard output stream
-    while (getline(inputFile, line)) {
-        text += line;
-    }
-    SearchResult result {fileName, {}};
-    for (auto const& [topic, identifiers] : catalog) {
-        int count = 0;
-
-        for (const std::string& term : identifiers) {
-            size_t pos = text.find(term, 0);
-            while (pos != std::string::npos) {
-                pos = text.find(term, pos + term.length());
-                count++;
+    // Batch buffers must stay alive until their MPI_Isend completes.
+    std::list<std::pair<std::string, MPI_Request>> sends;
+    // Batches handed to each worker whose counts have not come back yet, oldest first.
+    std::vector<std::deque<std::pair<size_t, size_t>>> outstanding(size);
+    std::vector<uint32_t> incoming;
+    int pendingWorkers = size - 1;
+
+    while (pendingWorkers > 0 || (managerWorks && scheduler.hasMore()))
+    {
+        int arrived = 0;
+        MPI_Status status;
+        if (pendingWorkers > 0)
+        {
+            if (managerWorks && scheduler.hasMore())
+            {
+                MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &arrived, &status);
+            }
+            else
+            {
+                instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+                if (MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status) != MPI_SUCCESS)
+                    throw std::runtime_error("Waiting for the workers failed");
+                arrived = 1;
+            }
+        }
+
+        if (arrived)
+        {
+            int worker = status.MPI_SOURCE;
+            int length;
+            MPI_Get_count(&status, MPI_UINT32_T, &length);
+            incoming.resize(length);
+            int received;
+            {
+                instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+                received = MPI_Recv(incoming.data(), length, MPI_UINT32_T, worker, status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
             }
+            if (received != MPI_SUCCESS)
+                throw std::runtime_error("Receiving from worker " + std::to_string(worker) + " failed");
+            // A worker asks for its next batch as soon as it starts on one, so a request carries
+            // the counts of the batch before the one it is working on and the final message those
+            // of its last batch. This pairing cannot rely on the length: with no topics every
+            // batch comes back empty.
+            std::deque<std::pair<size_t, size_t>>& handed = outstanding[worker];
+            if (handed.size() > (status.MPI_TAG == TAG_RESULTS ? 0u : 1u))
+            {
+                auto [first, count] = handed.front();
+                handed.pop_front();
+                if (static_cast<size_t>(length) != count * matcher.topicCount())
+                    throw std::runtime_error("Worker " + std::to_string(worker) + " sent counts of the wrong size");
+                writer.add(first, incoming.data(), count);
+            }
+            else if (length > 0)
+            {
+                throw std::runtime_error("Worker " + std::to_string(worker) + " sent counts for no batch");
+            }
+            if (status.MPI_TAG == TAG_RESULTS)
+            {
+                --pendingWorkers;
+                continue;
+            }
+
+            instrumentation::ScopedTimer distribution(instrumentation::PathDistribution);
+            BatchScheduler::Batch batch = scheduler.nextBatch();
+            if (batch.count > 0)
+                outstanding[worker].emplace_back(batch.first, batch.count);
+            sends.emplace_back(std::move(batch.paths), MPI_REQUEST_NULL);
+            auto& [paths, sendRequest] = sends.back();
+            if (MPI_Isend(paths.data(), paths.size(), MPI_CHAR, worker, TAG_WORK_BATCH, MPI_COMM_WORLD, &sendRequest) != MPI_SUCCESS)
+                throw std::runtime_error("Sending a batch to worker " + std::to_string(worker) + " failed");
+
+            sends.remove_if([](std::pair<std::string, MPI_Request>& send) {
+                int done = 0;
+                if (MPI_Test(&send.second, &done, MPI_STATUS_IGNORE) != MPI_SUCCESS)
+                    throw std::runtime_error("Sending a batch failed");
+                return done != 0;
+            });
+            continue;
         }
 
-        result.TopicsList.emplace_back(topic, count);
+        if (rankPool && scheduler.hasMore())
+        {
+            // A single document would leave the rank's other threads idle; take a whole batch.
+            BatchScheduler::Batch batch = scheduler.nextBatch();
+            std::vector<uint32_t> counts;
+            classifyPacked(batch.paths.data(), batch.paths.size(), counts);
+            writer.add(batch.first, counts.data(), batch.count);
+            continue;
+        }
+        size_t index;
+        if (scheduler.hasMore() && scheduler.nextDocument(index))
+        {
+            std::vector<uint32_t> counts = classifyDocument(scheduler.documents()[index].c_str());
+            writer.add(index, counts.data(), 1);
+        }
     }
-    writeResultsToFile(result);
+
+    instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+    for (auto& send : sends)
+        MPI_Wait(&send.second, MPI_STATUS_IGNORE);
 }
+
 /**
- * @brief Retrieves all files with specific extensions in a directory.
- * @param directoryPath The path to the directory.
- * @param extensions The list of file extensions to consider.
- * @return Vector of file paths.
- * @details Searches the specified directory for files with extensions provided in the 'extensions' parameter.
- *          Returns a vector containing the paths of these files.
+ * @brief Worker side of the dynamic schedule: pulls and classifies batches until an empty one arrives.
+ * @details The request for the next batch goes out before the current batch is classified,
+ *          so the manager's answer is already waiting when the worker needs it. That request
+ *          carries the counts of the previous batch; the counts of the last batch follow the
+ *          empty batch as a TAG_RESULTS message. With --pipeline every batch is fed to one
+ *          BatchPipeline as it arrives, and the request waits for the previous batch instead, so
+ *          the pipeline always holds the next documents and never drains between batches.
  */
-std::vector<std::string> getAllFilesInDirectory(const std::string& directoryPath, const std::vector<std::string>& extensions) {
-    std::vector<std::string> files;
-    for (const auto& entry : std::filesystem::directory_iterator(directoryPath)) {
-        if (std::filesystem::is_regular_file(entry.path())) {
-            std::string extension = entry.path().extension().string();
-            if (std::find(extensions.begin(), extensions.end(), extension) != extensions.end()) {
-                files.push_back(entry.path().string());
-            }
+void requestBatches()
+{
+    std::vector<char> batch;
+    std::vector<uint32_t> previous;
+    std::vector<uint32_t> current;
+    std::unique_ptr<BatchPipeline> pipeline;
+    if (pipelineStages)
+        pipeline = std::make_unique<BatchPipeline>(*pipelineStages);
+    size_t fed = 0;
+    MPI_Send(previous.data(), 0, MPI_UINT32_T, 0, TAG_WORK_REQUEST, MPI_COMM_WORLD);
+    while (true)
+    {
+        int length;
+        {
+            // Waiting for a batch is time both in path distribution and blocked in MPI
+            instrumentation::ScopedTimer distribution(instrumentation::PathDistribution);
+            instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+            MPI_Status status;
+            MPI_Probe(0, TAG_WORK_BATCH, MPI_COMM_WORLD, &status);
+            MPI_Get_count(&status, MPI_CHAR, &length);
+            batch.resize(length);
+            MPI_Recv(batch.data(), length, MPI_CHAR, 0, TAG_WORK_BATCH, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        }
+        if (length == 0)
+            break;
+
+        if (pipeline)
+        {
+            // The pipeline reads this batch while it finishes the one before, whose counts go
+            // with the request; the first request carries none.
+            pipeline->feed(std::move(batch));
+            batch.clear();
+            previous = ++fed > 1 ? pipeline->takeBatch() : std::vector<uint32_t>();
+            instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+            MPI_Send(previous.data(), previous.size(), MPI_UINT32_T, 0, TAG_WORK_REQUEST, MPI_COMM_WORLD);
+            continue;
         }
+
+        MPI_Request nextRequest;
+        MPI_Isend(previous.data(), previous.size(), MPI_UINT32_T, 0, TAG_WORK_REQUEST, MPI_COMM_WORLD, &nextRequest);
+        current.clear();
+        classifyPacked(batch.data(), batch.size(), current);
+        {
+            instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+            MPI_Wait(&nextRequest, MPI_STATUS_IGNORE);
+        }
+        previous.swap(current);
     }
-    return files;
+    if (pipeline)
+        previous = fed > 0 ? pipeline->takeBatch() : std::vector<uint32_t>();
+    instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+    MPI_Send(previous.data(), previous.size(), MPI_UINT32_T, 0, TAG_RESULTS, MPI_COMM_WORLD);
+}
+
+/**
+ * @brief Reorders the documents to schedule as --order asks (see documentOrder.h).
+ * @param documents Documents about to be scheduled; permuted into the planned order.
+ * @param scheduled Index in the writer's document list of every entry of documents; permuted
+ *                  alike, ready for OrderedResultWriter::setSchedule.
+ * @return End of every planned share (static schedule) or batch (dynamic schedule) in the new
+ *         order; empty, with nothing reordered, for the listing order.
+ */
+vector<size_t> planSchedule(vector<string>& documents, vector<size_t>& scheduled, const Options& options, int size)
+{
+    if (options.order == DocumentOrder::Listing)
+        return {};
+    instrumentation::ScopedTimer timer(instrumentation::Enumerate);
+    vector<FileLocation> files = locateFiles(documents);
+    int participants = options.managerWorks ? size : size - 1;
+    DocumentPlan plan = options.schedule == Schedule::Static
+                            ? planShares(files, options.order, participants)
+                            : planBatches(files, options.order, options.batchSize, options.batchBytes);
+    vector<string> orderedDocuments;
+    vector<size_t> orderedScheduled;
+    orderedDocuments.reserve(documents.size());
+    orderedScheduled.reserve(documents.size());
+    for (size_t i : plan.order)
+    {
+        orderedDocuments.push_back(std::move(documents[i]));
+        orderedScheduled.push_back(scheduled[i]);
+    }
+    documents.swap(orderedDocuments);
+    scheduled.swap(orderedScheduled);
+    return plan.ends;
 }
+
+/**
+ * @brief Rank 0 with --incremental or --checkpoint: classifies with a result index.
+ * @details The comparison needs every document stat'ed, so the tree is listed in full first.
+ *          With --incremental, or --checkpoint and --resume, documents that are unchanged since
+ *          the index was stored are written straight from it and only the others are scheduled,
+ *          with either schedule. Counts are recorded as they arrive at rank 0, and with
+ *          --checkpoint the index is stored every checkpointInterval seconds and when the run
+ *          fails, so --resume only loses the batches that were in flight. With the static
+ *          schedule counts only arrive at the end. Counts computed by the workers are recorded
+ *          without a content hash, so a later run classifies such a document again if its
+ *          modification time changes even when its contents do not.
+ */
+void classifyWithIndex(const Options& options, int size, const string& documentRoot, const vector<string>& extensions)
+{
+    const bool checkpointing = !options.checkpoint.empty();
+    const bool reuse = !checkpointing || options.resume;
+    vector<string> documents = getAllFilesInDirectory(documentRoot, extensions, options.walkThreads);
+    uint64_t version = ResultIndex::catalogVersion(matcher, options.engine == Engine::Words ? "words" : "substring");
+    ResultIndex index(checkpointing ? options.checkpoint : options.incremental, version, matcher.topicCount());
+
+    vector<DocumentKey> keys(documents.size());
+    vector<char> known(documents.size(), 0);
+    OrderedResultWriter writer("classification_results.txt", documents, matcher.topicCount(), options.binaryResults,
+                               options.resultEncoding);
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+    writer.setResultHook([&](size_t document, const uint32_t* counts) {
+        if (known[document])
+            index.record(documents[document], keys[document], counts);
+        auto now = std::chrono::steady_clock::now();
+        if (checkpointing && std::chrono::duration<double>(now - lastCheckpoint).count() >= options.checkpointInterval)
+        {
+            instrumentation::ScopedTimer timer(instrumentation::ResultWrite);
+            index.store();
+            lastCheckpoint = now;
+        }
+    });
+
+    vector<string> pending;
+    vector<size_t> scheduled;
+    vector<uintmax_t> sizes; // From the keys, so --batch-bytes needs no second stat.
+    vector<uint32_t> counts;
+    for (size_t i = 0; i < documents.size(); ++i)
+    {
+        known[i] = ResultIndex::statDocument(documents[i], keys[i]);
+        if (known[i] && reuse && index.lookup(documents[i], keys[i], counts))
+        {
+            writer.addDocument(i, counts.data());
+            continue;
+        }
+        pending.push_back(documents[i]);
+        scheduled.push_back(i);
+        sizes.push_back(known[i] ? keys[i].size : 0);
+    }
+    vector<size_t> ends = planSchedule(pending, scheduled, options, size);
+    writer.setSchedule(std::move(scheduled));
+
+    try
+    {
+        if (options.schedule == Schedule::Static)
+        {
+            distributeStatic(pending, size, options.managerWorks, writer, ends);
+        }
+        else
+        {
+            // A planned order has its own batch ends, and pending no longer lines up with sizes.
+            BatchScheduler scheduler(pending, nullptr, options.batchSize, options.batchBytes,
+                                     ends.empty() ? std::move(sizes) : vector<uintmax_t>());
+            scheduler.setBatchEnds(std::move(ends));
+            serveBatches(scheduler, size, options.managerWorks, writer);
+        }
+    }
+    catch (...)
+    {
+        // Keep what has been finished so far for --resume.
+        index.store();
+        throw;
+    }
+    instrumentation::ScopedTimer timer(instrumentation::ResultWrite);
+    index.store();
+}
+
+/**
+ * @brief Broadcasts a byte buffer from rank 0 of a communicator.
+ * @details MPI counts are ints, so buffers above 2 GiB go out in several pieces.
+ */
+void broadcastBytes(char* data, uint64_t size, MPI_Comm communicator = MPI_COMM_WORLD)
+{
+    const uint64_t maxChunk = std::numeric_limits<int>::max();
+    instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+    for (uint64_t offset = 0; offset < size; offset += maxChunk)
+        MPI_Bcast(data + offset, static_cast<int>(std::min(maxChunk, size - offset)), MPI_CHAR, 0, communicator);
+}
+
+/**
+ * @brief Broadcasts the matcher compiled on rank 0 to every rank.
+ * @details The compiled image is the wire format: workers receive it into an aligned buffer
+ *          and use it in place, without rebuilding a catalog or an automaton.
+ */
+void broadcastMatcher(int rank)
+{
+    instrumentation::ScopedTimer timer(instrumentation::CatalogBroadcast);
+    uint64_t imageSize = rank == 0 ? matcher.imageSize() : 0;
+    {
+        instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+        MPI_Bcast(&imageSize, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    }
+    if (rank == 0)
+    {
+        broadcastBytes(const_cast<char*>(matcher.imageData()), imageSize);
+        return;
+    }
+    auto image = std::make_shared<std::vector<uint64_t>>((imageSize + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    broadcastBytes(reinterpret_cast<char*>(image->data()), imageSize);
+    matcher = AhoCorasick::fromImage(image->data(), imageSize, image);
+}
+
+/**
+ * @brief Broadcasts the matcher compiled on rank 0 into one shared-memory segment per node.
+ * @details The ranks of a node are grouped with MPI_Comm_split_type(MPI_COMM_TYPE_SHARED). The
+ *          first rank of every node allocates a segment of the image size with
+ *          MPI_Win_allocate_shared and receives the image into it; rank 0 broadcasts only to
+ *          these node leaders. The other ranks of the node locate the leader's segment with
+ *          MPI_Win_shared_query and use the image in place, so a node holds a single copy.
+ *          Rank 0 switches to its node's copy as well. The window lives until releaseSharedCatalog().
+ */
+void broadcastMatcherShared(int rank)
+{
+    instrumentation::ScopedTimer timer(instrumentation::CatalogBroadcast);
+    MPI_Comm node;
+    MPI_Comm leaders;
+    int nodeRank;
+    uint64_t imageSize = rank == 0 ? matcher.imageSize() : 0;
+    char* image = nullptr;
+    {
+        instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+        // Ordering by world rank makes rank 0 the leader of its node and of the leaders.
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
+        MPI_Comm_rank(node, &nodeRank);
+        MPI_Comm_split(MPI_COMM_WORLD, nodeRank == 0 ? 0 : MPI_UNDEFINED, rank, &leaders);
+        MPI_Bcast(&imageSize, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+        MPI_Win_allocate_shared(nodeRank == 0 ? static_cast<MPI_Aint>(imageSize) : 0, 1, MPI_INFO_NULL, node, &image,
+                                &catalogWindow);
+    }
+    if (nodeRank == 0)
+    {
+        if (rank == 0)
+            std::memcpy(image, matcher.imageData(), imageSize);
+        broadcastBytes(image, imageSize, leaders);
+        MPI_Comm_free(&leaders);
+    }
+    else
+    {
+        MPI_Aint segmentSize;
+        int displacementUnit;
+        MPI_Win_shared_query(catalogWindow, 0, &segmentSize, &displacementUnit, &image);
+    }
+    {
+        // Completes the leader's writes before any rank of the node reads the image.
+        instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+        MPI_Win_fence(0, catalogWindow);
+    }
+    MPI_Comm_free(&node);
+    matcher = AhoCorasick::fromImage(image, imageSize);
+}
+
+/**
+ * @brief Drops the matcher and frees the shared catalog window, if there is one.
+ * @details Collective over the ranks of every node; must be called before MPI_Finalize.
+ */
+void releaseSharedCatalog()
+{
+    if (catalogWindow == MPI_WIN_NULL)
+        return;
+    matcher = AhoCorasick();
+    MPI_Win_free(&catalogWindow);
+}
+
+/**
+ * @brief Collects the instrumentation samples of every rank on rank 0 and writes them as JSON.
+ * @param wallSeconds Time this rank has run so far.
+ * @details The per-rank totals are reduced with MPI_Reduce into the sum and the maximum over all
+ *          ranks; a maximum far above the mean points at a rank that holds the others up. The
+ *          samples of every thread are gathered as well, for the per-rank breakdown. Collective,
+ *          so every rank has to call it.
+ */
+void reportStats(const string& path, int rank, int size, double wallSeconds)
+{
+    using instrumentation::Sample;
+    vector<Sample> samples = instrumentation::threadSamples();
+    Sample own = instrumentation::total(samples);
+    Sample sum;
+    Sample maximum;
+    double wallMaximum = 0;
+    MPI_Reduce(own.values, sum.values, Sample::words, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(own.values, maximum.values, Sample::words, MPI_UINT64_T, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&wallSeconds, &wallMaximum, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    // Every thread's sample, rank by rank, as flat arrays of Sample::words values.
+    int ownWords = static_cast<int>(samples.size() * Sample::words);
+    vector<int> words(rank == 0 ? size : 0);
+    vector<double> walls(rank == 0 ? size : 0);
+    MPI_Gather(&ownWords, 1, MPI_INT, words.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gather(&wallSeconds, 1, MPI_DOUBLE, walls.data(), 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    vector<int> displacements(words.size(), 0);
+    for (size_t r = 1; r < words.size(); ++r)
+        displacements[r] = displacements[r - 1] + words[r - 1];
+    vector<Sample> threads(rank == 0 ? (displacements.back() + words.back()) / Sample::words : 0);
+    MPI_Gatherv(samples.data(), ownWords, MPI_UINT64_T, threads.data(), words.data(), displacements.data(), MPI_UINT64_T, 0,
+                MPI_COMM_WORLD);
+    if (rank != 0)
+        return;
+
+    string json = string("{\"instrumentation\": ") + (instrumentation::enabled ? "true" : "false") +
+                  ", \"wallSeconds\": " + to_string(wallMaximum) + ", \"ranks\": " + to_string(size) +
+                  ", \"documentsPerSecond\": " +
+                  to_string(wallMaximum > 0 ? sum.counter(instrumentation::Documents) / wallMaximum : 0.0) + ", \"total\": ";
+    instrumentation::appendJson(json, sum);
+    json += ", \"maxPerRank\": ";
+    instrumentation::appendJson(json, maximum);
+    json += ", \"perRank\": [";
+    for (int r = 0; r < size; ++r)
+    {
+        auto first = threads.begin() + displacements[r] / Sample::words;
+        json += string(r > 0 ? ", " : "") + "{\"rank\": " + to_string(r) + ", \"wallSeconds\": " + to_string(walls[r]) + ", ";
+        instrumentation::appendGroupFields(json, vector<Sample>(first, first + words[r] / Sample::words), walls[r]);
+        json += "}";
+    }
+    json += "]}\n";
+
+    ofstream statsFile(path);
+    if (!statsFile.is_open())
+        std::cerr << "Error opening stats file for writing!" << std::endl;
+    statsFile << json;
+}
+
+/**
+ * @brief Scores the documents of every rank by TF-IDF and writes the scores on rank 0.
+ * @details The document frequencies of all ranks and their document counts are summed with a
+ *          single MPI_Allreduce, after which every rank scores the documents it classified from
+ *          their recorded term counts. Rank 0 gathers the scored documents and writes them in
+ *          the order of classification_results.txt, one line each in its format:
+ *          FileName:    Topic1;Score1,    Topic2;Score2,    ...
+ *          --top-k applies to the scores, --min-count only to counts.
+ * @param documents On rank 0, the documents in the order classification_results.txt lists them.
+ */
+void reportScores(const string& path, int rank, int size, const vector<string>& documents)
+{
+    instrumentation::ScopedTimer timer(instrumentation::Scoring);
+    TfIdfScorer scorer(matcher);
+    for (const auto& entry : termLog->entries())
+        scorer.addDocument(entry.second);
+    vector<uint64_t> totals = scorer.documentFrequencies();
+    totals.push_back(scorer.documents());
+    {
+        instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+        MPI_Allreduce(MPI_IN_PLACE, totals.data(), static_cast<int>(totals.size()), MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+    }
+    scorer.documents() = totals.back();
+    totals.pop_back();
+    scorer.documentFrequencies() = std::move(totals);
+    scorer.computeIdf();
+
+    // Every scored document as its NUL-terminated path followed by topicCount floats.
+    const size_t topicCount = matcher.topicCount();
+    string records;
+    for (const auto& [document, terms] : termLog->entries())
+    {
+        vector<float> scores = scorer.score(terms);
+        records.append(document).push_back('\0');
+        records.append(reinterpret_cast<const char*>(scores.data()), topicCount * sizeof(float));
+    }
+    int ownBytes = static_cast<int>(records.size());
+    vector<int> bytes(rank == 0 ? size : 0);
+    instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+    MPI_Gather(&ownBytes, 1, MPI_INT, bytes.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    vector<int> displacements(bytes.size(), 0);
+    for (size_t r = 1; r < bytes.size(); ++r)
+        displacements[r] = displacements[r - 1] + bytes[r - 1];
+    string all(rank == 0 ? displacements.back() + bytes.back() : 0, '\0');
+    MPI_Gatherv(records.data(), ownBytes, MPI_CHAR, all.data(), bytes.data(), displacements.data(), MPI_CHAR, 0,
+                MPI_COMM_WORLD);
+    wait.stop();
+    if (rank != 0)
+        return;
+
+    std::unordered_map<string_view, size_t> listed;
+    listed.reserve(documents.size());
+    for (size_t i = 0; i < documents.size(); ++i)
+        listed.emplace(documents[i], i);
+    // Listing position, path and scores of every document.
+    vector<std::tuple<size_t, string_view, const char*>> scored;
+    for (size_t offset = 0; offset < all.size();)
+    {
+        string_view document(all.data() + offset);
+        offset += document.size() + 1;
+        auto it = listed.find(document);
+        scored.emplace_back(it == listed.end() ? documents.size() : it->second, document, all.data() + offset);
+        offset += topicCount * sizeof(float);
+    }
+    std::sort(scored.begin(), scored.end());
+    ofstream scoresFile(path);
+    if (!scoresFile.is_open())
+        std::cerr << "Error opening scores file for writing!" << std::endl;
+    TopicSelection topK{selection.topK, 0};
+    vector<float> scores(topicCount);
+    for (const auto& [position, document, data] : scored)
+    {
+        std::memcpy(scores.data(), data, topicCount * sizeof(float));
+        scoresFile << getFileNameFromPath(document) << ":\t";
+        for (const auto& [topicId, score] : selectTopics(scores.data(), topicCount, topK))
+            scoresFile << matcher.topicName(topicId) << ';' << score << ",\t";
+        scoresFile << '\n';
+    }
+}
+
 /**
  * @brief Main function.
  * @param argc Number of command-line arguments.
  * @param argv Command-line arguments.
  * @return Status code.
  * @details This function is the entry point of the program.
- *          It initializes MPI, broadcasts the catalog to worker processes, and distributes
+ *          It initializes MPI with support for helper threads, broadcasts the compiled catalog to worker processes, and distributes
  *          document classification tasks among worker processes.
  *          The manager process reads the catalog, retrieves document paths, and distributes
- *          them to worker processes for classification.
- *          Worker processes receive their assigned documents, classify them, and write
- *          the results to an output file.
- *          Finally, the program calculates the execution time and prints it (only by rank 0).
+ *          them to worker processes for classification, either up front (--schedule static)
+ *          or in batches that idle workers pull from it (--schedule dynamic, the default).
+ *          With --manager-works (implied when running with a single process) the manager
+ *          classifies documents as well.
+ *          Worker processes receive their assigned documents, classify them, and send the
+ *          per-topic counts back to the manager, which writes the output file in document order.
+ *          Finally, the program calculates the execution time and prints it (only by rank 0);
+ *          with --stats rank 0 also writes the counters and stage timings of all ranks.
  */
 int main(int argc, char** argv)
+try
 {
     using std::chrono::high_resolution_clock;
     using std::chrono::duration_cast;
@@ -183,100 +1605,136 @@ int main(int argc, char** argv)
     using std::chrono::milliseconds;
 
     auto t1 = high_resolution_clock::now();
-    int rank, size;
-    MPI_Init(&argc, &argv);
+    int rank, size, provided;
+    // Helper threads (walker, pipeline, pool) never call MPI; only the main thread does.
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
-
-    if (size < 2)
+    Options options = parseArguments(argc, argv);
+    if (provided < MPI_THREAD_FUNNELED && options.threads > 1)
     {
-        cerr << "At least 2 processes are required: 1 manager and 1 worker." << endl;
-        MPI_Abort(MPI_COMM_WORLD, 1);
+        if (rank == 0)
+            std::cerr << "MPI library does not support threads; classifying on one thread per rank" << std::endl;
+        options.threads = 1;
     }
 
+    // With a single process there are no workers, so the manager has to classify everything itself.
+    if (size < 2)
+        options.managerWorks = true;
+    streamChunkSize = options.streamChunk;
+    selection = options.selection;
+    earlyStop = options.earlyStop;
+    if (!options.scores.empty())
+        termLog = std::make_unique<TermCountLog>();
+    if (options.pipeline)
+        pipelineStages = std::make_unique<PipelineOptions>(options.stages);
+    if (options.threads > 1)
+        rankPool = std::make_unique<WorkStealingPool>(options.threads);
+
     if (rank == 0)
     {
-        readCatalog();
-        std::stringstream ss{};
-        for (const auto& pair : catalog)
+        instrumentation::ScopedTimer timer(instrumentation::CatalogLoad);
+        const CaseFold fold = options.caseFold;
+        // "^weight" suffixes only mean something to scoring; otherwise terms are read verbatim.
+        const bool weighted = !options.scores.empty();
+        if (options.catalogCache.empty())
+        {
+            readCatalog(weighted);
+            matcher = AhoCorasick(catalog, true, fold);
+        }
+        else
         {
-            ss << pair.first << ":";
-            for (const auto& item : pair.second)
+            matcher = loadCompiledCatalog(catalogPath, options.catalogCache, [fold, weighted]
             {
-                ss << item << ",";
-            }
-            ss << ";";
+                readCatalog(weighted);
+                return AhoCorasick(catalog, true, fold);
+            }, fold, weighted);
         }
-
-        std::string serialized_catalog = ss.str();
-        int catalogSize = serialized_catalog.size();
-        MPI_Bcast(&catalogSize, 1, MPI_INT, 0, MPI_COMM_WORLD);
-        MPI_Bcast(&serialized_catalog[0], serialized_catalog.size(), MPI_CHAR, 0, MPI_COMM_WORLD);
     }
+    if (options.sharedCatalog)
+        broadcastMatcherShared(rank);
+    else
+        broadcastMatcher(rank);
+    matcher.setPrefilter(options.prefilter);
+    engine = options.engine;
+    if (engine == Engine::Words)
+        wordMatcher = WordMatcher(matcher);
 
-    MPI_Barrier(MPI_COMM_WORLD);
+    {
+        instrumentation::ScopedTimer wait(instrumentation::MpiWait);
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
 
+    // Rank 0's listing, in the order classification_results.txt is written in.
+    vector<string> documents;
     if (rank == 0)
     {
-        vector<string> documents = getAllFilesInDirectory("./sample_documents", { ".txt", ".html", ".tex" });
+        const string documentRoot = "./sample_documents";
+        const vector<string> extensions = { ".txt", ".html", ".tex" };
 
-        int numDocumentsPerWorker = documents.size() / (size - 1);
-        int remainingDocuments = documents.size() % (size - 1);
-
-        int startIdx = 0;
-
-        for (int i = 1; i < size; ++i)
+        if (!options.incremental.empty() || !options.checkpoint.empty())
         {
-            int numDocsToSend = numDocumentsPerWorker + (i <= remainingDocuments ? 1 : 0);
-            MPI_Send(&numDocsToSend, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
-
-            for (int j = 0; j < numDocsToSend; ++j)
+            // Have failed MPI calls return, so a final checkpoint can be stored before the job is aborted.
+            if (!options.checkpoint.empty())
+                MPI_Comm_set_errhandler(MPI_COMM_WORLD, MPI_ERRORS_RETURN);
+            classifyWithIndex(options, size, documentRoot, extensions);
+        }
+        else if (options.schedule == Schedule::Static && options.order == DocumentOrder::Listing)
+        {
+            documents = getAllFilesInDirectory(documentRoot, extensions, options.walkThreads);
+            OrderedResultWriter writer("classification_results.txt", documents, matcher.topicCount(), options.binaryResults,
+                                       options.resultEncoding);
+            distributeStatic(documents, size, options.managerWorks, writer);
+        }
+        else if (options.order != DocumentOrder::Listing)
+        {
+            // A planned order needs the size of every document, so the tree is listed in full first.
+            documents = getAllFilesInDirectory(documentRoot, extensions, options.walkThreads);
+            OrderedResultWriter writer("classification_results.txt", documents, matcher.topicCount(), options.binaryResults,
+                                       options.resultEncoding);
+            vector<string> pending = documents;
+            vector<size_t> scheduled(documents.size());
+            std::iota(scheduled.begin(), scheduled.end(), size_t{0});
+            vector<size_t> ends = planSchedule(pending, scheduled, options, size);
+            writer.setSchedule(std::move(scheduled));
+            if (options.schedule == Schedule::Static)
             {
-                int docSize = documents[startIdx].size() + 1;
-                MPI_Send(&docSize, 1, MPI_INT, i, 0, MPI_COMM_WORLD);
-                MPI_Send(&documents[startIdx][0], documents[startIdx].size() + 1, MPI_CHAR, i, 0, MPI_COMM_WORLD);
-                ++startIdx;
+                distributeStatic(pending, size, options.managerWorks, writer, ends);
             }
-        }
-    }
-    else
-    {
-        // Worker processes
-        int catalogSize;
-        MPI_Bcast(&catalogSize, 1, MPI_INT, 0, MPI_COMM_WORLD);
-        char* received_catalog = new char[catalogSize];
-        MPI_Bcast(received_catalog, catalogSize, MPI_CHAR, 0, MPI_COMM_WORLD);
-
-        std::stringstream ss;
-        ss << received_catalog;
-        std::string entry;
-
-        while (std::getline(ss, entry, ';'))
-        {
-            std::istringstream iss(entry);
-            std::string category;
-            std::getline(iss, category, ':');
-            std::string item;
-            std::vector<std::string> items;
-            while (std::getline(iss, item, ','))
+            else
             {
-                items.push_back(item);
+                BatchScheduler scheduler(pending, nullptr, options.batchSize, options.batchBytes);
+                scheduler.setBatchEnds(std::move(ends));
+                serveBatches(scheduler, size, options.managerWorks, writer);
             }
-            catalog[category] = items;
         }
-        int numDocsToReceive;
-        MPI_Recv(&numDocsToReceive, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-        // Receive documents
-        for (int i = 0; i < numDocsToReceive; ++i)
+        else
         {
-            int docSize;
-            MPI_Recv(&docSize, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            char document[docSize];
-            MPI_Recv(document, docSize, MPI_CHAR, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            classifyDocument(document);
+            // Documents are handed out while the tree is still being walked.
+            DirectoryWalker walker(documentRoot, extensions, options.walkThreads, options.batchBytes > 0);
+            OrderedResultWriter writer("classification_results.txt", documents, matcher.topicCount(), options.binaryResults,
+                                       options.resultEncoding);
+            BatchScheduler scheduler(documents, &walker, options.batchSize, options.batchBytes);
+            serveBatches(scheduler, size, options.managerWorks, writer);
         }
     }
+    else
+    {
+        // Worker processes
+        if (options.schedule == Schedule::Static)
+            receiveStatic();
+        else
+            requestBatches();
+    }
+    rankPool.reset();
+    if (termLog)
+        reportScores(options.scores, rank, size, documents);
+    if (!options.stats.empty())
+    {
+        duration<double> elapsed = high_resolution_clock::now() - t1;
+        reportStats(options.stats, rank, size, elapsed.count());
+    }
+    releaseSharedCatalog();
     MPI_Finalize();
     auto t2 = high_resolution_clock::now();
     if(rank == 0) {
@@ -288,3 +1746,13 @@ int main(int argc, char** argv)
 
     return 0;
 }
+catch (const std::exception& error)
+{
+    // The other ranks may be blocked in a collective or waiting for work; take the whole job down.
+    std::cerr << error.what() << std::endl;
+    int initialized = 0;
+    MPI_Initialized(&initialized);
+    if (initialized)
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    return 1;
+}
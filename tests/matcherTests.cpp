@@ -0,0 +1,620 @@
+/**
+@file matcherTests.cpp
+@brief Behavioural tests of the matching building blocks, run by ctest.
+
+Every test compares the optimised code with a plain reference: the std::string::find loop the
+classifiers used before the catalog was compiled into an automaton. Random catalogs and texts
+come from a fixed seed, so a failure reproduces on every run.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "ahoCorasick.h"
+#include "caseFold.h"
+#include "catalog.h"
+#include "catalogCache.h"
+#include "documentReader.h"
+#include "prefilter.h"
+#include "resultFile.h"
+#include "resultIndex.h"
+
+namespace {
+
+int failures = 0;
+
+/**
+ * @brief Records a failure unless condition holds.
+ */
+void expect(bool condition, const std::string& what)
+{
+    if (!condition) {
+        ++failures;
+        std::cerr << "FAILED: " << what << '\n';
+    }
+}
+
+std::string describe(const std::vector<uint32_t>& counts)
+{
+    std::string text = "{";
+    for (size_t i = 0; i < counts.size(); ++i) {
+        text += (i == 0 ? "" : ", ") + std::to_string(counts[i]);
+    }
+    return text + "}";
+}
+
+void expectCounts(const std::vector<uint32_t>& actual, const std::vector<uint32_t>& expected, const std::string& what)
+{
+    expect(actual == expected, what + ": got " + describe(actual) + ", expected " + describe(expected));
+}
+
+/**
+ * @brief The original classifier: one non-overlapping find loop per term of every topic.
+ * @param joinLines Drop line breaks first, as the getline loop that read documents did.
+ */
+std::vector<uint32_t> referenceCounts(const Catalog& catalog, std::string text, bool joinLines)
+{
+    if (joinLines) {
+        text.erase(std::remove(text.begin(), text.end(), '\n'), text.end());
+    }
+    std::vector<uint32_t> counts(catalog.topicCount(), 0);
+    for (size_t topic = 0; topic < catalog.topicCount(); ++topic) {
+        for (size_t i = 0; i < catalog.termCount(topic); ++i) {
+            std::string term(catalog.term(topic, i));
+            if (term.empty()) {
+                continue;
+            }
+            for (size_t pos = text.find(term); pos != std::string::npos; pos = text.find(term, pos + term.size())) {
+                ++counts[topic];
+            }
+        }
+    }
+    return counts;
+}
+
+/**
+ * @brief Random text over a small alphabet, so terms overlap and repeat often.
+ */
+std::string randomText(std::mt19937& random, std::string_view alphabet, size_t maxLength)
+{
+    std::string text(std::uniform_int_distribution<size_t>(0, maxLength)(random), ' ');
+    std::uniform_int_distribution<size_t> letter(0, alphabet.size() - 1);
+    for (char& c : text) {
+        c = alphabet[letter(random)];
+    }
+    return text;
+}
+
+/**
+ * @brief Random catalog text; terms may repeat within and across topics.
+ */
+std::string randomCatalog(std::mt19937& random)
+{
+    std::string text;
+    size_t topics = std::uniform_int_distribution<size_t>(1, 5)(random);
+    for (size_t topic = 0; topic < topics; ++topic) {
+        text += "Topic" + std::to_string(topic) + "@%";
+        size_t terms = std::uniform_int_distribution<size_t>(1, 6)(random);
+        for (size_t i = 0; i < terms; ++i) {
+            std::string term;
+            do {
+                term = randomText(random, "abc", 4);
+            } while (term.empty());
+            text += (i == 0 ? "" : ",") + term;
+        }
+        text += '\n';
+    }
+    return text;
+}
+
+/**
+ * @brief A file in the temporary directory, removed again at the end of the test.
+ */
+class TemporaryFile {
+public:
+    explicit TemporaryFile(const std::string& name, std::string_view contents = {})
+        : path_(std::filesystem::temp_directory_path() / ("matcherTests-" + name))
+    {
+        std::ofstream(path_, std::ios::binary) << contents;
+    }
+
+    ~TemporaryFile()
+    {
+        std::error_code error;
+        std::filesystem::remove(path_, error);
+    }
+
+    std::string path() const { return path_.string(); }
+
+    void write(std::string_view contents) const { std::ofstream(path_, std::ios::binary) << contents; }
+
+private:
+    std::filesystem::path path_;
+};
+
+/**
+ * @brief The tokenize() the catalog used to be parsed with.
+ */
+std::vector<std::string> referenceTokenize(const std::string& s, const std::string& delimiter)
+{
+    std::vector<std::string> tokens;
+    size_t start = 0;
+    size_t end = s.find(delimiter);
+    while (end != std::string::npos) {
+        tokens.push_back(s.substr(start, end - start));
+        start = end + delimiter.size();
+        end = s.find(delimiter, start);
+    }
+    tokens.push_back(s.substr(start));
+    return tokens;
+}
+
+void testOverlappingTerms()
+{
+    // "aa" restarts after every hit, and terms of one topic are searched independently.
+    Catalog catalog("A@%aa\nB@%a,aa\nC@%ab,b,abc\n");
+    AhoCorasick matcher(catalog);
+    expectCounts(matcher.countTopics("aaaa"), {2, 6, 0}, "overlapping terms in aaaa");
+    expectCounts(matcher.countTopics("aaa"), {1, 4, 0}, "overlapping terms in aaa");
+    expectCounts(matcher.countTopics("abcab"), {0, 2, 5}, "nested terms in abcab");
+    expectCounts(matcher.countTopics("aaa", MatchMode::Overlapping), {2, 5, 0}, "overlapping mode");
+}
+
+void testRepeatedTerms()
+{
+    // A term listed twice under one topic counts twice; a term shared by topics counts for each.
+    Catalog catalog("A@%x,x\nB@%x,y\nC@%,y\n");
+    AhoCorasick matcher(catalog);
+    expectCounts(matcher.countTopics("x y x"), {4, 3, 1}, "duplicate and shared terms");
+    expectCounts(matcher.countTopics(""), {0, 0, 0}, "empty text");
+}
+
+void testTermWeights()
+{
+    // Suffixes are only weights when asked for; otherwise "x^2" is a term like any other.
+    const std::string text = "A@%stock^2.5,market,x^,^3\nB@%y^nope\n";
+    Catalog plain(text);
+    Catalog weighted(text, true);
+    expect(!plain.weighted() && plain.term(0, 0) == "stock^2.5" && plain.termWeight(0, 0) == 1.0f,
+           "weights are not parsed by default");
+    expect(weighted.weighted() && weighted.term(0, 0) == "stock" && weighted.termWeight(0, 0) == 2.5f,
+           "weights are parsed when asked for");
+    expect(weighted.term(0, 2) == "x^" && weighted.term(0, 3) == "^3" && weighted.term(1, 0) == "y^nope" &&
+               weighted.termWeight(1, 0) == 1.0f,
+           "suffixes that are not weights stay part of the term");
+    expectCounts(AhoCorasick(plain).countTopics("stock^2.5 stock"), {1, 0}, "verbatim term matches with its suffix");
+    expectCounts(AhoCorasick(weighted).countTopics("stock^2.5 stock"), {2, 0}, "weighted term matches without it");
+    expect(!AhoCorasick(plain).weighted() && AhoCorasick(weighted).weighted(), "weights are recorded in the image");
+}
+
+void testJoinLines()
+{
+    Catalog catalog("A@%hello world\nB@%ab\n");
+    AhoCorasick joined(catalog);
+    AhoCorasick separate(catalog, false);
+    std::string text = "hello wo\nrld a\nb\n\nab";
+    expectCounts(joined.countTopics(text), referenceCounts(catalog, text, true), "terms across line breaks");
+    expectCounts(joined.countTopics(text), {1, 2}, "terms across line breaks");
+    expectCounts(separate.countTopics(text), {0, 1}, "line breaks kept");
+}
+
+void testRandomCatalogs()
+{
+    std::mt19937 random(20261014);
+    for (int round = 0; round < 500; ++round) {
+        std::string catalogText = randomCatalog(random);
+        Catalog catalog(catalogText);
+        for (bool joinLines : {true, false}) {
+            AhoCorasick matcher(catalog, joinLines);
+            for (int document = 0; document < 10; ++document) {
+                std::string text = randomText(random, "abc\nx", 200);
+                expectCounts(matcher.countTopics(text), referenceCounts(catalog, text, joinLines),
+                             "random catalog " + std::to_string(round) + (joinLines ? " joined" : " separate"));
+            }
+        }
+    }
+}
+
+void testChunkBoundaries()
+{
+    // Every split of the text, down to one byte per chunk, must count like a single pass.
+    std::mt19937 random(10);
+    for (int round = 0; round < 200; ++round) {
+        Catalog catalog(randomCatalog(random));
+        std::string text = randomText(random, "abc\nx", 200);
+        for (bool joinLines : {true, false}) {
+            AhoCorasick matcher(catalog, joinLines);
+            for (MatchMode mode : {MatchMode::NonOverlapping, MatchMode::Overlapping}) {
+                std::vector<MatchPosition> expectedPositions;
+                std::vector<uint32_t> expected = matcher.countTopics(text, mode, expectedPositions);
+                size_t maxChunk = std::uniform_int_distribution<size_t>(1, 16)(random);
+                AhoCorasick::StreamCounter counter(matcher, mode);
+                std::vector<MatchPosition> positions;
+                for (size_t begin = 0; begin < text.size();) {
+                    size_t length = std::uniform_int_distribution<size_t>(1, maxChunk)(random);
+                    counter.feed(std::string_view(text).substr(begin, length), &positions);
+                    begin += length;
+                }
+                std::string what = "chunks of up to " + std::to_string(maxChunk) + " bytes, round " + std::to_string(round);
+                expectCounts(counter.topicCounts(), expected, what);
+                if (joinLines) {
+                    // Line breaks skipped in an earlier chunk are not known any more (see feed()).
+                    continue;
+                }
+                expect(std::equal(positions.begin(), positions.end(), expectedPositions.begin(), expectedPositions.end(),
+                                  [](const MatchPosition& a, const MatchPosition& b) {
+                                      return a.topic == b.topic && a.begin == b.begin && a.end == b.end;
+                                  }),
+                       what + ": positions differ");
+            }
+        }
+    }
+
+    // forEachChunk hands out the file in order, in chunks of at most the chunk size.
+    std::string text = "hello wo\nrld\nhello world";
+    TemporaryFile file("chunks.txt", text);
+    Catalog catalog("A@%hello world\n");
+    AhoCorasick matcher(catalog);
+    for (size_t chunkSize = 1; chunkSize <= text.size() + 1; ++chunkSize) {
+        std::string read;
+        bool small = true;
+        AhoCorasick::StreamCounter counter(matcher);
+        forEachChunk(file.path().c_str(), chunkSize, [&](std::string_view chunk) {
+            small = small && chunk.size() <= chunkSize;
+            read += chunk;
+            counter.feed(chunk);
+        });
+        std::string what = "forEachChunk with " + std::to_string(chunkSize) + "-byte chunks";
+        expect(read == text && small, what + ": chunks differ from the file");
+        expectCounts(counter.topicCounts(), {2}, what);
+    }
+}
+
+void testPrefilter()
+{
+    // Texts are mostly bytes no term starts with, so the kernels skip long runs, across blocks.
+    std::mt19937 random(11);
+    std::vector<prefilter::Kernel> kernels;
+    for (prefilter::Kernel kernel : {prefilter::Kernel::Scalar, prefilter::Kernel::Sse42, prefilter::Kernel::Avx2,
+                                     prefilter::Kernel::Neon, prefilter::Kernel::Auto}) {
+        if (prefilter::isSupported(kernel)) {
+            kernels.push_back(kernel);
+        }
+    }
+    for (int round = 0; round < 200; ++round) {
+        Catalog catalog(randomCatalog(random));
+        std::string text = randomText(random, "xyz \n\nxyzxyzxyzxyzabc", 600);
+        for (bool joinLines : {true, false}) {
+            AhoCorasick matcher(catalog, joinLines);
+            matcher.setPrefilter(prefilter::Kernel::Off);
+            std::vector<MatchPosition> expectedPositions;
+            std::vector<uint32_t> expected = matcher.countTopics(text, MatchMode::NonOverlapping, expectedPositions);
+            expectCounts(expected, referenceCounts(catalog, text, joinLines), "prefilter off");
+            for (prefilter::Kernel kernel : kernels) {
+                matcher.setPrefilter(kernel);
+                std::vector<MatchPosition> positions;
+                std::string what = "prefilter kernel " + std::to_string(static_cast<int>(kernel)) + ", round " +
+                                   std::to_string(round) + (joinLines ? " joined" : " separate");
+                expectCounts(matcher.countTopics(text, MatchMode::NonOverlapping, positions), expected, what);
+                expect(std::equal(positions.begin(), positions.end(), expectedPositions.begin(), expectedPositions.end(),
+                                  [](const MatchPosition& a, const MatchPosition& b) {
+                                      return a.topic == b.topic && a.begin == b.begin && a.end == b.end;
+                                  }),
+                       what + ": positions differ");
+            }
+        }
+    }
+}
+
+void testCatalogParsing()
+{
+    // The old parser: a std::map from topic to tokenize(terms, ","), first definition wins.
+    std::mt19937 random(13);
+    for (int round = 0; round < 500; ++round) {
+        std::string text = randomText(random, "ab,,@%\n", 80);
+        std::map<std::string, std::vector<std::string>> expected;
+        for (const std::string& line : referenceTokenize(text, "\n")) {
+            std::vector<std::string> parts = referenceTokenize(line, "@%");
+            if (parts.size() > 1) {
+                expected.emplace(parts[0], referenceTokenize(parts[1], ","));
+            }
+        }
+        Catalog catalog(text);
+        std::map<std::string, std::vector<std::string>> parsed;
+        for (size_t topic = 0; topic < catalog.topicCount(); ++topic) {
+            std::vector<std::string>& terms = parsed[std::string(catalog.topicName(topic))];
+            for (size_t i = 0; i < catalog.termCount(topic); ++i) {
+                terms.emplace_back(catalog.term(topic, i));
+            }
+        }
+        expect(parsed == expected && catalog.topicCount() == expected.size(), "catalog parsed from \"" + text + "\"");
+
+        std::vector<std::string> tokens;
+        forEachToken(text, ",", [&](std::string_view token) { tokens.emplace_back(token); });
+        expect(tokens == referenceTokenize(text, ","), "tokens of \"" + text + "\"");
+    }
+}
+
+void testIndexReuse()
+{
+    Catalog catalog("A@%ab\nB@%b\n");
+    AhoCorasick matcher(catalog);
+    TemporaryFile indexFile("results.index");
+    TemporaryFile same("same.txt", "abab");
+    TemporaryFile touched("touched.txt", "ab b");
+    TemporaryFile edited("edited.txt", "abab");
+    std::vector<std::string> paths {same.path(), touched.path(), edited.path()};
+
+    // Classifies every document of one run and returns the documents that were read.
+    auto run = [&](uint64_t catalogVersion) {
+        ResultIndex index(indexFile.path(), catalogVersion, matcher.topicCount());
+        std::vector<std::string> classified;
+        for (const std::string& path : paths) {
+            std::vector<uint32_t> counts = index.classify(path, [&](uint64_t& hash) {
+                classified.push_back(path);
+                MappedDocument document(path);
+                hash = fnv1a64(document.text(), hash);
+                return matcher.countTopics(document.text());
+            });
+            expectCounts(counts, matcher.countTopics(MappedDocument(path).text()), "counts of " + path);
+        }
+        index.store();
+        return classified;
+    };
+    const uint64_t version = ResultIndex::catalogVersion(matcher, "automaton");
+    expect(run(version) == paths, "first run classifies every document");
+    expect(run(version).empty(), "unchanged documents are reused");
+
+    // Same contents with a new modification time are reused; same size with new contents are not.
+    auto later = [](const std::string& path) {
+        std::filesystem::last_write_time(path, std::filesystem::last_write_time(path) + std::chrono::seconds(5));
+    };
+    later(touched.path());
+    edited.write("bbbb");
+    later(edited.path());
+    expect(run(version) == std::vector<std::string> {edited.path()}, "only the edited document is classified");
+    expect(run(version).empty(), "edited document is reused after it was recorded");
+    // The hash folded in while classifying must be the one lookup computes from the file.
+    later(edited.path());
+    expect(run(version).empty(), "hash recorded while classifying matches the contents");
+    expect(run(version + 1) == paths, "another catalog version classifies every document");
+}
+
+void testResultFileRoundTrip()
+{
+    // Mostly zero counts with a few large ones, so every encoding has something to compress.
+    std::mt19937 random(25);
+    const std::vector<std::string> topics {"", "Sports", "Science", "Politics", "Art"};
+    std::vector<std::string> documents;
+    std::vector<std::vector<uint32_t>> counts;
+    for (size_t document = 0; document < 1000; ++document) {
+        documents.push_back("./sample_documents/" + std::string(document % 7, 'd') + std::to_string(document) + ".txt");
+        std::vector<uint32_t>& row = counts.emplace_back(topics.size(), 0);
+        for (uint32_t& count : row) {
+            uint32_t kind = std::uniform_int_distribution<uint32_t>(0, 9)(random);
+            count = kind < 6 ? 0 : kind < 9 ? kind : std::uniform_int_distribution<uint32_t>()(random);
+        }
+    }
+
+    TemporaryFile file("results.bin");
+    for (CountEncoding encoding : {CountEncoding::Dense, CountEncoding::Sparse, CountEncoding::Packed, CountEncoding::Auto}) {
+        for (size_t blockDocuments : {size_t {1}, size_t {7}, size_t {4096}}) {
+            {
+                ResultFileWriter writer(file.path(), topics, encoding, blockDocuments);
+                for (size_t document = 0; document < documents.size(); ++document) {
+                    writer.add(documents[document], counts[document].data());
+                }
+            }
+            std::string what = "encoding " + std::to_string(static_cast<int>(encoding)) + ", blocks of " +
+                               std::to_string(blockDocuments);
+            ResultFileReader reader(file.path());
+            expect(reader.documentCount() == documents.size() && reader.topicCount() == topics.size(), what + ": sizes");
+            for (size_t topic = 0; topic < topics.size(); ++topic) {
+                expect(reader.topicName(topic) == topics[topic], what + ": topic " + std::to_string(topic));
+            }
+            for (size_t document = 0; document < documents.size(); ++document) {
+                std::vector<uint32_t> sparse(topics.size(), 0);
+                reader.forEachCount(document, [&](size_t topic, uint32_t count) { sparse[topic] += count; });
+                if (reader.documentName(document) != documents[document] || reader.counts(document) != counts[document] ||
+                    sparse != counts[document]) {
+                    expect(false, what + ": document " + std::to_string(document));
+                    break;
+                }
+            }
+        }
+    }
+
+    // A file without its block index, as left by an interrupted run, is rejected.
+    std::string bytes(MappedDocument(file.path()).text());
+    file.write(std::string_view(bytes).substr(0, bytes.size() - 8));
+    bool rejected = false;
+    try {
+        ResultFileReader reader(file.path());
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    expect(rejected, "truncated result file is rejected");
+}
+
+void testCaseFolding()
+{
+    Catalog catalog("A@%hello\nB@%\xc3\xa4pfel,\xcf\x83\xce\xbf\xcf\x86\xce\xaf\xce\xb1\nC@%stra\xc3\x9f" "e\n");
+    AhoCorasick ascii(catalog, true, CaseFold::Ascii);
+    AhoCorasick unicode(catalog, true, CaseFold::Unicode);
+    // HeLLo, \xc3\x84PFEL (Ä), \xce\xa3\xce\x9f\xce\xa6\xce\x8a\xce\x91 (ΣΟΦΊΑ), STRASSE
+    std::string text = "HeLLo h\nELLO \xc3\x84PFEL \xce\xa3\xce\x9f\xce\xa6\xce\x8a\xce\x91 STRASSE";
+    expectCounts(ascii.countTopics(text), {2, 0, 0}, "ASCII folding");
+    expectCounts(unicode.countTopics(text), {2, 2, 0}, "Unicode folding");
+    expectCounts(AhoCorasick(catalog).countTopics(text), {0, 0, 0}, "no folding");
+    expect(ascii.caseFold() == CaseFold::Ascii && AhoCorasick::fromImage(unicode.imageData(), unicode.imageSize()).caseFold() ==
+                                                          CaseFold::Unicode,
+           "folding is kept in the image");
+
+    // Folded matching is exact matching of folded terms in folded text, for every kernel and split.
+    const std::vector<std::string> pieces {"a", "A", "b", "B", "\xc3\xa9", "\xc3\x89", "\xd0\x96", "\xd0\xb6", "\xce\xa3",
+                                           "\xcf\x83", "\xcf\x82", "\xc2\xb5", "\xce\xbc", "\xe2\x82\xac", "\n", " "};
+    auto randomPieces = [&](std::mt19937& random, size_t maxCount) {
+        std::string text;
+        for (size_t i = std::uniform_int_distribution<size_t>(1, maxCount)(random); i > 0; --i) {
+            text += pieces[std::uniform_int_distribution<size_t>(0, pieces.size() - 1)(random)];
+        }
+        return text;
+    };
+    std::mt19937 random(29);
+    for (int round = 0; round < 200; ++round) {
+        for (CaseFold fold : {CaseFold::Ascii, CaseFold::Unicode}) {
+            std::string catalogText;
+            std::string foldedText;
+            for (int topic = 0; topic < 4; ++topic) {
+                std::string line = "T" + std::to_string(topic) + "@%";
+                std::string foldedLine = line;
+                for (int i = 0; i < 3; ++i) {
+                    std::string term = randomPieces(random, 3);
+                    std::replace(term.begin(), term.end(), '\n', 'x');
+                    line += (i == 0 ? "" : ",") + term;
+                    foldedLine += (i == 0 ? "" : ",") + caseFold::foldTerm(term, fold);
+                }
+                catalogText += line + '\n';
+                foldedText += foldedLine + '\n';
+            }
+            Catalog folded(foldedText);
+            AhoCorasick matcher(Catalog(catalogText), true, fold);
+            std::string text = randomPieces(random, 200);
+            std::vector<uint32_t> expected = referenceCounts(folded, caseFold::foldTerm(text, fold), true);
+            std::string what = std::string(fold == CaseFold::Ascii ? "ASCII" : "Unicode") + " folding, round " +
+                               std::to_string(round);
+            for (prefilter::Kernel kernel : {prefilter::Kernel::Off, prefilter::Kernel::Auto}) {
+                matcher.setPrefilter(kernel);
+                expectCounts(matcher.countTopics(text), expected, what);
+            }
+            // Chunks of one byte split every two-byte character.
+            for (size_t chunk : {size_t {1}, size_t {3}}) {
+                AhoCorasick::StreamCounter counter(matcher);
+                for (size_t i = 0; i < text.size(); i += chunk) {
+                    counter.feed(std::string_view(text).substr(i, chunk));
+                }
+                expectCounts(counter.topicCounts(), expected, what + ", chunks of " + std::to_string(chunk));
+            }
+        }
+    }
+}
+
+void testCatalogCache()
+{
+    TemporaryFile catalogFile("catalog.txt", "A@%ab\nB@%b\n");
+    TemporaryFile cacheFile("catalog.cache");
+    int compiles = 0;
+    auto load = [&] {
+        return loadCompiledCatalog(catalogFile.path(), cacheFile.path(), [&] {
+            ++compiles;
+            return AhoCorasick(Catalog::load(catalogFile.path()));
+        });
+    };
+    auto cachedMtime = [&] {
+        CatalogCacheHeader header{};
+        std::memcpy(&header, MappedDocument(cacheFile.path()).text().data(), sizeof(header));
+        return header.source.mtime;
+    };
+    expectCounts(load().countTopics("abab"), {2, 2}, "compiled catalog");
+    expectCounts(load().countTopics("abab"), {2, 2}, "cached catalog");
+    expect(compiles == 1, "a valid cache is used");
+
+    // A touched catalog is confirmed by its hash once, and the cache then records the new time.
+    std::filesystem::last_write_time(catalogFile.path(),
+                                     std::filesystem::last_write_time(catalogFile.path()) + std::chrono::seconds(5));
+    CatalogKey touched = catalogCache::statCatalog(catalogFile.path());
+    expectCounts(load().countTopics("abab"), {2, 2}, "touched catalog");
+    expect(compiles == 1 && cachedMtime() == touched.mtime, "touched catalog keeps its cache with the new time");
+
+    catalogFile.write("A@%ab\nB@%a\n");
+    expectCounts(load().countTopics("abab"), {2, 2}, "edited catalog");
+    expect(compiles == 2, "an edited catalog is compiled again");
+}
+
+void testCorruptImages()
+{
+    Catalog catalog("A@%ball,goal\nB@%atom,ball,\xc3\xa4pfel\n");
+    AhoCorasick matcher(catalog, true, CaseFold::Unicode);
+    const std::string text = "The BALL hit the goal, an atom split and \xc3\x84pfel fell.";
+    const size_t words = matcher.imageSize() / sizeof(uint32_t);
+
+    // Every 32-bit word of the image in turn holds an index far out of range. The image must be
+    // rejected or still be scanned within bounds; reading out of bounds would crash the test.
+    std::vector<uint64_t> image(matcher.imageSize() / sizeof(uint64_t));
+    const uint32_t huge = 0x7fffffff;
+    size_t lastRejected = 0;
+    for (size_t word = 0; word < words; ++word) {
+        std::memcpy(image.data(), matcher.imageData(), matcher.imageSize());
+        std::memcpy(reinterpret_cast<char*>(image.data()) + word * sizeof(uint32_t), &huge, sizeof(huge));
+        try {
+            AhoCorasick damaged = AhoCorasick::fromImage(image.data(), matcher.imageSize());
+            damaged.countTopics(text);
+            for (size_t topic = 0; topic < damaged.topicCount(); ++topic) {
+                damaged.topicName(topic);
+            }
+        } catch (const std::invalid_argument&) {
+            lastRejected = word;
+        }
+    }
+    // The dictionary links are the last section before the prefilter tables.
+    expect(lastRejected * sizeof(uint32_t) > matcher.imageSize() - sizeof(prefilter::Tables) - 64,
+           "damaged automaton tables are rejected");
+
+    // A cache file damaged the same way is compiled again instead of being used.
+    TemporaryFile catalogFile("corrupt-catalog.txt", "A@%ball,goal\nB@%atom,ball,\xc3\xa4pfel\n");
+    TemporaryFile cacheFile("corrupt-catalog.cache");
+    int compiles = 0;
+    auto load = [&] {
+        return loadCompiledCatalog(catalogFile.path(), cacheFile.path(), [&] {
+            ++compiles;
+            return AhoCorasick(Catalog::load(catalogFile.path()), true, CaseFold::Unicode);
+        });
+    };
+    const std::vector<uint32_t> expected = load().countTopics(text);
+    std::string cache(MappedDocument(cacheFile.path()).text());
+    CatalogCacheHeader header{};
+    std::memcpy(&header, cache.data(), sizeof(header));
+    std::memcpy(cache.data() + header.imageOffset + lastRejected * sizeof(uint32_t), &huge, sizeof(huge));
+    cacheFile.write(cache);
+    expectCounts(load().countTopics(text), expected, "damaged cache");
+    expect(compiles == 2, "a damaged cache is compiled again");
+}
+
+} // namespace
+
+int main()
+{
+    const std::vector<std::pair<const char*, std::function<void()>>> tests {
+        {"overlapping terms", testOverlappingTerms},
+        {"repeated terms", testRepeatedTerms},
+        {"join lines", testJoinLines},
+        {"term weights", testTermWeights},
+        {"catalog parsing", testCatalogParsing},
+        {"random catalogs", testRandomCatalogs},
+        {"chunk boundaries", testChunkBoundaries},
+        {"prefilter", testPrefilter},
+        {"catalog cache", testCatalogCache},
+        {"corrupt images", testCorruptImages},
+        {"index reuse", testIndexReuse},
+        {"result file round trip", testResultFileRoundTrip},
+        {"case folding", testCaseFolding},
+    };
+    for (const auto& [name, test] : tests) {
+        int before = failures;
+        test();
+        std::cout << (failures == before ? "ok      " : "FAILED  ") << name << '\n';
+    }
+    return failures == 0 ? 0 : 1;
+}